@@ -15,10 +15,14 @@
 #include <float.h>
 #include <math.h>
 #include <limits.h>		/* INT_MAX etc. */
+#include <stdint.h>		/* SIZE_MAX */
 #include <errno.h>
+#include <getopt.h>
 #include "zlib.h"
 #include "kseq.h"
 #include "kstring.h"
+#include "stats.h"
+#include "isa.h"
 
 KSEQ_INIT(gzFile, gzread);
 typedef enum { true, false } bool;
@@ -32,19 +36,19 @@ typedef enum { true, false } bool;
 #define MID                     600
 #define UPP                     700
 #define JUMP                    800
+#define LOW2                    900
+#define UPP2                    1000
 
-// scoring matrix and pointer matrix
+// pointer matrix; kern_fill() keeps the scores in strips, never whole
 typedef struct {
   unsigned int m;
   unsigned int n;
-  double **L;
-  double **M;
-  double **U;
-  double **J;
   int  **pointerL;
   int  **pointerM;
   int  **pointerU;
   int  **pointerJ;
+  int  **pointerL2; // long gap pieces, only allocated by add_long_gap_matrix()
+  int  **pointerU2;
 } matrix_t;
 
 //for alignment allows jump state with junctions
@@ -60,12 +64,199 @@ typedef struct {
 	int m; // match
 	int u; // unmatch
 	int j; // jump penality
+	int o2; // long gap open
+	int e2; // long gap extension
+	int f; // fusion jump penalty, between targets
 	bool s;
+	bool p; // two-piece affine gap
+	bool b; // both strands of s1
+	size_t max_mem; // planner memory budget in bytes, 0 for half the physical memory
+	double min_score; // alignments scoring less are dropped, -INFINITY for none
 	junction_t sites;
 } opt_t;
 
+typedef double (*align_f)(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
 
+/* index.c */
+int idx_align_reads(const char *idx_fn, const char *fn, opt_t *opt, align_f align, int mode, bool need_shorter);
+/* twopass.c */
+double align_fit_twopass(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_local_twopass(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+long fit_reverse(kstring_t *s1, kstring_t *s2, opt_t *opt, const char *site, size_t j_end, double max_score);
+int local_reverse(kstring_t *s1, kstring_t *s2, opt_t *opt, size_t i_end, size_t j_end, double max_score, size_t *di, size_t *dj);
+/* graph.c */
+double align_fit_graph(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+/* prune.c */
+typedef struct {
+	int q, bits;
+	uint64_t *set; // one bit per hashed q-gram of the target
+} qgram_t;
+bool prune_ok(int mode, const opt_t *opt);
+void qgram_build(qgram_t *g, const kstring_t *t);
+void qgram_free(qgram_t *g);
+double qgram_bound(const qgram_t *g, int mode, const kstring_t *s1, size_t n, const opt_t *opt);
+double prune_qgram(int mode, const kstring_t *s1, const kstring_t *s2, const opt_t *opt);
+/* exact.c */
+bool exact_ok(int mode, const opt_t *opt);
+bool exact_align(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, const opt_t *opt, double *score);
+/* kernel.c */
+#define KMODE_GLOBAL            0
+#define KMODE_LOCAL             1
+#define KMODE_FIT               2
+#define KMODE_OVERLAP           3
+#define KMODE_EDIT              4       // planner only, not a kern_fill() mode
+char *site_mask(const opt_t *opt, size_t n);
+double kern_fill(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, matrix_t *S, int *state, int *i_end, int *j_end);
+double kern_score(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, int *i_end, int *j_end);
+int kern_score_int(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, int *i_end, int *j_end);
+double kern_score_min(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, double min_score);
+/* strand.c */
+void revcomp(const kstring_t *s, kstring_t *rc);
+double align_both_strands(align_f align, int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, char *strand);
+/* diff.c */
+bool diff_exact(const opt_t *opt);
+double align_gla_diff(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_fit_diff(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+/* batch.c */
+#define BATCH_GLOBAL            0
+#define BATCH_LOCAL             1
+#define BATCH_EDIT              2
+typedef struct {
+	char *n1, *n2;
+	kstring_t s1, s2;
+	double score;
+} pair_t;
+void batch_score(pair_t **s, size_t k, opt_t *opt, int mode);
+/* shard.c */
+typedef struct {
+	char *name;
+	uint64_t len;   // bases
+	uint64_t off;   // byte offset of the first base
+	uint64_t lb;    // bases per line
+	uint64_t lw;    // bytes per line, with the newline
+} fai_rec_t;
+typedef struct {
+	size_t n;
+	fai_rec_t *r;
+} fai_t;
+typedef struct {
+	FILE *fp;
+	fai_t *fai;
+	size_t next, end;  // records [next, end) are left
+	uint64_t pos;      // offset of fp
+} shard_t;
+void fai_build(const char *fn, const char *out);
+fai_t *fai_load(const char *fn);
+void fai_destroy(fai_t *fai);
+void shard_parse(const char *s, int *i, int *n);
+shard_t *shard_open(const char *fn, int i, int n, size_t unit);
+long shard_read(shard_t *sh, const char **name, kstring_t *seq);
+void shard_close(shard_t *sh);
+/* prof.c */
+#define PROF_NEG                (INT32_MIN / 4) // unreachable, room for a few additions
+typedef struct {
+	int32_t *M, *L, *U, *J;
+} prow_t;
+/*
+ * M and L of columns [j0, n] from the previous row, returns max cM:
+ * cM[j] = max{pL, pM, pU, pJ+gate}[j-1] + s[j], at least floor
+ * cL[j] = max{pL[j]+e, pM[j]+o}
+ */
+typedef int32_t (*prof_ml_f)(const prow_t *p, prow_t *c, const int32_t *s, const int32_t *gate,
+		long j0, long n, int32_t o, int32_t e, int32_t floor);
+/*
+ * a gap state along the row, U[0] given:
+ * U[j] = max{M[j-1]+o+gate[j], U[j-1]+e}
+ * U and J of the recurrence; with U[j] - j*e it is a prefix max, so
+ * a vector takes log2(width) shifts instead of width dependent steps
+ */
+typedef void (*prof_gap_f)(int32_t *U, const int32_t *M, const int32_t *gate, long n, int32_t o, int32_t e);
+int prof_align_reads(const char *target_fn, const char *fn, opt_t *opt, int mode, int n_threads);
+void prof_kernels(prof_ml_f *ml, prof_gap_f *gap);
+/* fusion.c */
+int fusion_align_reads(const char *target_fn, const char *fn, opt_t *opt, int n_threads);
+/* band.c */
+double band_bound(const opt_t *opt, size_t m, size_t n, long w);
+size_t band_width(size_t m, size_t n, long w);
+double align_gla_band(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, long w);
+/* myers.c */
+#define MYERS_W                 64
+#define MYERS_HIGH              ((uint64_t)1 << (MYERS_W - 1))
+/*
+ * advance one block of Pv/Mv by one column with the horizontal
+ * difference hin into its first row; returns the one out of the row
+ * of bit high
+ */
+static inline int
+myers_block(uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high){
+	uint64_t Pv = *pv, Mv = *mv, hneg = hin < 0 ? 1 : 0, Xv, Xh, Ph, Mh;
+	int hout;
+	Xv = eq | Mv;
+	eq |= hneg;
+	Xh = (((eq & Pv) + Pv) ^ Pv) | eq;
+	Ph = Mv | ~(Xh | Pv);
+	Mh = Pv & Xh;
+	hout = (Ph & high ? 1 : 0) - (Mh & high ? 1 : 0); // no branch, its sign is random
+	Ph <<= 1;
+	Mh <<= 1;
+	Mh |= hneg;
+	Ph |= hin > 0 ? 1 : 0;
+	*pv = Mh | ~(Xv | Ph);
+	*mv = Ph & Xv;
+	return hout;
+}
+long edit_myers(const kstring_t *s1, const kstring_t *s2);
+/* hirsch.c */
+double align_gla_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_local_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_fit_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_overlap_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+/* ckpt.c */
+size_t ckpt_rows(size_t m, int ns);
+double ckpt_mem(int mode, size_t m, size_t n, const opt_t *opt);
+double align_ckpt(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+/* wfa.c */
+bool wfa_exact(const opt_t *opt);
+double align_gla_wfa(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_gla_biwfa(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+long edit_wfa(const kstring_t *s1, const kstring_t *s2, const opt_t *opt, double max_work);
+/* plan.c */
+#define ENG_FULL                0
+#define ENG_DIFF                1
+#define ENG_TWOPASS             2
+#define ENG_BAND                3
+#define ENG_SCORE               4
+#define ENG_MYERS               5
+#define ENG_HIRSCH              6
+#define ENG_CKPT                7
+#define ENG_WFA                 8
+#define ENG_EXACT               9
+#define ENG_QGRAM               10
+#define ENG_PRUNE               11
+#define ENG_N                   12
+typedef struct {
+	int engine;    // ENG_*, -1 when nothing fits the budget
+	double cost;   // estimated ns
+	double mem;    // estimated bytes
+	double full;   // bytes of the full matrices
+	double least;  // bytes of the smallest engine considered, fitting or not
+} plan_t;
+#define PLAN_OPT_MIN_SCORE      256     // --min-score, long option only
+extern const struct option plan_long_opts[];
+const char *plan_name(int engine);
+size_t plan_parse_mem(const char *s);
+size_t plan_budget(const opt_t *opt);
+void plan_pick(int mode, size_t m, size_t n, const opt_t *opt, bool tb, plan_t *pl);
+void plan_die_mem(size_t m, size_t n, double need, const opt_t *opt) __attribute__((noreturn));
+double plan_align(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+int edit_plan(kstring_t *s1, kstring_t *s2, opt_t *opt);
+double align_gla_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_local_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_fit_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
+double align_overlap_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt);
 
+
+static inline void die (char *format, ...) __attribute__((noreturn));
 static inline void die (char *format, ...)
 {
   va_list args ;
@@ -79,10 +270,12 @@ static inline void die (char *format, ...)
 }
 
 #define mycalloc(n,type) (type*)_mycalloc(n,sizeof(type))
-static inline void *_mycalloc (long number, int size)
+static inline void *_mycalloc (size_t number, size_t size)
 {
+  if (size != 0 && number > SIZE_MAX / size) die ("mycalloc: %zu x %zu bytes overflows size_t", number, size) ;
   void *p = (void*) calloc (number, size) ;
-  if (p == NULL) die ("mycalloc failure requesting %d of size %d bytes", number, size) ;
+  if (p == NULL) die ("mycalloc failure requesting %zu of size %zu bytes", number, size) ;
+  STATS_BYTES(number * size);
   return p ;
 }
 
@@ -107,7 +300,14 @@ static inline opt_t
 	opt->m =  1.0;
 	opt->u = -2.0;
 	opt->j = -10.0;
+	opt->o2 = -24.0;
+	opt->e2 = 0.0;
+	opt->f = -30.0;
 	opt->s = false;
+	opt->p = false;
+	opt->b = false;
+	opt->max_mem = 0;
+	opt->min_score = -INFINITY;
 	opt->sites.size = 0;	
 	opt->sites.pos = NULL;	
 	return opt;
@@ -119,21 +319,10 @@ static inline opt_t
 static inline matrix_t 
 *create_matrix(size_t m, size_t n){
 	size_t i, j; 
+	STATS_BEGIN(STATS_ALLOC);
 	matrix_t *S = mycalloc(1, matrix_t);
 	S->m = m;
 	S->n = n;
-	S->L = mycalloc(m+1, double*);
-	S->M = mycalloc(m+1, double*);
-	S->U = mycalloc(m+1, double*);
-	S->J = mycalloc(m+1, double*);
-
-	for (i = 0; i < m; i++) {      
-		S->M[i] = mycalloc(n, double);
-		S->L[i] = mycalloc(n, double);
-		S->U[i] = mycalloc(n, double);
-		S->J[i] = mycalloc(n, double);
-    }
-	
 	S->pointerM = mycalloc(m, int*);
 	S->pointerU = mycalloc(m, int*);
 	S->pointerL = mycalloc(m, int*);
@@ -144,9 +333,26 @@ static inline matrix_t
         S->pointerL[i] = mycalloc(n, int);
 		S->pointerJ[i] = mycalloc(n, int);
     }
+	STATS_END(STATS_ALLOC);
 	return S;
 }
 
+/*
+ * allocate the L2/U2 states of the two-piece affine gap
+ */
+static inline void
+add_long_gap_matrix(matrix_t *S){
+	size_t i;
+	STATS_BEGIN(STATS_ALLOC);
+	S->pointerL2 = mycalloc(S->m, int*);
+	S->pointerU2 = mycalloc(S->m, int*);
+	for (i = 0; i < S->m; i++) {
+		S->pointerL2[i] = mycalloc(S->n, int);
+		S->pointerU2[i] = mycalloc(S->n, int);
+	}
+	STATS_END(STATS_ALLOC);
+}
+
 /*
  * destory matrix
  */
@@ -154,18 +360,20 @@ static inline void
 destory_matrix(matrix_t *S){
 	if(S == NULL) die("destory_matrix: parameter error\n");
 	int i;
-	for(i = 0; i < S->m; i++){
-		if(S->L[i]) free(S->L[i]);
-		if(S->M[i]) free(S->M[i]);
-		if(S->U[i]) free(S->U[i]);
-		if(S->J[i]) free(S->J[i]);
-	}
 	for(i = 0; i < S->m; i++){
 		if(S->pointerL[i]) free(S->pointerL[i]);
 		if(S->pointerM[i]) free(S->pointerM[i]);
 		if(S->pointerU[i]) free(S->pointerU[i]);
 		if(S->pointerJ[i]) free(S->pointerJ[i]);
 	}
+	if(S->pointerL2 != NULL){
+		for(i = 0; i < S->m; i++){
+			free(S->pointerL2[i]);
+			free(S->pointerU2[i]);
+		}
+		free(S->pointerL2); free(S->pointerU2);
+	}
+	free(S->pointerL); free(S->pointerM); free(S->pointerU); free(S->pointerJ);
 	free(S);
 }
 
@@ -175,11 +383,12 @@ static inline char
 	int l = strlen(s);
 	char *ss = strdup(s);
 	free(s);
-	s = mycalloc(l, char);
+	s = mycalloc(l+1, char);
 	int i; for(i=0; i<l; i++){
 		s[i] = ss[l-i-1];
 	}
 	s[l] = '\0';
+	free(ss);
 	return s;
 }
 
@@ -209,6 +418,24 @@ kstring_destory(kstring_t *ks){
 	free(ks);
 }
 
+/*
+ * parse junction sites "p1|p2|..." from a fasta comment into sites
+ */
+static inline void 
+junction_parse(const char *comment, junction_t *sites){
+	if(comment == NULL || sites == NULL) die("junction_parse: parameter error");
+	kstring_t *tmp = mycalloc(1, kstring_t);
+	tmp->s = strdup(comment);
+	tmp->l = strlen(tmp->s);
+	int *fields, i, n;
+	fields = ksplit(tmp, '|', &n);
+	sites->size = n;
+	sites->pos = mycalloc(n, int);
+	for (i = 0; i < n; ++i) sites->pos[i] = atoi(tmp->s + fields[i]);
+	if(tmp) kstring_destory(tmp);
+	if(fields) free(fields);
+}
+
 /*
  * read two sequences as str1 and str2 from the fasta file;
  * read junctions sites to opt->sites;
@@ -219,7 +446,7 @@ kstring_read(char* fname, kstring_t *str1, kstring_t *str2, opt_t *opt){
 	// input check
 	if(fname == NULL || str1 == NULL || str2 == NULL || opt == NULL) 
 		die("kstring_read: input error");
-	
+	STATS_BEGIN(STATS_PARSE);
 	// variables declarision
 	int i, l; gzFile fp; kseq_t *seq;
 	char **tmp_seq = mycalloc(3, char*);
@@ -242,23 +469,15 @@ kstring_read(char* fname, kstring_t *str1, kstring_t *str2, opt_t *opt){
 	// read the junctions sites if opt != NULL and opt->s==ture
 	if(opt != NULL && opt->s == true){
 		if(tmp_comment[1] == NULL) die("fail to read junction sites");
-		kstring_t *tmp = mycalloc(1, kstring_t);
-		tmp->s = strdup(tmp_comment[1]);
-		tmp->l = strlen(tmp->s);
-		int *fields, i, n;
-		printf("%s\n", tmp->s);
-		fields = ksplit(tmp, '|', &n);
-		opt->sites.size = n;
-		opt->sites.pos = mycalloc(n, int);
-		for (i = 0; i < n; ++i) opt->sites.pos[i] = atoi(tmp->s + fields[i]);
-		if(tmp) kstring_destory(tmp);
-		if(fields) free(fields);
+		printf("%s\n", tmp_comment[1]);
+		junction_parse(tmp_comment[1], &opt->sites);
 	}
 	for(; i >=0; i--) if(tmp_seq[i]) free(tmp_seq[i]);	
 	free(tmp_seq);
 	if(tmp_comment) free(tmp_comment);
 	if(seq) kseq_destroy(seq);
 	gzclose(fp);
+	STATS_END(STATS_PARSE);
 }
 
 /*
@@ -293,24 +512,28 @@ edit_dist(kstring_t *s1, kstring_t *s2, opt_t *opt){
 	if(s1 == NULL || s2 == NULL || opt == NULL) die("edit_dist: parameter error\n");
 	double mismatch = opt->u;
 	double match = 0;
-	double gap = opt->o;
-	size_t m   = s1->l + 1;
 	size_t n   = s2->l + 1;
-	matrix_t *S = create_matrix(m, n);
-	size_t i, j, k, l;
-	for(i=0; i < S->m; i++) S->M[i][0] = i;
-	for(j=0; j < S->n; j++) S->M[0][j] = j;
+	// only the previous row is needed for the distance
+	double *p = mycalloc(n, double), *c = mycalloc(n, double), *t;
+	size_t i, j;
+	for(j=0; j < n; j++) p[j] = j;
+	STATS_BEGIN(STATS_FILL);
 	for(i = 1; i <= s1->l; i++){
+		c[0] = i;
 		for(j = 1; j <= s2->l; j++){
 			double new_score = ((s1->s[i-1] - s2->s[j-1]) == 0) ? match : mismatch;			
-			min3(&S->M[i][j],
-			      S->M[i][j-1] + 1, 
-				  S->M[i-1][j-1] + new_score, 
-				  S->M[i-1][j] + 1);
+			min3(&c[j],
+			      c[j-1] + 1, 
+				  p[j-1] + new_score, 
+				  p[j] + 1);
 		}
+		t = p; p = c; c = t;
 	}
-	int res = (int) S->M[s1->l][s2->l];
-	destory_matrix(S);
+	STATS_END(STATS_FILL);
+	STATS_CELLS(s1->l * s2->l);
+	int res = (int) p[s2->l];
+	free(p);
+	free(c);
 	return res;
 }
 
@@ -342,7 +565,10 @@ main_edit_dist(int argc, char *argv[]) {
 	ks2 = mycalloc(1, kstring_t);
 	kstring_read(argv[argc-1], ks1, ks2, opt);
 	if(ks1->s == NULL || ks2->s == NULL) die("fail to read sequence\n");
-	printf("edit_distance=%d\n", edit_dist(ks1, ks2, opt));
+	int dist = edit_plan(ks1, ks2, opt);
+	STATS_BEGIN(STATS_OUTPUT);
+	printf("edit_distance=%d\n", dist);
+	STATS_END(STATS_OUTPUT);
 	kstring_destory(ks1);
 	kstring_destory(ks2);
 	free(opt);
@@ -417,57 +643,13 @@ trace_back_gla(matrix_t *S, kstring_t *s1, kstring_t *s2, kstring_t *res_ks1, ks
 static inline double 
 align_gla(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
 	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL) die("align: parameter error\n");
-	double mismatch = opt->u;
-	double match = opt->m;
-	double gap = opt->o;
-	double extension = opt->e;
-	
 	size_t m   = s1->l + 1; size_t n   = s2->l + 1;
 	matrix_t *S = create_matrix(m, n);
-	// initlize DP matrix
-	S->M[0][0] = 0.0;
-	S->L[0][0] = S->U[0][0] = gap;
-	// initlize 0 column
-	int i, j;
-	for(i=1; i<S->m; i++){
-		S->L[i][0] = gap + extension*(i);
-		S->M[i][0] = -INFINITY;
-		S->U[i][0] = -INFINITY;
-	}
-	for(j=1; j<S->n; j++){
-		S->L[0][j] = -INFINITY;
-		S->M[0][j] = -INFINITY;
-		S->U[0][j] = gap + extension*(j);
-	}
-	//-------------------------------
-	double new_score;
-	int idx;
-	// recurrance relation
-	for(i=1; i<=s1->l; i++){
-		for(j=1; j<=s2->l; j++){
-			// MID
-			new_score = ((s1->s[i-1] - s2->s[j-1]) == 0) ? match : mismatch;
-			//new_score = match(s1->s[i-1], s2->s[j-1], BLOSUM62);
-			idx = max5(&S->M[i][j], S->L[i-1][j-1]+new_score, S->M[i-1][j-1]+new_score, S->U[i-1][j-1]+new_score, -INFINITY, -INFINITY);
-			if(idx==0) S->pointerM[i][j] = LOW;
-			if(idx==1) S->pointerM[i][j] = MID;
-			if(idx==2) S->pointerM[i][j] = UPP;
-			// LOW
-			idx = max5(&S->L[i][j], S->L[i-1][j]+extension, S->M[i-1][j]+gap, -INFINITY, -INFINITY, -INFINITY);
-			if(idx==0) S->pointerL[i][j] = LOW;
-			if(idx==1) S->pointerL[i][j] = MID;			
-			// UPP
-			idx = max5(&S->U[i][j], -INFINITY, S->M[i][j-1]+gap, S->U[i][j-1]+extension, -INFINITY, -INFINITY);
-			if(idx==1) S->pointerU[i][j] = MID;
-			if(idx==2) S->pointerU[i][j] = UPP;
-		}
-	}
-	double max_score; int max_state;
-	idx = max5(&max_score, S->L[s1->l][s2->l], S->M[s1->l][s2->l], S->U[s1->l][s2->l], -INFINITY, -INFINITY);
-	if(idx==0) max_state = LOW;
-	if(idx==1) max_state = MID;
-	if(idx==2) max_state = UPP;
+	int max_state;
+	double max_score = kern_fill(s1, s2, opt, KMODE_GLOBAL, S, &max_state, NULL, NULL);
+	STATS_BEGIN(STATS_TRACE);
 	trace_back_gla(S, s1, s2, r1, r2, max_state);	
+	STATS_END(STATS_TRACE);
 	destory_matrix(S);
 	return max_score;
 }
@@ -477,13 +659,20 @@ static inline int
 main_global_affine(int argc, char *argv[]) {
 	opt_t *opt = init_opt(); // initlize options with default settings
 	int c;
+	align_f align = align_gla_plan;
 	srand48(11);
-	while ((c = getopt(argc, argv, "m:u:o:e:j:s")) >= 0) {
+	while ((c = getopt_long(argc, argv, "m:u:o:e:j:sdwWbM:", plan_long_opts, NULL)) >= 0) {
 			switch (c) {
 			case 'm': opt->m = atoi(optarg); break;
 			case 'u': opt->u = atoi(optarg); break;
 			case 'o': opt->o = atoi(optarg); break;
 			case 'e': opt->e = atoi(optarg); break;
+			case 'd': align = align_gla_diff; break;
+			case 'w': align = align_gla_wfa; break;
+			case 'W': align = align_gla_biwfa; break;
+			case 'b': opt->b = true; break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case PLAN_OPT_MIN_SCORE: opt->min_score = atoi(optarg); break;
 			default: return 1;
 		}
 	}
@@ -494,6 +683,12 @@ main_global_affine(int argc, char *argv[]) {
 				fprintf(stderr, "         -u INT   mismatch penalty [%d]\n", opt->u);
 				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
 				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -d       int8 difference-recurrence SIMD kernel\n");
+				fprintf(stderr, "         -w       wavefront alignment (WFA), O(ns) for a penalty s\n");
+				fprintf(stderr, "         -W       low-memory bidirectional WFA (BiWFA)\n");
+				fprintf(stderr, "         -b       also align the reverse complement of the first sequence (--both-strands)\n");
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "         --min-score INT  drop alignments scoring lower\n");
 				fprintf(stderr, "\n");
 				return 1;
 	}
@@ -506,8 +701,15 @@ main_global_affine(int argc, char *argv[]) {
 	kstring_t *r2 = mycalloc(1, kstring_t);
 	r1->s = mycalloc(ks1->l + ks2->l, char);
 	r2->s = mycalloc(ks1->l + ks2->l, char);
-	printf("score=%f\n", align_gla(ks1, ks2, r1, r2, opt));
-	printf("%s\n%s\n", r1->s, r2->s);
+	char strand = '+';
+	double score = opt->b == true ? align_both_strands(align, KMODE_GLOBAL, ks1, ks2, r1, r2, opt, &strand) : align(ks1, ks2, r1, r2, opt);
+	STATS_BEGIN(STATS_OUTPUT);
+	if(score >= opt->min_score){
+		printf("score=%f\n", score);
+		if(opt->b == true) printf("strand=%c\n", strand);
+		printf("%s\n%s\n", r1->s, r2->s);
+	}
+	STATS_END(STATS_OUTPUT);
 	free(opt);
 	kstring_destory(ks1);
 	kstring_destory(ks2);
@@ -542,6 +744,12 @@ main_global_affine(int argc, char *argv[]) {
 /* We allow pointer move from M to J only at given positions on s2    */
 /* J(i,j) = max{M(i-1, j)+JUMP, U(i-1, j)} if s2[j] = junction   OR   */
 /* J(i,j) = max{M(i-1, j)-INFINITY, U(i-1, j)} if s2[j] = junction    */
+/* With the two-piece affine gap (opt->p) a gap of length k costs     */
+/* max{GAP+(k-1)*EXTENSION, GAP2+(k-1)*EXTENSION2}, kept in L2/U2:    */
+/* L2(i,j) = max{M(i-1, j)+GAP2, L2(i-1, j)+EXTENSION2}               */
+/* U2(i,j) = max{M(i, j-1)+GAP2, U2(i, j-1)+EXTENSION2}               */
+/* and M(i,j) also takes L2(i-1, j-1)+s(x,y), U2(i-1, j-1)+s(x,y).    */
+/* This lets long deletions and unannotated introns cost a flat GAP2. */
 /* Traceback:                                                         */
 /*--------------------------------------------------------------------*/
 /* start at max(M(m,j_max), L(n, j_max)), Stop at any of i=0 on M/L;  */
@@ -581,6 +789,16 @@ trace_back_fit_affine_jump(matrix_t *S, kstring_t *s1, kstring_t *s2, kstring_t
 				res_ks1->s[cur] = '-';
 	           	res_ks2->s[cur++] = s2->s[--j];
 				break;
+			case LOW2:
+				state = S->pointerL2[i][j];
+				res_ks1->s[cur] = s1->s[--i];
+				res_ks2->s[cur++] = '-';
+				break;
+			case UPP2:
+				state = S->pointerU2[i][j];
+				res_ks1->s[cur] = '-';
+				res_ks2->s[cur++] = s2->s[--j];
+				break;
 			default:
 				break;
 			}
@@ -600,95 +818,13 @@ align_fit_affine_jump(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2
 	size_t m   = s1->l + 1; size_t n   = s2->l + 1;
 	matrix_t *S = create_matrix(m, n);
 	printf("asDAsdaSDAsdasDAsdaSD\n");
-	// copy alignment parameter
-	junction_t junctions = opt->sites;
-	double match = opt->m;
-	double mismatch = opt->u;
-	double gap = opt->o;
-	double extension = opt->e;
-	double jump_penality = opt->j;
-	// initlize leftmost column
-	int i, j;
-	for(i=0; i<S->m; i++){
-		S->M[i][0] = -INFINITY;
-		S->U[i][0] = -INFINITY;
-		S->L[i][0] = -INFINITY;
-		S->J[i][0] = -INFINITY;
-	}
-	// initlize first row
-	for(j=0; j<S->n; j++){
-		S->M[0][j] = 0.0;
-		S->U[0][j] = 0.0;
-		S->J[0][j] = -INFINITY;
-		S->L[0][j] = -INFINITY;
-	}
-	double new_score;
-	int idx;
-	
-	// recurrance relation
-	for(i=1; i<=s1->l; i++){
-		for(j=1; j<=s2->l; j++){
-			// MID any state can goto MID
-			new_score = ((s1->s[i-1] - s2->s[j-1]) == 0) ? match : mismatch;
-			//new_score = (strnicmp(s1->s+(i-1), s2->s+(j-1), 1) == 0) ? match : mismatch;
-			if(opt->s == true){
-				idx = max5(&S->M[i][j], S->L[i-1][j-1]+new_score, S->M[i-1][j-1]+new_score, S->U[i-1][j-1]+new_score, S->J[i-1][j-1]+new_score, -INFINITY);
-				if(idx == 0) S->pointerM[i][j]=LOW;
-				if(idx == 1) S->pointerM[i][j]=MID;
-				if(idx == 2) S->pointerM[i][j]=UPP;
-				if(idx == 3) S->pointerM[i][j]=JUMP;			 				
-			}else{
-				idx = max5(&S->M[i][j], S->L[i-1][j-1]+new_score, S->M[i-1][j-1]+new_score, S->U[i-1][j-1]+new_score, -INFINITY, -INFINITY);
-				if(idx == 0) S->pointerM[i][j]=LOW;
-				if(idx == 1) S->pointerM[i][j]=MID;
-				if(idx == 2) S->pointerM[i][j]=UPP;				
-			}
-			
-			// LOW
-			idx = max5(&S->L[i][j], S->L[i-1][j]+extension, S->M[i-1][j]+gap, -INFINITY, -INFINITY, -INFINITY);
-			if(idx == 0) S->pointerL[i][j]=LOW;
-			if(idx == 1) S->pointerL[i][j]=MID;
-			
-			// UPP
-			idx = max5(&S->U[i][j], -INFINITY, S->M[i][j-1]+gap, S->U[i][j-1]+extension, -INFINITY, -INFINITY);
-			if(idx == 1) S->pointerU[i][j]=MID;
-			if(idx == 2) S->pointerU[i][j]=UPP;
-			
-			// JUMP only allowed going to JUMP state at junction sites
-			if(opt->s == true){
-				if(isvalueinarray(j-1, junctions.pos, junctions.size)){
-					idx = max5(&S->J[i][j], -INFINITY, S->M[i][j-1]+jump_penality, -INFINITY, S->J[i][j-1], -INFINITY);
-					if(idx == 1) S->pointerJ[i][j] = MID;			
-					if(idx == 3) S->pointerJ[i][j] = JUMP;			
-				}else{
-					idx = max5(&S->J[i][j], -INFINITY, -INFINITY, -INFINITY, S->J[i][j-1], -INFINITY);				
-					if(idx == 3) S->pointerJ[i][j] = JUMP;
-				}	
-			}
-		}
-	}
-	
-	// find trace-back start point
+	if(opt->p == true) add_long_gap_matrix(S);
 	// NOTE: ALWAYS STARTS TRACING BACK FROM MID OR LOW
-	int i_max, j_max;
-	double max_score = -INFINITY;
-	int max_state;
-	i_max = s1->l;
-	for(j=0; j<s2->l; j++){
-		if(max_score < S->M[i_max][j]){
-			max_score = S->M[i_max][j];
-			j_max = j;
-			max_state = MID;
-		}
-	}
-	for(j=0; j<s2->l; j++){
-		if(max_score < S->L[i_max][j]){
-			max_score = S->L[i_max][j];
-			j_max = j;
-			max_state = LOW;
-		}
-	}
+	int i_max, j_max, max_state;
+	double max_score = kern_fill(s1, s2, opt, KMODE_FIT, S, &max_state, &i_max, &j_max);
+	STATS_BEGIN(STATS_TRACE);
 	trace_back_fit_affine_jump(S, s1, s2, r1, r2, max_state, i_max, j_max);	
+	STATS_END(STATS_TRACE);
 	destory_matrix(S);
 	return max_score;
 }
@@ -699,15 +835,33 @@ static inline int
 main_fit_affine_jump(int argc, char *argv[]) {
 	opt_t *opt = init_opt(); // initlize options with default settings
 	int c;
+	char *idx_fn = NULL, *reads_fn = NULL;
+	int n_threads = 1;
+	bool fusion = false;
+	align_f align = align_fit_plan;
 	srand48(11);
-	while ((c = getopt(argc, argv, "m:u:o:e:j:s")) >= 0) {
+	while ((c = getopt_long(argc, argv, "m:u:o:e:j:O:E:pstgdx:bM:q:T:FJ:", plan_long_opts, NULL)) >= 0) {
 			switch (c) {
 			case 'm': opt->m = atoi(optarg); break;
 			case 'u': opt->u = atoi(optarg); break;
 			case 'o': opt->o = atoi(optarg); break;
 			case 'e': opt->e = atoi(optarg); break;
 			case 'j': opt->j = atoi(optarg); break;
+			case 'O': opt->o2 = atoi(optarg); break;
+			case 'E': opt->e2 = atoi(optarg); break;
+			case 'p': opt->p = true; break;
 			case 's': opt->s = true; break;
+			case 't': align = align_fit_twopass; break;
+			case 'g': opt->s = true; align = align_fit_graph; break;
+			case 'd': align = align_fit_diff; break;
+			case 'x': idx_fn = optarg; break;
+			case 'b': opt->b = true; break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case 'q': reads_fn = optarg; break;
+			case 'T': n_threads = atoi(optarg); break;
+			case 'F': fusion = true; opt->s = true; break;
+			case 'J': opt->f = atoi(optarg); break;
+			case PLAN_OPT_MIN_SCORE: opt->min_score = atoi(optarg); break;
 			default: return 1;
 		}
 	}
@@ -719,10 +873,38 @@ main_fit_affine_jump(int argc, char *argv[]) {
 				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
 				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
 				fprintf(stderr, "         -j INT   jump penality [%d]\n", opt->j);
+				fprintf(stderr, "         -O INT   long gap open penalty [%d]\n", opt->o2);
+				fprintf(stderr, "         -E INT   long gap extension penalty [%d]\n", opt->e2);
+				fprintf(stderr, "         -p       two-piece affine gap, a gap costs max(o+(k-1)e, O+(k-1)E)\n");
 				fprintf(stderr, "         -s       weather jump state include\n");
+				fprintf(stderr, "         -t       two-pass: score-only passes, traceback on the aligned region only\n");
+				fprintf(stderr, "         -g       exon graph: junction sites are donor|acceptor pairs, align to the exons only\n");
+				fprintf(stderr, "         -d       int8 difference-recurrence SIMD kernel (ignored with -s)\n");
+				fprintf(stderr, "         -x FILE  align every read of <target.fa> to its best target in index FILE\n");
+				fprintf(stderr, "         -b       also align the reverse complement of the first sequence (--both-strands)\n");
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "         -q FILE  align every read of FILE to the first sequence of <target.fa>\n");
+				fprintf(stderr, "         -T INT   threads for -q [%d]\n", n_threads);
+				fprintf(stderr, "         -F       with -q, align to all sequences of <target.fa> at once, jumps may go between them (fusion)\n");
+				fprintf(stderr, "         -J INT   fusion jump penalty [%d]\n", opt->f);
+				fprintf(stderr, "         --min-score INT  drop alignments scoring lower\n");
 				fprintf(stderr, "\n");
 				return 1;
 	}
+	if(fusion == true && (reads_fn == NULL || align == align_fit_graph)) die("-F needs -q and does not work with -g\n");
+	if(align == align_fit_graph && (reads_fn != NULL || opt->b == true)) die("-g does not work with -q or -b\n");
+	if(reads_fn != NULL){
+		if(n_threads < 1) die("-T must be at least 1");
+		if(fusion == true) fusion_align_reads(argv[argc-1], reads_fn, opt, n_threads);
+		else prof_align_reads(argv[argc-1], reads_fn, opt, KMODE_FIT, n_threads);
+		free(opt);
+		return 0;
+	}
+	if(idx_fn != NULL){
+		idx_align_reads(idx_fn, argv[argc-1], opt, align, KMODE_FIT, true);
+		free(opt);
+		return 0;
+	}
 	kstring_t *ks1, *ks2; 
 	ks1 = mycalloc(1, kstring_t);
 	ks2 = mycalloc(1, kstring_t);
@@ -733,8 +915,15 @@ main_fit_affine_jump(int argc, char *argv[]) {
 	kstring_t *r2 = mycalloc(1, kstring_t);
 	r1->s = mycalloc(ks1->l + ks2->l, char);
 	r2->s = mycalloc(ks1->l + ks2->l, char);
-	printf("score=%f\n", align_fit_affine_jump(ks1, ks2, r1, r2, opt));
-	printf("%s\n%s\n", r1->s, r2->s);
+	char strand = '+';
+	double score = opt->b == true ? align_both_strands(align, KMODE_FIT, ks1, ks2, r1, r2, opt, &strand) : align(ks1, ks2, r1, r2, opt);
+	STATS_BEGIN(STATS_OUTPUT);
+	if(score >= opt->min_score){
+		printf("score=%f\n", score);
+		if(opt->b == true) printf("strand=%c\n", strand);
+		printf("%s\n%s\n", r1->s, r2->s);
+	}
+	STATS_END(STATS_OUTPUT);
 	kstring_destory(ks1);
 	kstring_destory(ks2);
 	kstring_destory(r1);
@@ -777,6 +966,7 @@ trace_back_local_affine(matrix_t *S, kstring_t *s1, kstring_t *s2, kstring_t *re
 				break;
 			case MID:
 				state = S->pointerM[i][j]; // change to next state
+				if(state == HOME) break; // M(i,j)=0, nothing aligned here
                 res_ks1->s[cur] = s1->s[--i];
                 res_ks2->s[cur++] = s2->s[--j];
 				break;
@@ -805,43 +995,13 @@ trace_back_local_affine(matrix_t *S, kstring_t *s1, kstring_t *s2, kstring_t *re
 static inline double 
 align_local_affine(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
 	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL) die("align: parameter error\n");
-	double mismatch = opt->u;
-	double match = opt->m;
-	double gap = opt->o;
-	double extension = opt->e;
-	
 	size_t m   = s1->l + 1; size_t n   = s2->l + 1;
 	matrix_t *S = create_matrix(m, n);
-	int i, j;
 	int i_max, j_max;
-	double max_score = -INFINITY;
-	double new_score;
-	int idx;
-	// recurrance relation
-	for(i=1; i<=s1->l; i++){
-		for(j=1; j<=s2->l; j++){
-			// MID
-			new_score = ((s1->s[i-1] - s2->s[j-1]) == 0) ? match : mismatch;
-			idx = max5(&S->M[i][j], S->L[i-1][j-1]+new_score, S->M[i-1][j-1]+new_score, S->U[i-1][j-1]+new_score, 0.0, -INFINITY);
-			if(idx==0) S->pointerM[i][j] = LOW;
-			if(idx==1) S->pointerM[i][j] = MID;
-			if(idx==2) S->pointerM[i][j] = UPP;
-			if(idx==3) S->pointerM[i][j] = HOME;			
-			if(S->M[i][j] > max_score){
-				max_score = S->M[i][j];
-				i_max = i; j_max = j;
-			}
-			// LOW
-			idx = max5(&S->L[i][j], S->L[i-1][j]+extension, S->M[i-1][j]+gap, -INFINITY, -INFINITY, -INFINITY);
-			if(idx==0) S->pointerL[i][j] = LOW;
-			if(idx==1) S->pointerL[i][j] = MID;
-			// UPP
-			idx = max5(&S->U[i][j], -INFINITY, S->M[i][j-1]+gap, S->U[i][j-1]+extension, -INFINITY, -INFINITY);
-			if(idx==1) S->pointerU[i][j] = MID;
-			if(idx==2) S->pointerU[i][j] = UPP;
-		}
-	}
+	double max_score = kern_fill(s1, s2, opt, KMODE_LOCAL, S, NULL, &i_max, &j_max);
+	STATS_BEGIN(STATS_TRACE);
 	trace_back_local_affine(S, s1, s2, r1, r2, i_max, j_max);	
+	STATS_END(STATS_TRACE);
 	destory_matrix(S);
 	return max_score;
 }
@@ -853,12 +1013,22 @@ main_local_affine(int argc, char *argv[]) {
 	opt_t *opt = init_opt(); // initlize options with default settings
 	int c;
 	srand48(11);
-	while ((c = getopt(argc, argv, "m:u:o:e:j:s")) >= 0) {
+	char *idx_fn = NULL, *reads_fn = NULL;
+	int n_threads = 1;
+	align_f align = align_local_plan;
+	while ((c = getopt_long(argc, argv, "m:u:o:e:j:stx:bM:q:T:", plan_long_opts, NULL)) >= 0) {
 			switch (c) {
 			case 'm': opt->m = atoi(optarg); break;
 			case 'u': opt->u = atoi(optarg); break;
 			case 'o': opt->o = atoi(optarg); break;
 			case 'e': opt->e = atoi(optarg); break;
+			case 't': align = align_local_twopass; break;
+			case 'x': idx_fn = optarg; break;
+			case 'b': opt->b = true; break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case 'q': reads_fn = optarg; break;
+			case 'T': n_threads = atoi(optarg); break;
+			case PLAN_OPT_MIN_SCORE: die("--min-score is for global, fit and overlap\n");
 			default: return 1;
 		}
 	}
@@ -869,9 +1039,26 @@ main_local_affine(int argc, char *argv[]) {
 				fprintf(stderr, "         -u INT   mismatch penalty [%d]\n", opt->u);
 				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
 				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -t       two-pass: score-only passes, traceback on the aligned region only\n");
+				fprintf(stderr, "         -x FILE  align every read of <target.fa> to its best target in index FILE\n");
+				fprintf(stderr, "         -b       also align the reverse complement of the first sequence (--both-strands)\n");
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "         -q FILE  align every read of FILE to the first sequence of <target.fa>\n");
+				fprintf(stderr, "         -T INT   threads for -q [%d]\n", n_threads);
 				fprintf(stderr, "\n");
 				return 1;
 	}
+	if(reads_fn != NULL){
+		if(n_threads < 1) die("-T must be at least 1");
+		prof_align_reads(argv[argc-1], reads_fn, opt, KMODE_LOCAL, n_threads);
+		free(opt);
+		return 0;
+	}
+	if(idx_fn != NULL){
+		idx_align_reads(idx_fn, argv[argc-1], opt, align, KMODE_LOCAL, false);
+		free(opt);
+		return 0;
+	}
 	
 	kstring_t *ks1, *ks2; 
 	ks1 = mycalloc(1, kstring_t);
@@ -882,8 +1069,13 @@ main_local_affine(int argc, char *argv[]) {
 	kstring_t *r2 = mycalloc(1, kstring_t);
 	r1->s = mycalloc(ks1->l + ks2->l, char);
 	r2->s = mycalloc(ks1->l + ks2->l, char);
-	printf("score=%f\n", align_local_affine(ks1, ks2, r1, r2, opt));
+	char strand = '+';
+	double score = opt->b == true ? align_both_strands(align, KMODE_LOCAL, ks1, ks2, r1, r2, opt, &strand) : align(ks1, ks2, r1, r2, opt);
+	STATS_BEGIN(STATS_OUTPUT);
+	printf("score=%f\n", score);
+	if(opt->b == true) printf("strand=%c\n", strand);
 	printf("%s\n%s\n", r1->s, r2->s);
+	STATS_END(STATS_OUTPUT);
 	kstring_destory(ks1);
 	kstring_destory(ks2);
 	kstring_destory(r1);
@@ -925,40 +1117,16 @@ static inline void trace_back_overlap(matrix_t *S, kstring_t *ks1, kstring_t *ks
  */
 static inline double align_overlap(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
 	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL) die("align_overlap: parameter error\n");
-	double mismatch = opt->u;
-	double match = opt->m;
-	double gap = opt->o;
-	double extension = opt->e;
 	size_t m   = s1->l + 1;
 	size_t n   = s2->l + 1;
-	size_t i, j, k, l;
 	matrix_t *S = create_matrix(m, n);
-	// first row and first column initilized with 0's
-	for(j=0; j < S->n; j++) S->M[0][j] = -INFINITY;
-	for(i=0; i < S->m; i++) S->M[i][0] = 0.0;
-	int idx;
-	for(i = 1; i <= s1->l; i++){
-		for(j = 1; j <= s2->l; j++){
-			//double new_score = match(s1->s[i-1], s2->s[j-1], BLOSUM62);
-			double new_score = ((s1->s[i-1] - s2->s[j-1]) == 0) ? match : mismatch;			
-			idx = max5(&S->M[i][j], S->M[i][j-1] + gap, S->M[i-1][j-1] + new_score, S->M[i-1][j] + gap, -INFINITY, -INFINITY);
-			if(idx==0) S->pointerM[i][j] = LEFT;
-			if(idx==1) S->pointerM[i][j] = DIAGONAL;
-			if(idx==2) S->pointerM[i][j] = RIGHT;			
-		}
-	}
-	// find max value of on the bottom column of S->score and starts tracing back from there
-	double max_score = -INFINITY;
+	// first row and first column initilized with 0's, ends on the bottom row
 	int i_max, j_max;
-	i_max = s1->l;
-	for(j=0; j<s2->l; j++){
-		if(max_score < S->M[i_max][j]){
-			max_score = S->M[i_max][j];
-			j_max = j;
-		}
-	}
+	double max_score = kern_fill(s1, s2, opt, KMODE_OVERLAP, S, NULL, &i_max, &j_max);
 	// stop when we get a cell with 0
+	STATS_BEGIN(STATS_TRACE);
 	trace_back_overlap(S, s1, s2, r1, r2, i_max, j_max);
+	STATS_END(STATS_TRACE);
 	destory_matrix(S);
 	return max_score;
 }
@@ -968,12 +1136,15 @@ static inline int main_overlap(int argc, char *argv[]) {
 	opt_t *opt = init_opt(); // initlize options with default settings
 	int c;
 	srand48(11);
-	while ((c = getopt(argc, argv, "m:u:o:e:j:s")) >= 0) {
+	while ((c = getopt_long(argc, argv, "m:u:o:e:j:sbM:", plan_long_opts, NULL)) >= 0) {
 			switch (c) {
 			case 'm': opt->m = atoi(optarg); break;
 			case 'u': opt->u = atoi(optarg); break;
 			case 'o': opt->o = atoi(optarg); break;
 			case 'e': opt->e = atoi(optarg); break;
+			case 'b': opt->b = true; break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case PLAN_OPT_MIN_SCORE: opt->min_score = atoi(optarg); break;
 			default: return 1;
 		}
 	}
@@ -984,6 +1155,9 @@ static inline int main_overlap(int argc, char *argv[]) {
 				fprintf(stderr, "         -u INT   mismatch penalty [%d]\n", opt->u);
 				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
 				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -b       also align the reverse complement of the first sequence (--both-strands)\n");
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "         --min-score INT  drop alignments scoring lower\n");
 				fprintf(stderr, "\n");
 				return 1;
 	}
@@ -991,14 +1165,21 @@ static inline int main_overlap(int argc, char *argv[]) {
 	kstring_t *ks1, *ks2;
 	ks1 = mycalloc(1, kstring_t);
 	ks2 = mycalloc(1, kstring_t);
-	kstring_read(argv[1], ks1, ks2, opt);
+	kstring_read(argv[argc-1], ks1, ks2, opt);
 	if(ks1->s == NULL || ks2->s == NULL) die("fail to read sequence\n");
 	kstring_t *r1 = mycalloc(1, kstring_t);
 	kstring_t *r2 = mycalloc(1, kstring_t);
 	r1->s = mycalloc(ks1->l + ks2->l, char);
 	r2->s = mycalloc(ks1->l + ks2->l, char);
-	printf("%f\n", align_overlap(ks1, ks2, r1, r2, opt));
-	printf("%s\n%s\n", r1->s, r2->s);
+	char strand = '+';
+	double score = opt->b == true ? align_both_strands(align_overlap_plan, KMODE_OVERLAP, ks1, ks2, r1, r2, opt, &strand) : align_overlap_plan(ks1, ks2, r1, r2, opt);
+	STATS_BEGIN(STATS_OUTPUT);
+	if(score >= opt->min_score){
+		printf("%f\n", score);
+		if(opt->b == true) printf("strand=%c\n", strand);
+		printf("%s\n%s\n", r1->s, r2->s);
+	}
+	STATS_END(STATS_OUTPUT);
 	free(opt);
 	kstring_destory(ks1);
 	kstring_destory(ks2);
@@ -0,0 +1,183 @@
+/*--------------------------------------------------------------------*/
+/* band.c 		                                                      */
+/* Banded affine global alignment.                                    */
+/*                                                                    */
+/* Only cells with lo <= j-i <= hi are filled, where                  */
+/* lo = min(0,n-m)-w and hi = max(0,n-m)+w; cells outside the band    */
+/* are -INF. The recurrence, boundaries and tie-breaking are those of */
+/* align_gla(). Pointers take one byte per band cell:                 */
+/* bits 0-1 M from LOW/MID/UPP, bit 2 L from MID, bit 3 U from UPP.   */
+/*                                                                    */
+/* A path that leaves the band has at least w+1 gaps in each          */
+/* direction, so at most min(m,n)-w-1 aligned pairs and at least      */
+/* |m-n|+2(w+1) gap bases. band_bound() turns that into an upper      */
+/* bound on its score. When the band score is strictly above it every */
+/* optimal path lies in the band, and the banded result (score and    */
+/* traceback) equals that of align_gla().                             */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define BAND_M_LOW              0
+#define BAND_M_MID              1
+#define BAND_M_UPP              2
+#define BAND_L_MID              0x04
+#define BAND_U_UPP              0x08
+
+/*
+ * upper bound on the score of any global path leaving the band of
+ * half-width w; -INF when the band is the whole matrix, +INF when the
+ * scoring gives no bound.
+ */
+double
+band_bound(const opt_t *opt, size_t m, size_t n, long w){
+	long mn = m < n ? m : n, d = m > n ? m - n : n - m;
+	if(w >= mn) return -INFINITY;
+	if(opt->o > 0 || opt->e > 0) return INFINITY;
+	double smax = opt->m > opt->u ? opt->m : opt->u, g = d + 2.0 * (w + 1);
+	if(smax < 0) smax = 0;
+	return smax * (mn - w - 1) + (opt->o >= opt->e ? g * opt->o : 2.0 * opt->o + (g - 2) * opt->e);
+}
+
+/*
+ * number of cells in a row of the band
+ */
+size_t
+band_width(size_t m, size_t n, long w){
+	long d = (long)n - (long)m;
+	return (d > 0 ? d : -d) + 2 * w + 1;
+}
+
+/*
+ * fill the band; P receives the pointers, (m+1) rows of band_width()
+ * bytes, when not NULL. returns the score at (m,n), *state the state
+ * it comes from.
+ */
+static AT_CLONES double
+band_fill(kstring_t *s1, kstring_t *s2, const opt_t *opt, long w, uint8_t *P, int *state){
+	const double match = opt->m, mismatch = opt->u, gap = opt->o, extension = opt->e, neg = -INFINITY;
+	const long m = s1->l, n = s2->l, lo = (n < m ? n - m : 0) - w, hi = (n > m ? n - m : 0) + w;
+	const long W = hi - lo + 1;
+	double *buf = mycalloc(6 * (n + 1), double), *t, v;
+	double *pM = buf, *pL = pM + (n + 1), *pU = pL + (n + 1);
+	double *cM = pU + (n + 1), *cL = cM + (n + 1), *cU = cL + (n + 1);
+	double max_score;
+	long i, j, jlo, jhi;
+	int idx;
+	uint8_t b;
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) pM[j] = pL[j] = pU[j] = cM[j] = cL[j] = cU[j] = neg;
+	/* first row */
+	for(j = 0; j <= n && j <= hi; j++){
+		cM[j] = j == 0 ? 0 : neg;
+		cL[j] = j == 0 ? gap : neg;
+		cU[j] = gap + extension * j;
+	}
+	for(i = 1; i <= m; i++){
+		t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;
+		jlo = i + lo > 0 ? i + lo : 0;
+		jhi = i + hi < n ? i + hi : n;
+		if(jlo == 0){ // first column
+			cL[0] = gap + extension * i;
+			cM[0] = cU[0] = neg;
+			jlo = 1;
+		}else{
+			cM[jlo-1] = cU[jlo-1] = neg;
+		}
+		uint8_t *p = P ? P + i * W - (i + lo) : NULL;
+		for(j = jlo; j <= jhi; j++){
+			const double s = (s1->s[i-1] == s2->s[j-1]) ? match : mismatch;
+			/* MID */
+			cM[j] = pL[j-1] + s; idx = BAND_M_LOW;
+			if((v = pM[j-1] + s) > cM[j]){ cM[j] = v; idx = BAND_M_MID; }
+			if((v = pU[j-1] + s) > cM[j]){ cM[j] = v; idx = BAND_M_UPP; }
+			b = idx;
+			/* LOW */
+			cL[j] = pL[j] + extension;
+			if((v = pM[j] + gap) > cL[j]){ cL[j] = v; b |= BAND_L_MID; }
+			/* UPP */
+			cU[j] = cM[j-1] + gap;
+			if((v = cU[j-1] + extension) > cU[j]){ cU[j] = v; b |= BAND_U_UPP; }
+			if(p) p[j] = b;
+		}
+		if(jhi + 1 <= n) cM[jhi+1] = cL[jhi+1] = cU[jhi+1] = neg;
+	}
+	/* end cell */
+	max_score = cL[n]; idx = LOW;
+	if(cM[n] > max_score){ max_score = cM[n]; idx = MID; }
+	if(cU[n] > max_score){ max_score = cU[n]; idx = UPP; }
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * W);
+	free(buf);
+	if(state) *state = idx;
+	return max_score;
+}
+
+/*
+ * trace_back_gla() on the band pointers
+ */
+static void
+band_trace(const uint8_t *P, long W, long lo, int state, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2){
+	static const int m_state[3] = {LOW, MID, UPP};
+	long i = s1->l, j = s2->l;
+	int cur = 0;
+	while(i > 0 && j > 0){
+		uint8_t b = P[i * W + j - (i + lo)];
+		switch(state){
+			case LOW:
+				state = (b & BAND_L_MID) ? MID : LOW;
+				r1->s[cur] = s1->s[--i];
+				r2->s[cur++] = '-';
+				break;
+			case MID:
+				state = m_state[b & 3];
+				r1->s[cur] = s1->s[--i];
+				r2->s[cur++] = s2->s[--j];
+				break;
+			case UPP:
+				state = (b & BAND_U_UPP) ? UPP : MID;
+				r1->s[cur] = '-';
+				r2->s[cur++] = s2->s[--j];
+				break;
+			default:
+				break;
+		}
+	}
+	while(j > 0){
+		r1->s[cur] = '-';
+		r2->s[cur++] = s2->s[--j];
+	}
+	while(i > 0){
+		r2->s[cur] = '-';
+		r1->s[cur++] = s1->s[--i];
+	}
+	r1->l = cur;
+	r2->l = cur;
+	r1->s = strrev(r1->s);
+	r2->s = strrev(r2->s);
+}
+
+/*
+ * global alignment restricted to the band of half-width w; score only
+ * when r1/r2 are NULL. Exact when the score is above band_bound().
+ */
+double
+align_gla_band(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, long w){
+	if(s1 == NULL || s2 == NULL || opt == NULL || w < 0) die("align_gla_band: parameter error\n");
+	long m = s1->l, n = s2->l, lo = (n < m ? n - m : 0) - w, W = band_width(m, n, w);
+	uint8_t *P = NULL;
+	int state;
+	if(r1 != NULL && r2 != NULL){
+		STATS_BEGIN(STATS_ALLOC);
+		P = mycalloc((m + 1) * W, uint8_t);
+		STATS_END(STATS_ALLOC);
+	}
+	double score = band_fill(s1, s2, opt, w, P, &state);
+	if(P != NULL){
+		STATS_BEGIN(STATS_TRACE);
+		band_trace(P, W, lo, state, s1, s2, r1, r2);
+		STATS_END(STATS_TRACE);
+		free(P);
+	}
+	return score;
+}
@@ -0,0 +1,447 @@
+/*--------------------------------------------------------------------*/
+/* batch.c 		                                                      */
+/* Inter-sequence SIMD scoring of many short pairs.                   */
+/*                                                                    */
+/* Pairs are read a chunk at a time, sorted by length and cut into    */
+/* batches of 8 (SSE2), 16 (AVX2) or 32 (AVX-512BW) pairs, the widest */
+/* this cpu runs (isa.h); each int16 lane of a vector then runs       */
+/* the whole DP of one pair. Bases are transposed so that row i of    */
+/* every pair in the batch is one vector load. Shorter pairs of a     */
+/* batch are padded; cells past a pair's own (m,n) never feed back    */
+/* into it, so its score is read at (m,n) (global, edit) or maximised */
+/* under a mask (local). Sorting keeps padding to a few bases for     */
+/* amplicon-like input.                                               */
+/*                                                                    */
+/* Recurrences are those of align_gla(), align_local_affine() and     */
+/* edit_dist(), score only. Pairs whose scores may not fit in int16,  */
+/* or that have an empty sequence, go through the planner (plan.c).  */
+/*                                                                    */
+/* With --min-score (global only), pairs whose q-gram bound (prune.c) */
+/* is already below it are not scored, and pairs below it are not     */
+/* printed.                                                           */
+/*                                                                    */
+/* With --shard i/N only the pairs of shard i are read, through the   */
+/* .fai of the input (shard.c); the outputs of the N shards, in       */
+/* order, concatenate to the output of the whole input.               */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define BATCH_CHUNK             65536   // pairs read and sorted at a time
+#define BATCH_MAX_SCORE         30000   // |score| bound for int16 lanes
+#define BATCH_OPT_SHARD         257     // --shard, long option only
+
+// plan_long_opts and --shard
+static const struct option batch_long_opts[] = {
+	{"both-strands", no_argument, NULL, 'b'},
+	{"max-mem", required_argument, NULL, 'M'},
+	{"min-score", required_argument, NULL, PLAN_OPT_MIN_SCORE},
+	{"shard", required_argument, NULL, BATCH_OPT_SHARD},
+	{NULL, 0, NULL, 0}
+};
+
+static int
+pair_cmp(const void *a, const void *b){
+	const pair_t *x = *(const pair_t**)a, *y = *(const pair_t**)b;
+	if(x->s1.l != y->s1.l) return x->s1.l < y->s1.l ? -1 : 1;
+	if(x->s2.l != y->s2.l) return x->s2.l < y->s2.l ? -1 : 1;
+	return 0;
+}
+
+static double
+batch_scalar(pair_t *p, opt_t *opt, int mode){
+	if(mode == BATCH_EDIT) return edit_plan(&p->s1, &p->s2, opt);
+	return plan_align(mode == BATCH_LOCAL ? KMODE_LOCAL : KMODE_GLOBAL, &p->s1, &p->s2, NULL, NULL, opt);
+}
+
+static inline bool
+batch_fits(const pair_t *p, const opt_t *opt){
+	int a = abs(opt->m), b;
+	if((b = abs(opt->u)) > a) a = b;
+	if((b = abs(opt->o)) > a) a = b;
+	if((b = abs(opt->e)) > a) a = b;
+	if(p->s1.l == 0 || p->s2.l == 0) return false;
+	return (double)(p->s1.l + p->s2.l + 2) * (a + 1) < BATCH_MAX_SCORE ? true : false;
+}
+
+/*
+ * NAME scores up to W pairs, one per lane, with the vec_t and v_*
+ * operations defined where it is instantiated
+ */
+#define BATCH_SIMD(NAME, W, ATTR)                                                                                \
+static ATTR void                                                                                                 \
+NAME(pair_t **p, int k, opt_t *opt, int mode){                                                                   \
+	const int16_t NEG = -32000;                                                                                  \
+	size_t ml = 0, nl = 0, i, j;                                                                                 \
+	int l;                                                                                                       \
+	for(l = 0; l < k; l++){                                                                                      \
+		if(p[l]->s1.l > ml) ml = p[l]->s1.l;                                                                     \
+		if(p[l]->s2.l > nl) nl = p[l]->s2.l;                                                                     \
+	}                                                                                                            \
+	/* transposed bases, padding with distinct values so that pads never match */                                \
+	int16_t *q = mycalloc((ml + 1) * W, int16_t), *t = mycalloc((nl + 1) * W, int16_t);                          \
+	int16_t *ilen = mycalloc(W, int16_t), *jlen = mycalloc(W, int16_t);                                          \
+	for(l = 0; l < W; l++){                                                                                      \
+		for(i = 1; i <= ml; i++) q[i*W + l] = (l < k && i <= p[l]->s1.l) ? (unsigned char)p[l]->s1.s[i-1] : -1;  \
+		for(j = 1; j <= nl; j++) t[j*W + l] = (l < k && j <= p[l]->s2.l) ? (unsigned char)p[l]->s2.s[j-1] : -2;  \
+		ilen[l] = l < k ? p[l]->s1.l : 0;                                                                        \
+		jlen[l] = l < k ? p[l]->s2.l : 0;                                                                        \
+	}                                                                                                            \
+	/* rows are kept as int16_t so that unaligned loads/stores suffice */                                        \
+	int16_t *M = mycalloc((nl + 1) * W, int16_t), *L = mycalloc((nl + 1) * W, int16_t);                          \
+	int16_t *U = mycalloc((nl + 1) * W, int16_t), *jmask = mycalloc((nl + 1) * W, int16_t);                      \
+	const vec_t sc_m = v_set1(mode == BATCH_EDIT ? 0 : opt->m), sc_u = v_set1(opt->u);                           \
+	const vec_t gap = v_set1(opt->o), ext = v_set1(opt->e), one = v_set1(1), zero = v_set1(0);                   \
+	const vec_t vneg = v_set1(NEG), vjlen = v_load(jlen), vilen = v_load(ilen);                                  \
+	vec_t best = zero;                                                                                           \
+	int16_t buf[W];                                                                                              \
+	/* first row */                                                                                              \
+	for(j = 0; j <= nl; j++){                                                                                    \
+		v_store(jmask + j*W, v_gt(v_adds(vjlen, one), v_set1(j))); /* j <= n */                                  \
+		if(mode == BATCH_GLOBAL){                                                                                \
+			v_store(M + j*W, j == 0 ? zero : vneg);                                                              \
+			v_store(L + j*W, j == 0 ? gap : vneg);                                                               \
+			v_store(U + j*W, v_set1(opt->o + opt->e * j));                                                       \
+		}else if(mode == BATCH_LOCAL){                                                                           \
+			v_store(M + j*W, zero); v_store(L + j*W, zero); v_store(U + j*W, zero);                              \
+		}else{                                                                                                   \
+			v_store(M + j*W, v_set1(j));                                                                         \
+		}                                                                                                        \
+	}                                                                                                            \
+	for(i = 1; i <= ml; i++){                                                                                    \
+		const vec_t qi = v_load(q + i*W);                                                                        \
+		vec_t dM = v_load(M), dL = v_load(L), dU = v_load(U), left, uleft;                                       \
+		if(mode == BATCH_GLOBAL){                                                                                \
+			v_store(M, vneg); v_store(U, vneg);                                                                  \
+			v_store(L, v_set1(opt->o + opt->e * i));                                                             \
+		}else if(mode == BATCH_EDIT){                                                                            \
+			v_store(M, v_set1(i));                                                                               \
+		}                                                                                                        \
+		left = v_load(M); uleft = v_load(U);                                                                     \
+		if(mode == BATCH_EDIT){                                                                                  \
+			for(j = 1; j <= nl; j++){                                                                            \
+				vec_t s = v_sel(v_eq(qi, v_load(t + j*W)), sc_m, sc_u), up = v_load(M + j*W);                    \
+				vec_t h = v_min(v_min(v_adds(left, one), v_adds(dM, s)), v_adds(up, one));                       \
+				dM = up;                                                                                         \
+				v_store(M + j*W, h); left = h;                                                                   \
+			}                                                                                                    \
+		}else{                                                                                                   \
+			const vec_t imask = v_gt(v_adds(vilen, one), v_set1(i)); /* i <= m */                                \
+			for(j = 1; j <= nl; j++){                                                                            \
+				vec_t s = v_sel(v_eq(qi, v_load(t + j*W)), sc_m, sc_u);                                          \
+				vec_t h = v_adds(v_max(v_max(dL, dM), dU), s), e, f;                                             \
+				vec_t uM = v_load(M + j*W), uL = v_load(L + j*W);                                                \
+				if(mode == BATCH_LOCAL){                                                                         \
+					h = v_max(h, zero);                                                                          \
+					best = v_max(best, v_and(h, v_and(imask, v_load(jmask + j*W))));                             \
+				}                                                                                                \
+				e = v_max(v_adds(uL, ext), v_adds(uM, gap));                                                     \
+				f = v_max(v_adds(uleft, ext), v_adds(left, gap));                                                \
+				dM = uM; dL = uL; dU = v_load(U + j*W);                                                          \
+				v_store(M + j*W, h); v_store(L + j*W, e); v_store(U + j*W, f);                                   \
+				left = h; uleft = f;                                                                             \
+			}                                                                                                    \
+		}                                                                                                        \
+		/* pairs ending on this row */                                                                           \
+		for(l = 0; l < k; l++){                                                                                  \
+			if(p[l]->s1.l != i || mode == BATCH_LOCAL) continue;                                                 \
+			size_t n = p[l]->s2.l;                                                                               \
+			int16_t h = M[n*W + l];                                                                              \
+			if(mode == BATCH_GLOBAL){                                                                            \
+				if(L[n*W + l] > h) h = L[n*W + l];                                                               \
+				if(U[n*W + l] > h) h = U[n*W + l];                                                               \
+			}                                                                                                    \
+			p[l]->score = h;                                                                                     \
+		}                                                                                                        \
+	}                                                                                                            \
+	if(mode == BATCH_LOCAL){                                                                                     \
+		v_store(buf, best);                                                                                      \
+		for(l = 0; l < k; l++) p[l]->score = buf[l];                                                             \
+	}                                                                                                            \
+	free(q); free(t); free(ilen); free(jlen);                                                                    \
+	free(M); free(L); free(U); free(jmask);                                                                      \
+}
+#ifdef __SSE2__
+#define vec_t                   __m128i
+#define v_set1(x)               _mm_set1_epi16(x)
+#define v_load(p)               _mm_loadu_si128((const __m128i*)(p))
+#define v_store(p, a)           _mm_storeu_si128((__m128i*)(p), a)
+#define v_adds(a, b)            _mm_adds_epi16(a, b)
+#define v_max(a, b)             _mm_max_epi16(a, b)
+#define v_min(a, b)             _mm_min_epi16(a, b)
+#define v_eq(a, b)              _mm_cmpeq_epi16(a, b)
+#define v_gt(a, b)              _mm_cmpgt_epi16(a, b)
+#define v_and(a, b)             _mm_and_si128(a, b)
+#define v_sel(m, a, b)          _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+BATCH_SIMD(batch_simd_sse2, 8, )
+#undef vec_t
+#undef v_set1
+#undef v_load
+#undef v_store
+#undef v_adds
+#undef v_max
+#undef v_min
+#undef v_eq
+#undef v_gt
+#undef v_and
+#undef v_sel
+#endif
+
+#ifdef AT_HAVE_AVX2
+#define vec_t                   __m256i
+#define v_set1(x)               _mm256_set1_epi16(x)
+#define v_load(p)               _mm256_loadu_si256((const __m256i*)(p))
+#define v_store(p, a)           _mm256_storeu_si256((__m256i*)(p), a)
+#define v_adds(a, b)            _mm256_adds_epi16(a, b)
+#define v_max(a, b)             _mm256_max_epi16(a, b)
+#define v_min(a, b)             _mm256_min_epi16(a, b)
+#define v_eq(a, b)              _mm256_cmpeq_epi16(a, b)
+#define v_gt(a, b)              _mm256_cmpgt_epi16(a, b)
+#define v_and(a, b)             _mm256_and_si256(a, b)
+#define v_sel(m, a, b)          _mm256_blendv_epi8(b, a, m) // m ? a : b
+BATCH_SIMD(batch_simd_avx2, 16, AT_TARGET("avx2"))
+#undef vec_t
+#undef v_set1
+#undef v_load
+#undef v_store
+#undef v_adds
+#undef v_max
+#undef v_min
+#undef v_eq
+#undef v_gt
+#undef v_and
+#undef v_sel
+#endif
+
+#ifdef AT_HAVE_AVX512BW
+// masks are kept as vectors, so that v_and() works on them
+#define vec_t                   __m512i
+#define v_set1(x)               _mm512_set1_epi16(x)
+#define v_load(p)               _mm512_loadu_si512(p)
+#define v_store(p, a)           _mm512_storeu_si512(p, a)
+#define v_adds(a, b)            _mm512_adds_epi16(a, b)
+#define v_max(a, b)             _mm512_max_epi16(a, b)
+#define v_min(a, b)             _mm512_min_epi16(a, b)
+#define v_eq(a, b)              _mm512_movm_epi16(_mm512_cmpeq_epi16_mask(a, b))
+#define v_gt(a, b)              _mm512_movm_epi16(_mm512_cmpgt_epi16_mask(a, b))
+#define v_and(a, b)             _mm512_and_si512(a, b)
+#define v_sel(m, a, b)          _mm512_mask_blend_epi16(_mm512_movepi16_mask(m), b, a)
+BATCH_SIMD(batch_simd_avx512, 32, AT_TARGET("avx512bw"))
+#undef vec_t
+#undef v_set1
+#undef v_load
+#undef v_store
+#undef v_adds
+#undef v_max
+#undef v_min
+#undef v_eq
+#undef v_gt
+#undef v_and
+#undef v_sel
+#endif
+
+#ifdef __SSE2__
+typedef void (*batch_f)(pair_t **p, int k, opt_t *opt, int mode);
+
+/*
+ * the widest kernel this cpu runs (isa.h); *w is its number of lanes
+ */
+static batch_f
+batch_pick(int *w){
+#ifdef AT_HAVE_AVX512BW
+	if(ISA_HAS("avx512bw")){ *w = 32; return batch_simd_avx512; }
+#endif
+#ifdef AT_HAVE_AVX2
+	if(ISA_HAS("avx2")){ *w = 16; return batch_simd_avx2; }
+#endif
+	*w = 8;
+	return batch_simd_sse2;
+}
+#endif
+
+/*
+ * score the k pairs of s, those that fit in int16 lanes a batch at a
+ * time and the others one by one; s is reordered
+ */
+void
+batch_score(pair_t **s, size_t k, opt_t *opt, int mode){
+	size_t i, n = 0;
+	for(i = 0; i < k; i++){
+		if(batch_fits(s[i], opt) == true) s[n++] = s[i];
+		else s[i]->score = batch_scalar(s[i], opt, mode);
+	}
+	k = n;
+#ifdef __SSE2__
+	int w;
+	batch_f batch_simd = batch_pick(&w);
+	qsort(s, k, sizeof(pair_t*), pair_cmp);
+	STATS_BEGIN(STATS_FILL);
+	for(i = 0; i < k; i += w){
+		batch_simd(s + i, k - i < (size_t)w ? k - i : (size_t)w, opt, mode);
+		size_t l;
+		for(l = i; l < k && l < i + w; l++) STATS_CELLS(s[l]->s1.l * s[l]->s2.l);
+	}
+	STATS_END(STATS_FILL);
+#else
+	for(i = 0; i < k; i++) s[i]->score = batch_scalar(s[i], opt, mode);
+#endif
+}
+
+/*
+ * score one chunk, keeping input order for the output. With opt->b
+ * every pair gets a twin holding the reverse complement of s1; twins
+ * have the same lengths, so they sort next to each other and usually
+ * share a batch.
+ */
+static void
+batch_chunk(pair_t *a, size_t n, opt_t *opt, int mode){
+	pair_t *r = NULL, **s = mycalloc(opt->b == true ? 2 * n : n, pair_t*);
+	size_t i, k = 0;
+	if(opt->b == true){
+		r = mycalloc(n, pair_t);
+		for(i = 0; i < n; i++){
+			revcomp(&a[i].s1, &r[i].s1);
+			r[i].s2 = a[i].s2; // shared, freed with a[i]
+		}
+	}
+	const bool prune = (mode == BATCH_GLOBAL && prune_ok(KMODE_GLOBAL, opt) == true) ? true : false;
+	for(i = 0; i < (opt->b == true ? 2 * n : n); i++){
+		pair_t *p = i < n ? &a[i] : &r[i - n];
+		if(prune == true && prune_qgram(KMODE_GLOBAL, &p->s1, &p->s2, opt) < opt->min_score) p->score = -INFINITY;
+		else s[k++] = p;
+	}
+	batch_score(s, k, opt, mode);
+	STATS_BEGIN(STATS_OUTPUT);
+	for(i = 0; i < n; i++){
+		if(opt->b == false){
+			if(a[i].score >= opt->min_score) printf("%s\t%s\t%.0f\n", a[i].n1, a[i].n2, a[i].score);
+			continue;
+		}
+		// edit distance is minimised, the other scores maximised; ties go to '+'
+		bool rev = (mode == BATCH_EDIT ? r[i].score < a[i].score : r[i].score > a[i].score) ? true : false;
+		if((rev == true ? r[i].score : a[i].score) < opt->min_score) continue;
+		printf("%s\t%s\t%.0f\t%c\n", a[i].n1, a[i].n2, rev == true ? r[i].score : a[i].score, rev == true ? '-' : '+');
+	}
+	STATS_END(STATS_OUTPUT);
+	if(r != NULL){
+		for(i = 0; i < n; i++) free(r[i].s1.s);
+		free(r);
+	}
+	free(s);
+}
+
+static void
+pair_free(pair_t *p){
+	free(p->n1); free(p->n2);
+	free(p->s1.s); free(p->s2.s);
+	memset(p, 0, sizeof(pair_t));
+}
+
+/*
+ * score consecutive pairs of records, of shard shard_i out of shard_n
+ * when shard_n > 0
+ */
+static int
+batch_align(const char *fn, opt_t *opt, int mode, int shard_i, int shard_n){
+	gzFile fp = NULL;
+	kseq_t *seq = NULL;
+	shard_t *sh = NULL;
+	kstring_t buf = {0, 0, 0};
+	if(shard_n > 0){
+		sh = shard_open(fn, shard_i, shard_n, 2);
+	}else{
+		fp = gzopen(fn, "r");
+		if(fp == NULL) die("Can't open %s\n", fn);
+		seq = kseq_init(fp);
+	}
+	pair_t *a = mycalloc(BATCH_CHUNK, pair_t);
+	size_t n = 0, i;
+	int half = 0;
+	while(1){
+		const char *name;
+		kstring_t *s;
+		long l;
+		STATS_BEGIN(STATS_PARSE);
+		if(sh != NULL){
+			l = shard_read(sh, &name, &buf);
+			s = &buf;
+		}else{
+			l = kseq_read(seq);
+			name = seq->name.s;
+			s = &seq->seq;
+		}
+		if(l >= 0){
+			pair_t *p = &a[n];
+			if(half == 0){ p->n1 = strdup(name); kputsn(s->s, s->l, &p->s1); }
+			else{ p->n2 = strdup(name); kputsn(s->s, s->l, &p->s2); n++; }
+			half ^= 1;
+		}
+		STATS_END(STATS_PARSE);
+		if(l < 0 && half){
+			fprintf(stderr, "[%s] odd number of records, the last one is ignored\n", __func__);
+			pair_free(&a[n]);
+		}
+		if(n == BATCH_CHUNK || (l < 0 && n > 0)){
+			batch_chunk(a, n, opt, mode);
+			for(i = 0; i < n; i++) pair_free(&a[i]);
+			n = 0;
+		}
+		if(l < 0) break;
+	}
+	free(a);
+	if(sh != NULL){
+		shard_close(sh);
+		free(buf.s);
+	}else{
+		kseq_destroy(seq);
+		gzclose(fp);
+	}
+	return 0;
+}
+
+int
+main_batch(int argc, char *argv[]){
+	opt_t *opt = init_opt();
+	int c, mode = BATCH_GLOBAL, shard_i = 0, shard_n = 0;
+	while ((c = getopt_long(argc, argv, "m:u:o:e:a:bM:", batch_long_opts, NULL)) >= 0) {
+			switch (c) {
+			case 'm': opt->m = atoi(optarg); break;
+			case 'u': opt->u = atoi(optarg); break;
+			case 'o': opt->o = atoi(optarg); break;
+			case 'e': opt->e = atoi(optarg); break;
+			case 'a':
+				if(strcmp(optarg, "global") == 0) mode = BATCH_GLOBAL;
+				else if(strcmp(optarg, "local") == 0) mode = BATCH_LOCAL;
+				else if(strcmp(optarg, "edit") == 0) mode = BATCH_EDIT;
+				else die("unknown recurrence '%s'\n", optarg);
+				break;
+			case 'b': opt->b = true; break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case PLAN_OPT_MIN_SCORE: opt->min_score = atoi(optarg); break;
+			case BATCH_OPT_SHARD: shard_parse(optarg, &shard_i, &shard_n); break;
+			default: return 1;
+		}
+	}
+	if (optind + 1 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools batch [options] <pairs.fa>\n\n");
+				fprintf(stderr, "Options: -m INT   score for a match [%d]\n", opt->m);
+				fprintf(stderr, "         -u INT   mismatch penalty [%d]\n", opt->u);
+				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
+				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -a STR   recurrence: global, local or edit [global]\n");
+				fprintf(stderr, "         -b       also score the reverse complement of the first sequence (--both-strands)\n");
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "         --min-score INT  drop pairs scoring lower (global only)\n");
+				fprintf(stderr, "         --shard i/N      score shard i (0-based) of N only; needs <pairs.fa>.fai (alignTools faidx)\n");
+				fprintf(stderr, "\n");
+				fprintf(stderr, "Records 1-2, 3-4, ... of <pairs.fa> are scored as pairs. The outputs of shards\n");
+				fprintf(stderr, "0..N-1, concatenated in order, are the output of the whole file.\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	if(opt->min_score != -INFINITY && mode != BATCH_GLOBAL) die("--min-score is for -a global\n");
+	batch_align(argv[optind], opt, mode, shard_i, shard_n);
+	free(opt);
+	return 0;
+}
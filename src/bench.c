@@ -0,0 +1,346 @@
+/*--------------------------------------------------------------------*/
+/* bench.c 		                                                      */
+/* Performance regression harness, built and run by `make bench`.     */
+/*                                                                    */
+/* Writes a fixed corpus of generated pairs (the generator is seeded  */
+/* by case name, so every run sees the same bases) to bench/corpus/,  */
+/* runs each case through the alignTools binary a few times and       */
+/* records the median wall time, GCUPS (m*n cells per ns) and the     */
+/* peak RSS of the child, and the score it printed.                   */
+/* The run is appended as one JSON line to bench/history.jsonl and    */
+/* compared with bench/baseline.json: a case more than -t percent     */
+/* slower or bigger than the baseline is a regression, and any        */
+/* regression makes the exit status 1. Differences under 5 ms or      */
+/* 1 MB are noise (process start-up dominates the small cases). A     */
+/* score that differs between runs or from the baseline's is always   */
+/* a regression: a faster engine must give the same answer. When      */
+/* there is no baseline, or with -u, the run becomes the baseline.    */
+/* -n only runs every case once and records nothing: the training run */
+/* of `make pgo`.                                                     */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "alignment.h"
+
+#define BENCH_DIR               "bench"
+#define BENCH_CORPUS            BENCH_DIR "/corpus"
+#define BENCH_BASELINE          BENCH_DIR "/baseline.json"
+#define BENCH_HISTORY           BENCH_DIR "/history.jsonl"
+#define BENCH_OUT               BENCH_DIR "/out.txt"
+#define BENCH_NOISE_S           0.005
+#define BENCH_NOISE_KB          1024
+
+typedef struct {
+	const char *cmd;   // subcommand
+	const char *opts;  // extra options, space separated
+	int len;           // length of s2
+	int ident;         // percent identity of the aligned part
+} bench_case_t;
+
+/*
+ * the corpus: every subcommand from 100 bp up to the largest length
+ * it finishes in seconds, at three identities
+ */
+static const bench_case_t bench_cases[] = {
+	{"global", "", 100, 99}, {"global", "", 100, 90}, {"global", "", 100, 75},
+	{"global", "", 1000, 99}, {"global", "", 1000, 90}, {"global", "", 1000, 75},
+	{"global", "", 10000, 99}, {"global", "", 10000, 90}, {"global", "", 10000, 75},
+	{"global", "", 100000, 99},
+	{"local", "", 100, 99}, {"local", "", 100, 90}, {"local", "", 100, 75},
+	{"local", "", 1000, 99}, {"local", "", 1000, 90}, {"local", "", 1000, 75},
+	{"local", "", 10000, 99}, {"local", "", 10000, 90}, {"local", "", 10000, 75},
+	{"fit", "", 1000, 99}, {"fit", "", 1000, 90}, {"fit", "", 1000, 75},
+	{"fit", "", 10000, 99}, {"fit", "", 10000, 90}, {"fit", "", 10000, 75},
+	{"fit", "", 100000, 99}, {"fit", "", 100000, 90}, {"fit", "", 100000, 75},
+	{"overlap", "", 100, 99}, {"overlap", "", 100, 90}, {"overlap", "", 100, 75},
+	{"overlap", "", 1000, 99}, {"overlap", "", 1000, 90}, {"overlap", "", 1000, 75},
+	{"overlap", "", 5000, 99}, {"overlap", "", 5000, 90}, {"overlap", "", 5000, 75},
+	{"edit", "-u 1 -o 1", 100, 99}, {"edit", "-u 1 -o 1", 100, 90}, {"edit", "-u 1 -o 1", 100, 75},
+	{"edit", "-u 1 -o 1", 1000, 99}, {"edit", "-u 1 -o 1", 1000, 90}, {"edit", "-u 1 -o 1", 1000, 75},
+	{"edit", "-u 1 -o 1", 10000, 99}, {"edit", "-u 1 -o 1", 10000, 90}, {"edit", "-u 1 -o 1", 10000, 75},
+	{"edit", "-u 1 -o 1", 100000, 99}, {"edit", "-u 1 -o 1", 100000, 90}, {"edit", "-u 1 -o 1", 100000, 75},
+};
+#define BENCH_N                 (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+typedef struct {
+	char name[64];
+	size_t m, n;
+	double seconds, gcups, score;
+	long rss_kb;
+} bench_res_t;
+
+static uint64_t bench_seed;
+
+static inline uint32_t
+bench_rand(){
+	bench_seed = bench_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return bench_seed >> 33;
+}
+
+static void
+bench_random(kstring_t *s, int len){
+	while(len-- > 0) kputc("ACGT"[bench_rand() & 3], s);
+}
+
+/*
+ * append src[0,len) to s with (100-ident)% errors: 80% substitutions,
+ * 10% insertions, 10% deletions
+ */
+static void
+bench_mutate(kstring_t *s, const char *src, int len, int ident){
+	int i;
+	for(i = 0; i < len; i++){
+		if((int)(bench_rand() % 10000) >= (100 - ident) * 100){
+			kputc(src[i], s);
+			continue;
+		}
+		switch(bench_rand() % 10){
+			case 0:  kputc("ACGT"[bench_rand() & 3], s); kputc(src[i], s); break;
+			case 1:  break;
+			default: kputc("ACGT"[(strchr("ACGT", src[i]) - "ACGT" + 1 + bench_rand() % 3) & 3], s); break;
+		}
+	}
+}
+
+/*
+ * the pair of case c: s2 is random, s1 is made from it as the
+ * subcommand expects (whole, embedded, a read, or a suffix/prefix)
+ */
+static void
+bench_pair(const bench_case_t *c, kstring_t *s1, kstring_t *s2){
+	const int len = c->len;
+	s1->l = s2->l = 0;
+	bench_random(s2, len);
+	if(strcmp(c->cmd, "local") == 0){
+		bench_random(s1, len / 10);
+		bench_mutate(s1, s2->s + len / 4, len / 2, c->ident);
+		bench_random(s1, len / 10);
+	}else if(strcmp(c->cmd, "fit") == 0){
+		int m = len / 2 < 1000 ? len / 2 : 1000;
+		bench_mutate(s1, s2->s + len / 3, m, c->ident);
+	}else if(strcmp(c->cmd, "overlap") == 0){
+		bench_random(s1, len / 2);
+		bench_mutate(s1, s2->s, len / 2, c->ident);
+	}else{
+		bench_mutate(s1, s2->s, len, c->ident);
+	}
+}
+
+static double
+bench_now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * the score printed in out, score=X, edit_distance=X or X alone on
+ * its line (overlap); NAN when there is none
+ */
+static double
+bench_score(const char *out){
+	char line[64];
+	double x;
+	int k;
+	FILE *fp = fopen(out, "r");
+	if(fp == NULL) return NAN;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		if(sscanf(line, "score=%lf", &x) == 1 || sscanf(line, "edit_distance=%lf", &x) == 1 ||
+				(sscanf(line, "%lf%n", &x, &k) == 1 && (line[k] == '\n' || line[k] == '\0'))){
+			fclose(fp);
+			return x;
+		}
+		// the rest of a long line
+		while(strchr(line, '\n') == NULL && fgets(line, sizeof(line), fp) != NULL);
+	}
+	fclose(fp);
+	return NAN;
+}
+
+/*
+ * one run of bin cmd opts fn, its output in BENCH_OUT; returns the
+ * wall time, *rss the child's peak RSS in KB
+ */
+static double
+bench_run(const char *bin, const bench_case_t *c, const char *fn, long *rss){
+	char opts[64], *argv[16], *p;
+	int argc = 0, status, fd;
+	struct rusage ru;
+	strncpy(opts, c->opts, sizeof(opts) - 1);
+	opts[sizeof(opts) - 1] = '\0';
+	argv[argc++] = (char*)bin;
+	argv[argc++] = (char*)c->cmd;
+	for(p = strtok(opts, " "); p && argc < 14; p = strtok(NULL, " ")) argv[argc++] = p;
+	argv[argc++] = (char*)fn;
+	argv[argc] = NULL;
+	double t = bench_now();
+	pid_t pid = fork();
+	if(pid < 0) die("bench: fork failed: %s", strerror(errno));
+	if(pid == 0){
+		if((fd = open(BENCH_OUT, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0){ dup2(fd, 1); close(fd); }
+		if((fd = open("/dev/null", O_WRONLY)) >= 0){ dup2(fd, 2); close(fd); }
+		execv(bin, argv);
+		_exit(127);
+	}
+	if(wait4(pid, &status, 0, &ru) < 0) die("bench: wait4 failed: %s", strerror(errno));
+	t = bench_now() - t;
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) die("bench: %s %s %s failed with status %d", bin, c->cmd, fn, status);
+	*rss = ru.ru_maxrss;
+	return t;
+}
+
+static int
+bench_cmp(const void *a, const void *b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+bench_json(FILE *fp, const char *commit, const bench_res_t *r, size_t n){
+	size_t i;
+	fprintf(fp, "{\"commit\":\"%s\",\"date\":%ld,\"cases\":[", commit, (long)time(NULL));
+	for(i = 0; i < n; i++)
+		fprintf(fp, "%s{\"name\":\"%s\",\"m\":%zu,\"n\":%zu,\"seconds\":%.6f,\"gcups\":%.4f,\"rss_kb\":%ld,\"score\":%.6f}",
+				i ? "," : "", r[i].name, r[i].m, r[i].n, r[i].seconds, r[i].gcups, r[i].rss_kb, r[i].score);
+	fprintf(fp, "]}\n");
+}
+
+/*
+ * seconds, rss and score of case name in the baseline text; -1 when
+ * absent. *score is NAN for a baseline from before scores were kept.
+ */
+static int
+bench_lookup(const char *base, const char *name, double *seconds, long *rss, double *score){
+	char key[96];
+	const char *p, *end;
+	snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+	if(base == NULL || (p = strstr(base, key)) == NULL || (end = strchr(p, '}')) == NULL) return -1;
+	if((p = strstr(p, "\"seconds\":")) == NULL || sscanf(p, "\"seconds\":%lf", seconds) != 1) return -1;
+	if((p = strstr(p, "\"rss_kb\":")) == NULL || sscanf(p, "\"rss_kb\":%ld", rss) != 1) return -1;
+	if((p = strstr(p, "\"score\":")) == NULL || p > end || sscanf(p, "\"score\":%lf", score) != 1) *score = NAN;
+	return 0;
+}
+
+static char
+*bench_slurp(const char *fn){
+	FILE *fp = fopen(fn, "r");
+	if(fp == NULL) return NULL;
+	fseek(fp, 0, SEEK_END);
+	long l = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *s = mycalloc(l + 1, char);
+	if(fread(s, 1, l, fp) != (size_t)l) die("bench: fail to read %s", fn);
+	fclose(fp);
+	return s;
+}
+
+static int
+bench_usage(){
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage:   bench [options] <alignTools>\n\n");
+	fprintf(stderr, "Options: -r INT   runs per case, the median is kept [3]\n");
+	fprintf(stderr, "         -t INT   regression threshold in percent [15]\n");
+	fprintf(stderr, "         -c STR   commit recorded with the run\n");
+	fprintf(stderr, "         -u       make this run the baseline\n");
+	fprintf(stderr, "         -n       run every case once, record and compare nothing\n");
+	fprintf(stderr, "\n");
+	return 1;
+}
+
+int
+main(int argc, char *argv[]){
+	int c, runs = 3, tol = 15, update = 0, train = 0, bad = 0;
+	const char *commit = "";
+	size_t i, k;
+	while((c = getopt(argc, argv, "r:t:c:un")) >= 0){
+		switch(c){
+			case 'r': runs = atoi(optarg); break;
+			case 't': tol = atoi(optarg); break;
+			case 'c': commit = optarg; break;
+			case 'u': update = 1; break;
+			case 'n': train = 1; break;
+			default: return bench_usage();
+		}
+	}
+	if(optind + 1 > argc || runs < 1) return bench_usage();
+	const char *bin = argv[optind];
+	if(train) runs = 1;
+	mkdir(BENCH_DIR, 0755);
+	mkdir(BENCH_CORPUS, 0755);
+	char *base = update || train ? NULL : bench_slurp(BENCH_BASELINE);
+	bench_res_t *res = mycalloc(BENCH_N, bench_res_t);
+	double *t = mycalloc(runs, double);
+	kstring_t s1 = {0, 0, 0}, s2 = {0, 0, 0};
+	printf("%-22s %8s %8s %10s %8s %10s  %s\n", "case", "m", "n", "seconds", "GCUPS", "rss_kb", "vs baseline");
+	for(i = 0; i < BENCH_N; i++){
+		const bench_case_t *bc = &bench_cases[i];
+		bench_res_t *r = &res[i];
+		char fn[256];
+		snprintf(r->name, sizeof(r->name), "%s-%d-%d", bc->cmd, bc->len, bc->ident);
+		snprintf(fn, sizeof(fn), "%s/%s.fa", BENCH_CORPUS, r->name);
+		// seeded by name, so adding a case leaves the others alone
+		for(bench_seed = 11, k = 0; r->name[k]; k++) bench_seed = (bench_seed ^ (unsigned char)r->name[k]) * 1099511628211ULL;
+		bench_pair(bc, &s1, &s2);
+		FILE *fp = fopen(fn, "w");
+		if(fp == NULL) die("bench: fail to write %s", fn);
+		fprintf(fp, ">s1\n%s\n>s2\n%s\n", s1.s, s2.s);
+		fclose(fp);
+		r->m = s1.l; r->n = s2.l;
+		int wrong = 0;
+		for(k = 0; k < (size_t)runs; k++){
+			long rss;
+			t[k] = bench_run(bin, bc, fn, &rss);
+			if(rss > r->rss_kb) r->rss_kb = rss;
+			double sc = bench_score(BENCH_OUT);
+			if(isnan(sc)) die("bench: %s %s %s printed no score", bin, bc->cmd, fn);
+			if(k == 0) r->score = sc;
+			else if(sc != r->score) wrong = 1;
+		}
+		qsort(t, runs, sizeof(double), bench_cmp);
+		r->seconds = t[runs / 2];
+		r->gcups = (double)r->m * r->n / r->seconds * 1e-9;
+		printf("%-22s %8zu %8zu %10.4f %8.3f %10ld", r->name, r->m, r->n, r->seconds, r->gcups, r->rss_kb);
+		double bs, bscore;
+		long brss;
+		if(wrong){
+			printf("  SCORE CHANGED BETWEEN RUNS");
+			bad++;
+		}
+		if(bench_lookup(base, r->name, &bs, &brss, &bscore) == 0){
+			int slow = r->seconds > bs * (1 + tol / 100.0) && r->seconds - bs > BENCH_NOISE_S;
+			int big = r->rss_kb > brss * (1 + tol / 100.0) && r->rss_kb - brss > BENCH_NOISE_KB;
+			printf("  %+6.1f%% time %+6.1f%% rss%s", 100 * (r->seconds / bs - 1), 100 * ((double)r->rss_kb / brss - 1),
+					slow || big ? "  REGRESSION" : "");
+			bad += slow || big;
+			if(!isnan(bscore) && r->score != bscore){
+				printf("  SCORE %.0f, baseline %.0f", r->score, bscore);
+				bad++;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	if(train){
+		free(res); free(t); free(s1.s); free(s2.s);
+		return 0;
+	}
+	FILE *fp = fopen(BENCH_HISTORY, "a");
+	if(fp == NULL) die("bench: fail to open %s", BENCH_HISTORY);
+	bench_json(fp, commit, res, BENCH_N);
+	fclose(fp);
+	if(base == NULL){
+		if((fp = fopen(BENCH_BASELINE, "w")) == NULL) die("bench: fail to write %s", BENCH_BASELINE);
+		bench_json(fp, commit, res, BENCH_N);
+		fclose(fp);
+		printf("baseline written to %s\n", BENCH_BASELINE);
+	}else if(bad){
+		printf("%d regression(s) against %s: slower or bigger by more than %d%%, or a different score\n", bad, BENCH_BASELINE, tol);
+	}
+	free(base); free(res); free(t); free(s1.s); free(s2.s);
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+/*--------------------------------------------------------------------*/
+/* ckpt.c 		                                                      */
+/* Checkpointed traceback for global, local and fit.                  */
+/*                                                                    */
+/* The fill keeps two rows per state and copies every k-th row, the   */
+/* checkpoints, aside. The traceback then walks up one block of k     */
+/* rows at a time: the block is filled again from the checkpoint      */
+/* above it, this time with one pointer byte per cell, and the path   */
+/* is followed until it leaves the block at the top. Every block the  */
+/* path crosses is filled twice, so time is about twice that of the   */
+/* fill; memory is the checkpoint rows plus one block of pointers.    */
+/* With ns states a checkpoint is ns rows, and k = sqrt(8 ns m) gives */
+/* both the same size, about 2 (n+1) sqrt(8 ns m) bytes: ns is 3, one */
+/* more for the jump state of fit -s, two more for the long gaps of   */
+/* fit -p.                                                            */
+/*                                                                    */
+/* Boundaries, tie-breaking and the trace back loops are those of the */
+/* kernel and of trace_back_gla(), trace_back_local_affine() and      */
+/* trace_back_fit_affine_jump(), so the alignment equals that of the  */
+/* full matrices. A pointer byte holds where M came from in bits 0-2  */
+/* and one bit per other state.                                       */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define CK_M_LOW                0
+#define CK_M_MID                1
+#define CK_M_UPP                2
+#define CK_M_HOME               3
+#define CK_M_JUMP               4
+#define CK_M_LOW2               5
+#define CK_M_UPP2               6
+#define CK_M_MASK               7
+#define CK_L_MID                0x08
+#define CK_U_UPP                0x10
+#define CK_J_JUMP               0x20
+#define CK_L2_MID               0x40
+#define CK_U2_UPP2              0x80
+
+typedef struct {
+	kstring_t *s1, *s2;
+	int mode, jp, lg, ns;   // jump and long gap states of fit, states in all
+	const char *site;       // site_mask() when jp
+	double match, mismatch, gap, extension, jump, gap2, extension2;
+} ck_t;
+
+/* one row of every state; J, L2 and U2 are NULL when not used */
+typedef struct {
+	double *M, *L, *U, *J, *L2, *U2;
+} ck_rows_t;
+
+/*
+ * states kept per cell in mode
+ */
+static int
+ck_states(int mode, const opt_t *opt){
+	if(mode != KMODE_FIT) return 3;
+	return 3 + (opt->s == true ? 1 : 0) + (opt->p == true ? 2 : 0);
+}
+
+/*
+ * block height for m rows and ns states
+ */
+size_t
+ckpt_rows(size_t m, int ns){
+	size_t k = (size_t)sqrt(8.0 * ns * m);
+	return k > 0 ? k : 1;
+}
+
+/*
+ * bytes the engine takes for an m x n alignment in mode
+ */
+double
+ckpt_mem(int mode, size_t m, size_t n, const opt_t *opt){
+	const int ns = ck_states(mode, opt);
+	const double k = ckpt_rows(m, ns);
+	return (m / k + 1) * ns * (n + 1) * sizeof(double) + k * (n + 1) + 2.0 * ns * (n + 1) * sizeof(double)
+		+ 2.0 * (m + n) + (mode == KMODE_FIT && opt->s == true ? n + 1 : 0);
+}
+
+/*
+ * the rows of the states of c, one after another from base
+ */
+static ck_rows_t
+ck_rows(const ck_t *c, double *base){
+	const size_t n1 = c->s2->l + 1;
+	ck_rows_t r = {NULL, NULL, NULL, NULL, NULL, NULL};
+	r.M = base; r.L = r.M + n1; r.U = r.L + n1;
+	base = r.U + n1;
+	if(c->jp){ r.J = base; base += n1; }
+	if(c->lg){ r.L2 = base; r.U2 = r.L2 + n1; }
+	return r;
+}
+
+/*
+ * row 0 of the mode
+ */
+static void
+ck_first(const ck_t *c, const ck_rows_t *r){
+	const double neg = -INFINITY;
+	const size_t n = c->s2->l;
+	size_t j;
+	for(j = 0; j <= n; j++){
+		if(c->mode == KMODE_GLOBAL){
+			r->M[j] = j == 0 ? 0 : neg;
+			r->L[j] = j == 0 ? c->gap : neg;
+			r->U[j] = c->gap + c->extension * j;
+		}else if(c->mode == KMODE_LOCAL){
+			r->M[j] = r->L[j] = r->U[j] = 0;
+		}else{
+			r->M[j] = r->U[j] = 0;
+			r->L[j] = neg;
+			if(c->jp) r->J[j] = neg;
+			if(c->lg) r->L2[j] = r->U2[j] = neg;
+		}
+	}
+}
+
+/*
+ * row i in cr from row i-1 in pr, with pointers into P when tb; the
+ * kernel's recurrence for the mode, with the jump and long gap states
+ * of c when ext. for local, a new best M is recorded in *best/(*bi,*bj)
+ * when not tb. mode, ext and tb are literal constants at every call,
+ * as in kernel.c.
+ */
+static inline __attribute__((always_inline)) void
+ck_row(const ck_t *c, const int mode, const int ext, const int tb, size_t i, const ck_rows_t *pr, const ck_rows_t *cr,
+		uint8_t *P, double *best, size_t *bi, size_t *bj){
+	const double match = c->match, mismatch = c->mismatch, gap = c->gap, extension = c->extension, neg = -INFINITY;
+	const double jump = c->jump, gap2 = c->gap2, extension2 = c->extension2;
+	const size_t n = c->s2->l;
+	const int local = mode == KMODE_LOCAL, jp = ext && c->jp, lg = ext && c->lg;
+	const char a = c->s1->s[i-1], *b = c->s2->s, *site = c->site;
+	const double *pM = pr->M, *pL = pr->L, *pU = pr->U, *pJ = pr->J, *pL2 = pr->L2, *pU2 = pr->U2;
+	double *cM = cr->M, *cL = cr->L, *cU = cr->U, *cJ = cr->J, *cL2 = cr->L2, *cU2 = cr->U2;
+	double v;
+	uint8_t p;
+	size_t j;
+	if(mode == KMODE_GLOBAL){
+		cL[0] = gap + extension * i;
+		cM[0] = cU[0] = neg;
+	}else if(local){
+		cM[0] = cL[0] = cU[0] = 0;
+	}else{
+		cM[0] = cL[0] = cU[0] = neg;
+		if(jp) cJ[0] = neg;
+		if(lg) cL2[0] = cU2[0] = neg;
+	}
+	for(j = 1; j <= n; j++){
+		const double s = (a == b[j-1]) ? match : mismatch;
+		/* MID, written with selects: the branches mispredict on pointers */
+		double h = pL[j-1];
+		p = pM[j-1] > h ? CK_M_MID : CK_M_LOW;   h = pM[j-1] > h ? pM[j-1] : h;
+		p = pU[j-1] > h ? CK_M_UPP : p;          h = pU[j-1] > h ? pU[j-1] : h;
+		if(jp){ p = pJ[j-1] > h ? CK_M_JUMP : p;  h = pJ[j-1] > h ? pJ[j-1] : h; }
+		if(lg){
+			p = pL2[j-1] > h ? CK_M_LOW2 : p;    h = pL2[j-1] > h ? pL2[j-1] : h;
+			p = pU2[j-1] > h ? CK_M_UPP2 : p;    h = pU2[j-1] > h ? pU2[j-1] : h;
+		}
+		cM[j] = h + s;
+		if(local && 0 > cM[j]){ cM[j] = 0; p = CK_M_HOME; }
+		if(local && !tb && cM[j] > *best){ *best = cM[j]; *bi = i; *bj = j; }
+		/* LOW */
+		v = pM[j] + gap;
+		cL[j] = v > pL[j] + extension ? v : pL[j] + extension;
+		p |= v > pL[j] + extension ? CK_L_MID : 0;
+		/* UPP */
+		v = cU[j-1] + extension;
+		cU[j] = v > cM[j-1] + gap ? v : cM[j-1] + gap;
+		p |= v > cM[j-1] + gap ? CK_U_UPP : 0;
+		/* JUMP only opens at junction sites */
+		if(jp){
+			const int stay = site[j-1] == 0 || cJ[j-1] > cM[j-1] + jump;
+			cJ[j] = stay ? cJ[j-1] : cM[j-1] + jump;
+			p |= stay ? CK_J_JUMP : 0;
+		}
+		/* LOW2 and UPP2 */
+		if(lg){
+			v = pM[j] + gap2;
+			cL2[j] = v > pL2[j] + extension2 ? v : pL2[j] + extension2;
+			p |= v > pL2[j] + extension2 ? CK_L2_MID : 0;
+			v = cU2[j-1] + extension2;
+			cU2[j] = v > cM[j-1] + gap2 ? v : cM[j-1] + gap2;
+			p |= v > cM[j-1] + gap2 ? CK_U2_UPP2 : 0;
+		}
+		if(tb) P[j] = p;
+	}
+}
+
+static AT_CLONES void
+ck_fill_row(const ck_t *c, size_t i, const ck_rows_t *pr, const ck_rows_t *cr, double *best, size_t *bi, size_t *bj){
+	switch(c->mode){
+		case KMODE_GLOBAL: ck_row(c, KMODE_GLOBAL, 0, 0, i, pr, cr, NULL, best, bi, bj); break;
+		case KMODE_LOCAL:  ck_row(c, KMODE_LOCAL, 0, 0, i, pr, cr, NULL, best, bi, bj); break;
+		default:
+			if(c->ns > 3) ck_row(c, KMODE_FIT, 1, 0, i, pr, cr, NULL, best, bi, bj);
+			else ck_row(c, KMODE_FIT, 0, 0, i, pr, cr, NULL, best, bi, bj);
+			break;
+	}
+}
+
+static AT_CLONES void
+ck_tb_row(const ck_t *c, size_t i, const ck_rows_t *pr, const ck_rows_t *cr, uint8_t *P){
+	switch(c->mode){
+		case KMODE_GLOBAL: ck_row(c, KMODE_GLOBAL, 0, 1, i, pr, cr, P, NULL, NULL, NULL); break;
+		case KMODE_LOCAL:  ck_row(c, KMODE_LOCAL, 0, 1, i, pr, cr, P, NULL, NULL, NULL); break;
+		default:
+			if(c->ns > 3) ck_row(c, KMODE_FIT, 1, 1, i, pr, cr, P, NULL, NULL, NULL);
+			else ck_row(c, KMODE_FIT, 0, 1, i, pr, cr, P, NULL, NULL, NULL);
+			break;
+	}
+}
+
+static inline void
+ck_emit(char *o1, char *o2, size_t *cur, char c1, char c2){
+	o1[*cur] = c1;
+	o2[(*cur)++] = c2;
+}
+
+/*
+ * checkpointed alignment in mode (KMODE_GLOBAL, KMODE_LOCAL or
+ * KMODE_FIT); drop-in for the full-matrix aligners.
+ */
+double
+align_ckpt(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_ckpt: parameter error\n");
+	if(mode == KMODE_OVERLAP) die("align_ckpt: mode not supported");
+	if(mode == KMODE_FIT && s1->l > s2->l) die("first sequence must be shorter than the second to do fitting alignment");
+	const int jp = mode == KMODE_FIT && opt->s == true, lg = mode == KMODE_FIT && opt->p == true;
+	const int ns = ck_states(mode, opt);
+	const size_t m = s1->l, n = s2->l, k = ckpt_rows(m, ns), nck = m / k + 1, row = ns * (n + 1);
+	char *site = jp ? site_mask(opt, n) : NULL;
+	const ck_t c = {s1, s2, mode, jp, lg, ns, site, opt->m, opt->u, opt->o, opt->e, opt->j, opt->o2, opt->e2};
+	double *ck, *buf;
+	ck_rows_t pr, cr, qr, tr;
+	double max_score = -INFINITY;
+	size_t i, j, i_max = 0, j_max = 0, cur = 0, b;
+	int state = MID;
+	uint8_t *P;
+	char *o1, *o2;
+	STATS_BEGIN(STATS_ALLOC);
+	ck = mycalloc(nck * row, double);
+	buf = mycalloc(2 * row, double);
+	P = mycalloc(k * (n + 1), uint8_t);
+	o1 = mycalloc(m + n + 1, char);
+	o2 = mycalloc(m + n + 1, char);
+	STATS_END(STATS_ALLOC);
+	pr = ck_rows(&c, buf);
+	cr = ck_rows(&c, buf + row);
+	/* fill, saving rows 0, k, 2k, ... */
+	STATS_BEGIN(STATS_FILL);
+	qr = ck_rows(&c, ck);
+	ck_first(&c, &qr);
+	memcpy(cr.M, ck, row * sizeof(double));
+	for(i = 1; i <= m; i++){
+		tr = pr; pr = cr; cr = tr;
+		ck_fill_row(&c, i, &pr, &cr, &max_score, &i_max, &j_max);
+		if(i % k == 0) memcpy(ck + (i / k) * row, cr.M, row * sizeof(double));
+	}
+	/* end cell */
+	if(mode == KMODE_GLOBAL){
+		max_score = cr.L[n]; state = LOW;
+		if(cr.M[n] > max_score){ max_score = cr.M[n]; state = MID; }
+		if(cr.U[n] > max_score){ max_score = cr.U[n]; state = UPP; }
+		i_max = m; j_max = n;
+	}else if(mode == KMODE_FIT){
+		i_max = m;
+		for(j = 0; j <= n; j++) if(max_score < cr.M[j]){ max_score = cr.M[j]; j_max = j; state = MID; }
+		for(j = 0; j <= n; j++) if(max_score < cr.L[j]){ max_score = cr.L[j]; j_max = j; state = LOW; }
+		for(j = 0; lg && j <= n; j++) if(max_score < cr.L2[j]){ max_score = cr.L2[j]; j_max = j; state = LOW2; }
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * n);
+	/* trace back, one block at a time */
+	STATS_BEGIN(STATS_TRACE);
+	i = i_max; j = j_max;
+	while(i > 0 && (j > 0 || mode == KMODE_FIT) && state != HOME){
+		// rows b+1..i, filled again from checkpoint b
+		b = (i - 1) / k * k;
+		qr = ck_rows(&c, ck + (b / k) * row);
+		size_t l;
+		for(l = b + 1; l <= i; l++){
+			ck_tb_row(&c, l, &qr, &cr, P + (l - b - 1) * (n + 1));
+			tr = pr; pr = cr; cr = tr;
+			qr = pr;
+		}
+		STATS_CELLS((i - b) * n);
+		while(i > b && (j > 0 || mode == KMODE_FIT) && state != HOME){
+			const uint8_t p = P[(i - b - 1) * (n + 1) + j];
+			switch(state){
+				case LOW:
+					state = (p & CK_L_MID) ? MID : LOW;
+					ck_emit(o1, o2, &cur, s1->s[--i], '-');
+					break;
+				case MID:
+					switch(p & CK_M_MASK){
+						case CK_M_LOW:  state = LOW; break;
+						case CK_M_MID:  state = MID; break;
+						case CK_M_UPP:  state = UPP; break;
+						case CK_M_JUMP: state = JUMP; break;
+						case CK_M_LOW2: state = LOW2; break;
+						case CK_M_UPP2: state = UPP2; break;
+						default:        state = HOME; break;
+					}
+					if(state == HOME) break; // M(i,j)=0, nothing aligned here
+					ck_emit(o1, o2, &cur, s1->s[--i], s2->s[--j]);
+					break;
+				case UPP:
+					state = (p & CK_U_UPP) ? UPP : MID;
+					ck_emit(o1, o2, &cur, '-', s2->s[--j]);
+					break;
+				case JUMP:
+					state = (p & CK_J_JUMP) ? JUMP : MID;
+					ck_emit(o1, o2, &cur, '-', s2->s[--j]);
+					break;
+				case LOW2:
+					state = (p & CK_L2_MID) ? MID : LOW2;
+					ck_emit(o1, o2, &cur, s1->s[--i], '-');
+					break;
+				default:
+					state = (p & CK_U2_UPP2) ? UPP2 : MID;
+					ck_emit(o1, o2, &cur, '-', s2->s[--j]);
+					break;
+			}
+		}
+	}
+	// global: the rest of the first row or column
+	if(mode == KMODE_GLOBAL){
+		while(j > 0) ck_emit(o1, o2, &cur, '-', s2->s[--j]);
+		while(i > 0) ck_emit(o1, o2, &cur, s1->s[--i], '-');
+	}
+	r1->s = realloc(r1->s, cur + 1);
+	r2->s = realloc(r2->s, cur + 1);
+	if(r1->s == NULL || r2->s == NULL) die("align_ckpt: fail to allocate %zu bytes", cur + 1);
+	for(i = 0; i < cur; i++){
+		r1->s[i] = o1[cur-1-i];
+		r2->s[i] = o2[cur-1-i];
+	}
+	r1->s[cur] = r2->s[cur] = '\0';
+	r1->l = r2->l = cur;
+	STATS_END(STATS_TRACE);
+	free(ck); free(buf); free(P); free(o1); free(o2);
+	if(site) free(site);
+	return max_score;
+}
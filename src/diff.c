@@ -0,0 +1,479 @@
+/*--------------------------------------------------------------------*/
+/* diff.c 		                                                      */
+/* Difference-recurrence (Suzuki-Kasahara) kernel for affine global   */
+/* and fit alignment.                                                 */
+/*                                                                    */
+/* Instead of absolute scores H(i,j) the kernel keeps the differences */
+/* u(i,j) = H(i,j) - H(i-1,j)      v(i,j) = H(i,j) - H(i,j-1)         */
+/* x(i,j) = E(i+1,j) - H(i,j)      y(i,j) = F(i,j+1) - H(i,j)         */
+/* which stay within a few gap penalties of zero, so they fit in int8 */
+/* whatever the sequence length. With z = H(i,j) - H(i-1,j-1):        */
+/* z(i,j) = max{s(i,j), x(i-1,j)+v(i-1,j), y(i,j-1)+u(i,j-1)}         */
+/* u(i,j) = z(i,j) - v(i-1,j)                                         */
+/* v(i,j) = z(i,j) - u(i,j-1)                                         */
+/* x(i,j) = max{x(i-1,j)+v(i-1,j)-z(i,j), -q} - E                     */
+/* y(i,j) = max{y(i,j-1)+u(i,j-1)-z(i,j), -q} - E                     */
+/* where a gap of length k costs q+k*E, i.e. E = -e and q = e - o.    */
+/* Cells on one anti-diagonal are independent, so each diagonal is    */
+/* computed 16 (SSE2), 32 (AVX2) or 64 (AVX-512BW) cells at a time.   */
+/* The traceback keeps one byte per cell instead of the 48 of         */
+/* matrix_t.                                                          */
+/*                                                                    */
+/* With the two-piece affine gap (opt->p) a second pair x2/y2 with    */
+/* q2 = e2 - o2, E2 = -e2 carries the long piece, z also takes        */
+/* x2+v and y2+u, and a gap costs max{q+k*E, q2+k*E2}.                */
+/*                                                                    */
+/* E (vertical, L in alignment.h) and F (horizontal, U) open from H,  */
+/* so a gap may directly follow a gap in the other sequence. That     */
+/* never scores better than the L/M/U recurrence as long as u >= 2*e  */
+/* (and u >= 2*e2 with the long piece), which holds for the defaults  */
+/* of the single affine gap.                                          */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define DIFF_GLOBAL             0
+#define DIFF_FIT                1
+#define DIFF_PAD                64 // widest vector, in int8 lanes
+
+/* traceback byte: which term H came from, and whether the gaps extend */
+#define DIFF_H_DIAG             0
+#define DIFF_H_E                1
+#define DIFF_H_F                2
+#define DIFF_H_E2               3
+#define DIFF_H_F2               4
+#define DIFF_E_EXT              0x08 // 0x04 << state, for every gap state
+#define DIFF_F_EXT              0x10
+#define DIFF_E2_EXT             0x20
+#define DIFF_F2_EXT             0x40
+
+typedef struct {
+	int8_t *u, *y, *y2;      // updated in place
+	int8_t *x0, *v0, *x1, *v1, *x20, *x21; // x, v and x2 of the previous and the current diagonal
+	const int8_t *qs, *ts;   // s1 and reversed s2
+	int8_t sc_m, sc_u, q, e; // e is E = -opt->e
+	int8_t q2, e2;           // long gap piece
+	bool two;                // with x2/y2
+} diff_t;
+
+/*
+ * the kernel is only valid when every delta fits in int8
+ */
+static inline bool
+diff_ok(const opt_t *opt){
+	if(opt->m < 0 || opt->u > opt->m || opt->o > opt->e || opt->e > 0) return false;
+	if(2*opt->m - opt->u - 3*opt->o - 2*opt->e > 120) return false;
+	if(opt->p == true && (opt->o2 > opt->e2 || opt->e2 > 0 || 2*opt->m - opt->u - 3*opt->o2 - 2*opt->e2 > 120)) return false;
+	return true;
+}
+
+/*
+ * true when the kernel scores exactly like the L/M/U recurrence
+ */
+bool
+diff_exact(const opt_t *opt){
+	if(diff_ok(opt) == false || opt->u < 2 * opt->e) return false;
+	if(opt->p == true && opt->u < 2 * opt->e2) return false;
+	return true;
+}
+
+/*
+ * score of a gap of length k>0 in the fit recurrence
+ */
+static inline long
+diff_gap(const opt_t *opt, long k){
+	long g = opt->o + (k-1) * opt->e, g2 = opt->o2 + (k-1) * opt->e2;
+	return (opt->p == true && g2 > g) ? g2 : g;
+}
+
+/*
+ * one anti-diagonal r: cells t in [st, en] of row t, column r-t.
+ * reads x0/v0 (previous diagonal), writes x1/v1; p is NULL when no
+ * traceback is kept. only picked without SSE2
+ */
+#ifndef __SSE2__
+static void
+diff_diag_scalar(diff_t *w, long r, long st, long en, uint8_t *p){
+	const int8_t *qs = w->qs, *tr = w->ts - r;
+	long t;
+	for(t = st; t <= en; t++){
+		int a = w->x0[t-1] + w->v0[t-1], b = w->y[t] + w->u[t], z;
+		uint8_t d = DIFF_H_DIAG;
+		z = qs[t] == tr[t] ? w->sc_m : w->sc_u;
+		int a2 = 0, b2 = 0;
+		if(a > z){ z = a; d = DIFF_H_E; }
+		if(b > z){ z = b; d = DIFF_H_F; }
+		if(w->two == true){
+			a2 = w->x20[t-1] + w->v0[t-1]; b2 = w->y2[t] + w->u[t];
+			if(a2 > z){ z = a2; d = DIFF_H_E2; }
+			if(b2 > z){ z = b2; d = DIFF_H_F2; }
+		}
+		w->v1[t] = z - w->u[t];
+		w->u[t]  = z - w->v0[t-1];
+		a -= z; b -= z;
+		if(a > -w->q) d |= DIFF_E_EXT; else a = -w->q;
+		if(b > -w->q) d |= DIFF_F_EXT; else b = -w->q;
+		w->x1[t] = a - w->e;
+		w->y[t]  = b - w->e;
+		if(w->two == true){
+			a2 -= z; b2 -= z;
+			if(a2 > -w->q2) d |= DIFF_E2_EXT; else a2 = -w->q2;
+			if(b2 > -w->q2) d |= DIFF_F2_EXT; else b2 = -w->q2;
+			w->x21[t] = a2 - w->e2;
+			w->y2[t]  = b2 - w->e2;
+		}
+		if(p) p[t - st] = d;
+	}
+}
+#endif
+
+#ifdef __SSE2__
+static inline __m128i
+blend_epi8_sse2(__m128i a, __m128i b, __m128i m){
+	return _mm_or_si128(_mm_andnot_si128(m, a), _mm_and_si128(m, b));
+}
+
+static inline __m128i
+max_epi8_sse2(__m128i a, __m128i b){
+#ifdef __SSE4_1__
+	return _mm_max_epi8(a, b);
+#else
+	__m128i m = _mm_cmpgt_epi8(a, b);
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+#endif
+}
+
+static void
+diff_diag_sse2(diff_t *w, long r, long st, long en, uint8_t *p){
+	const int8_t *qs = w->qs, *tr = w->ts - r;
+	const __m128i sc_m = _mm_set1_epi8(w->sc_m), sc_u = _mm_set1_epi8(w->sc_u);
+	const __m128i q_ = _mm_set1_epi8(-w->q), e_ = _mm_set1_epi8(w->e);
+	const __m128i one = _mm_set1_epi8(DIFF_H_E), two = _mm_set1_epi8(DIFF_H_F);
+	const __m128i fe = _mm_set1_epi8(DIFF_E_EXT), ff = _mm_set1_epi8(DIFF_F_EXT);
+	const __m128i q2_ = _mm_set1_epi8(-w->q2), e2_ = _mm_set1_epi8(w->e2);
+	const __m128i three = _mm_set1_epi8(DIFF_H_E2), four = _mm_set1_epi8(DIFF_H_F2);
+	const __m128i fe2 = _mm_set1_epi8(DIFF_E2_EXT), ff2 = _mm_set1_epi8(DIFF_F2_EXT);
+	long t;
+	for(t = st; t <= en; t += 16){
+		__m128i xs = _mm_loadu_si128((const __m128i*)(w->x0 + t - 1));
+		__m128i vs = _mm_loadu_si128((const __m128i*)(w->v0 + t - 1));
+		__m128i uo = _mm_loadu_si128((const __m128i*)(w->u + t));
+		__m128i yo = _mm_loadu_si128((const __m128i*)(w->y + t));
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(qs + t)), _mm_loadu_si128((const __m128i*)(tr + t)));
+		__m128i z = _mm_or_si128(_mm_and_si128(eq, sc_m), _mm_andnot_si128(eq, sc_u));
+		__m128i a = _mm_adds_epi8(xs, vs), b = _mm_adds_epi8(yo, uo), a2, b2, gt, d;
+		gt = _mm_cmpgt_epi8(a, z);
+		d = _mm_and_si128(gt, one);
+		z = max_epi8_sse2(z, a);
+		gt = _mm_cmpgt_epi8(b, z);
+		d = blend_epi8_sse2(d, two, gt);
+		z = max_epi8_sse2(z, b);
+		if(w->two == true){
+			a2 = _mm_adds_epi8(_mm_loadu_si128((const __m128i*)(w->x20 + t - 1)), vs);
+			b2 = _mm_adds_epi8(_mm_loadu_si128((const __m128i*)(w->y2 + t)), uo);
+			gt = _mm_cmpgt_epi8(a2, z);
+			d = blend_epi8_sse2(d, three, gt);
+			z = max_epi8_sse2(z, a2);
+			gt = _mm_cmpgt_epi8(b2, z);
+			d = blend_epi8_sse2(d, four, gt);
+			z = max_epi8_sse2(z, b2);
+		}
+		_mm_storeu_si128((__m128i*)(w->v1 + t), _mm_subs_epi8(z, uo));
+		_mm_storeu_si128((__m128i*)(w->u + t), _mm_subs_epi8(z, vs));
+		a = _mm_subs_epi8(a, z);
+		b = _mm_subs_epi8(b, z);
+		d = _mm_or_si128(d, _mm_and_si128(_mm_cmpgt_epi8(a, q_), fe));
+		d = _mm_or_si128(d, _mm_and_si128(_mm_cmpgt_epi8(b, q_), ff));
+		_mm_storeu_si128((__m128i*)(w->x1 + t), _mm_subs_epi8(max_epi8_sse2(a, q_), e_));
+		_mm_storeu_si128((__m128i*)(w->y + t), _mm_subs_epi8(max_epi8_sse2(b, q_), e_));
+		if(w->two == true){
+			a2 = _mm_subs_epi8(a2, z);
+			b2 = _mm_subs_epi8(b2, z);
+			d = _mm_or_si128(d, _mm_and_si128(_mm_cmpgt_epi8(a2, q2_), fe2));
+			d = _mm_or_si128(d, _mm_and_si128(_mm_cmpgt_epi8(b2, q2_), ff2));
+			_mm_storeu_si128((__m128i*)(w->x21 + t), _mm_subs_epi8(max_epi8_sse2(a2, q2_), e2_));
+			_mm_storeu_si128((__m128i*)(w->y2 + t), _mm_subs_epi8(max_epi8_sse2(b2, q2_), e2_));
+		}
+		if(p) _mm_storeu_si128((__m128i*)(p + t - st), d);
+	}
+}
+#endif
+
+#ifdef AT_HAVE_AVX2
+static AT_TARGET("avx2") void
+diff_diag_avx2(diff_t *w, long r, long st, long en, uint8_t *p){
+	const int8_t *qs = w->qs, *tr = w->ts - r;
+	const __m256i sc_m = _mm256_set1_epi8(w->sc_m), sc_u = _mm256_set1_epi8(w->sc_u);
+	const __m256i q_ = _mm256_set1_epi8(-w->q), e_ = _mm256_set1_epi8(w->e);
+	const __m256i one = _mm256_set1_epi8(DIFF_H_E), two = _mm256_set1_epi8(DIFF_H_F);
+	const __m256i fe = _mm256_set1_epi8(DIFF_E_EXT), ff = _mm256_set1_epi8(DIFF_F_EXT);
+	const __m256i q2_ = _mm256_set1_epi8(-w->q2), e2_ = _mm256_set1_epi8(w->e2);
+	const __m256i three = _mm256_set1_epi8(DIFF_H_E2), four = _mm256_set1_epi8(DIFF_H_F2);
+	const __m256i fe2 = _mm256_set1_epi8(DIFF_E2_EXT), ff2 = _mm256_set1_epi8(DIFF_F2_EXT);
+	long t;
+	for(t = st; t <= en; t += 32){
+		__m256i xs = _mm256_loadu_si256((const __m256i*)(w->x0 + t - 1));
+		__m256i vs = _mm256_loadu_si256((const __m256i*)(w->v0 + t - 1));
+		__m256i uo = _mm256_loadu_si256((const __m256i*)(w->u + t));
+		__m256i yo = _mm256_loadu_si256((const __m256i*)(w->y + t));
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(qs + t)), _mm256_loadu_si256((const __m256i*)(tr + t)));
+		__m256i z = _mm256_blendv_epi8(sc_u, sc_m, eq);
+		__m256i a = _mm256_adds_epi8(xs, vs), b = _mm256_adds_epi8(yo, uo), a2, b2, gt, d;
+		gt = _mm256_cmpgt_epi8(a, z);
+		d = _mm256_and_si256(gt, one);
+		z = _mm256_max_epi8(z, a);
+		gt = _mm256_cmpgt_epi8(b, z);
+		d = _mm256_blendv_epi8(d, two, gt);
+		z = _mm256_max_epi8(z, b);
+		if(w->two == true){
+			a2 = _mm256_adds_epi8(_mm256_loadu_si256((const __m256i*)(w->x20 + t - 1)), vs);
+			b2 = _mm256_adds_epi8(_mm256_loadu_si256((const __m256i*)(w->y2 + t)), uo);
+			gt = _mm256_cmpgt_epi8(a2, z);
+			d = _mm256_blendv_epi8(d, three, gt);
+			z = _mm256_max_epi8(z, a2);
+			gt = _mm256_cmpgt_epi8(b2, z);
+			d = _mm256_blendv_epi8(d, four, gt);
+			z = _mm256_max_epi8(z, b2);
+		}
+		_mm256_storeu_si256((__m256i*)(w->v1 + t), _mm256_subs_epi8(z, uo));
+		_mm256_storeu_si256((__m256i*)(w->u + t), _mm256_subs_epi8(z, vs));
+		a = _mm256_subs_epi8(a, z);
+		b = _mm256_subs_epi8(b, z);
+		d = _mm256_or_si256(d, _mm256_and_si256(_mm256_cmpgt_epi8(a, q_), fe));
+		d = _mm256_or_si256(d, _mm256_and_si256(_mm256_cmpgt_epi8(b, q_), ff));
+		_mm256_storeu_si256((__m256i*)(w->x1 + t), _mm256_subs_epi8(_mm256_max_epi8(a, q_), e_));
+		_mm256_storeu_si256((__m256i*)(w->y + t), _mm256_subs_epi8(_mm256_max_epi8(b, q_), e_));
+		if(w->two == true){
+			a2 = _mm256_subs_epi8(a2, z);
+			b2 = _mm256_subs_epi8(b2, z);
+			d = _mm256_or_si256(d, _mm256_and_si256(_mm256_cmpgt_epi8(a2, q2_), fe2));
+			d = _mm256_or_si256(d, _mm256_and_si256(_mm256_cmpgt_epi8(b2, q2_), ff2));
+			_mm256_storeu_si256((__m256i*)(w->x21 + t), _mm256_subs_epi8(_mm256_max_epi8(a2, q2_), e2_));
+			_mm256_storeu_si256((__m256i*)(w->y2 + t), _mm256_subs_epi8(_mm256_max_epi8(b2, q2_), e2_));
+		}
+		if(p) _mm256_storeu_si256((__m256i*)(p + t - st), d);
+	}
+}
+#endif
+
+#ifdef AT_HAVE_AVX512BW
+static AT_TARGET("avx512bw") void
+diff_diag_avx512(diff_t *w, long r, long st, long en, uint8_t *p){
+	const int8_t *qs = w->qs, *tr = w->ts - r;
+	const __m512i sc_m = _mm512_set1_epi8(w->sc_m), sc_u = _mm512_set1_epi8(w->sc_u);
+	const __m512i q_ = _mm512_set1_epi8(-w->q), e_ = _mm512_set1_epi8(w->e);
+	const __m512i one = _mm512_set1_epi8(DIFF_H_E), two = _mm512_set1_epi8(DIFF_H_F);
+	const __m512i fe = _mm512_set1_epi8(DIFF_E_EXT), ff = _mm512_set1_epi8(DIFF_F_EXT);
+	const __m512i q2_ = _mm512_set1_epi8(-w->q2), e2_ = _mm512_set1_epi8(w->e2);
+	const __m512i three = _mm512_set1_epi8(DIFF_H_E2), four = _mm512_set1_epi8(DIFF_H_F2);
+	const __m512i fe2 = _mm512_set1_epi8(DIFF_E2_EXT), ff2 = _mm512_set1_epi8(DIFF_F2_EXT);
+	long t;
+	for(t = st; t <= en; t += 64){
+		__m512i xs = _mm512_loadu_si512(w->x0 + t - 1);
+		__m512i vs = _mm512_loadu_si512(w->v0 + t - 1);
+		__m512i uo = _mm512_loadu_si512(w->u + t);
+		__m512i yo = _mm512_loadu_si512(w->y + t);
+		__mmask64 eq = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(qs + t), _mm512_loadu_si512(tr + t)), gt;
+		__m512i z = _mm512_mask_blend_epi8(eq, sc_u, sc_m);
+		__m512i a = _mm512_adds_epi8(xs, vs), b = _mm512_adds_epi8(yo, uo), a2, b2, d;
+		gt = _mm512_cmpgt_epi8_mask(a, z);
+		d = _mm512_maskz_mov_epi8(gt, one);
+		z = _mm512_max_epi8(z, a);
+		gt = _mm512_cmpgt_epi8_mask(b, z);
+		d = _mm512_mask_mov_epi8(d, gt, two);
+		z = _mm512_max_epi8(z, b);
+		if(w->two == true){
+			a2 = _mm512_adds_epi8(_mm512_loadu_si512(w->x20 + t - 1), vs);
+			b2 = _mm512_adds_epi8(_mm512_loadu_si512(w->y2 + t), uo);
+			gt = _mm512_cmpgt_epi8_mask(a2, z);
+			d = _mm512_mask_mov_epi8(d, gt, three);
+			z = _mm512_max_epi8(z, a2);
+			gt = _mm512_cmpgt_epi8_mask(b2, z);
+			d = _mm512_mask_mov_epi8(d, gt, four);
+			z = _mm512_max_epi8(z, b2);
+		}
+		_mm512_storeu_si512(w->v1 + t, _mm512_subs_epi8(z, uo));
+		_mm512_storeu_si512(w->u + t, _mm512_subs_epi8(z, vs));
+		a = _mm512_subs_epi8(a, z);
+		b = _mm512_subs_epi8(b, z);
+		d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(_mm512_cmpgt_epi8_mask(a, q_), fe));
+		d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(_mm512_cmpgt_epi8_mask(b, q_), ff));
+		_mm512_storeu_si512(w->x1 + t, _mm512_subs_epi8(_mm512_max_epi8(a, q_), e_));
+		_mm512_storeu_si512(w->y + t, _mm512_subs_epi8(_mm512_max_epi8(b, q_), e_));
+		if(w->two == true){
+			a2 = _mm512_subs_epi8(a2, z);
+			b2 = _mm512_subs_epi8(b2, z);
+			d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(_mm512_cmpgt_epi8_mask(a2, q2_), fe2));
+			d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(_mm512_cmpgt_epi8_mask(b2, q2_), ff2));
+			_mm512_storeu_si512(w->x21 + t, _mm512_subs_epi8(_mm512_max_epi8(a2, q2_), e2_));
+			_mm512_storeu_si512(w->y2 + t, _mm512_subs_epi8(_mm512_max_epi8(b2, q2_), e2_));
+		}
+		if(p) _mm512_storeu_si512(p + t - st, d);
+	}
+}
+#endif
+
+typedef void (*diff_diag_f)(diff_t *w, long r, long st, long en, uint8_t *p);
+
+/*
+ * the widest diagonal kernel this cpu runs (isa.h)
+ */
+static diff_diag_f
+diff_pick(void){
+#ifdef AT_HAVE_AVX512BW
+	if(ISA_HAS("avx512bw")) return diff_diag_avx512;
+#endif
+#ifdef AT_HAVE_AVX2
+	if(ISA_HAS("avx2")) return diff_diag_avx2;
+#endif
+#ifdef __SSE2__
+	return diff_diag_sse2;
+#else
+	return diff_diag_scalar;
+#endif
+}
+
+/*
+ * trace back from cell (i,j) through the per-diagonal bytes
+ */
+static void
+diff_backtrack(const uint8_t *P, const size_t *off, long n, long i, long j, int mode,
+		kstring_t *s1, kstring_t *s2, kstring_t *res_ks1, kstring_t *res_ks2){
+	int state = DIFF_H_DIAG, cur = 0;
+	while(i > 0 && j > 0){
+		long r = (i-1) + (j-1), st = r > n-1 ? r - (n-1) : 0;
+		uint8_t d = P[off[r] + (i-1) - st];
+		if(state == DIFF_H_DIAG) state = d & 7;
+		else if(!(d >> (state + 2) & 1)) state = d & 7; // the gap was opened from H here
+		if(state == DIFF_H_DIAG){
+			res_ks1->s[cur] = s1->s[--i];
+			res_ks2->s[cur++] = s2->s[--j];
+		}else if(state == DIFF_H_E || state == DIFF_H_E2){
+			res_ks1->s[cur] = s1->s[--i];
+			res_ks2->s[cur++] = '-';
+		}else{
+			res_ks1->s[cur] = '-';
+			res_ks2->s[cur++] = s2->s[--j];
+		}
+	}
+	while(i > 0){
+		res_ks1->s[cur] = s1->s[--i];
+		res_ks2->s[cur++] = '-';
+	}
+	if(mode == DIFF_GLOBAL){
+		while(j > 0){
+			res_ks1->s[cur] = '-';
+			res_ks2->s[cur++] = s2->s[--j];
+		}
+	}
+	res_ks1->l = cur;
+	res_ks2->l = cur;
+	res_ks1->s = strrev(res_ks1->s);
+	res_ks2->s = strrev(res_ks2->s);
+}
+
+/*
+ * fill the matrix anti-diagonal by anti-diagonal. Boundaries follow
+ * align_gla() for global (a leading gap of length k costs o+k*e) and
+ * align_fit_affine_jump() for fit (free leading/trailing s2).
+ * returns the score; r1/r2 receive the alignment when not NULL.
+ */
+static double
+diff_align(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, int mode){
+	long m = s1->l, n = s2->l, r, i;
+	diff_t w;
+	const diff_diag_f diff_diag = diff_pick();
+	STATS_BEGIN(STATS_ALLOC);
+	int8_t *buf = mycalloc(DIFF_PAD + 9 * (m + 2*DIFF_PAD) + 2 * (m + n + 2*DIFF_PAD), int8_t); // w.u starts DIFF_PAD in
+	w.u   = buf + DIFF_PAD;            w.y   = w.u   + m + 2*DIFF_PAD;
+	w.x0  = w.y   + m + 2*DIFF_PAD;    w.v0  = w.x0  + m + 2*DIFF_PAD;
+	w.x1  = w.v0  + m + 2*DIFF_PAD;    w.v1  = w.x1  + m + 2*DIFF_PAD;
+	w.y2  = w.v1  + m + 2*DIFF_PAD;    w.x20 = w.y2  + m + 2*DIFF_PAD;
+	w.x21 = w.x20 + m + 2*DIFF_PAD;
+	int8_t *qs = w.x21 + m + 2*DIFF_PAD, *ts = qs + m + n + 2*DIFF_PAD;
+	memcpy(qs, s1->s, m);
+	// ts[n-1-j] = s2[j], so that diagonal r reads s2[r-t] at ts - r + (n-1) + t
+	for(i = 0; i < n; i++) ts[DIFF_PAD + n - 1 - i] = s2->s[i];
+	w.qs = qs;
+	w.ts = ts + DIFF_PAD + n - 1;
+	w.sc_m = opt->m; w.sc_u = opt->u;
+	w.e = -opt->e; w.q = opt->e - opt->o;
+	w.e2 = -opt->e2; w.q2 = opt->e2 - opt->o2;
+	w.two = opt->p;
+
+	bool tb = (r1 != NULL && r2 != NULL) ? true : false;
+	uint8_t *P = NULL;
+	size_t *off = NULL;
+	if(tb == true){
+		P = mycalloc((size_t)m * n + DIFF_PAD, uint8_t);
+		off = mycalloc(m + n, size_t);
+	}
+	STATS_END(STATS_ALLOC);
+	STATS_BEGIN(STATS_FILL);
+	// H along the last row, for the score and the fit end column
+	double h = mode == DIFF_GLOBAL ? opt->o + (double)opt->e * m : diff_gap(opt, m) - opt->m - 1;
+	double max_score = mode == DIFF_GLOBAL ? h : -INFINITY;
+	long j_max = 0;
+	size_t o = 0;
+	for(r = 0; r < m + n - 1; r++){
+		long st = r > n-1 ? r - (n-1) : 0, en = r < m-1 ? r : m-1;
+		int8_t *tmp;
+		if(st == 0){ // above row 0: the first row of the matrix
+			w.x0[-1] = opt->o;
+			w.x20[-1] = opt->o2;
+			w.v0[-1] = mode == DIFF_GLOBAL ? (r == 0 ? opt->o + opt->e : opt->e) : 0;
+		}
+		if(en == r){ // left of column 0: the first column of the matrix
+			// fit forbids column 0; H(i,0) = gap(i)-m-1 keeps it strictly below any real path
+			if(mode == DIFF_GLOBAL) w.u[r] = r > 0 ? opt->e : opt->o + opt->e;
+			else w.u[r] = r > 0 ? diff_gap(opt, r+1) - diff_gap(opt, r) : diff_gap(opt, 1) - opt->m - 1;
+			w.y[r] = opt->o;
+			w.y2[r] = opt->o2;
+		}
+		if(tb == true){ off[r] = o; o += en - st + 1; }
+		diff_diag(&w, r, st, en, tb == true ? P + off[r] : NULL);
+		if(en == m-1){ // cell (m, r-m+2) of the last row
+			h += w.v1[m-1];
+			if(mode == DIFF_GLOBAL) max_score = h;
+			else if(h > max_score){ max_score = h; j_max = r - m + 2; }
+		}
+		tmp = w.x0; w.x0 = w.x1; w.x1 = tmp;
+		tmp = w.v0; w.v0 = w.v1; w.v1 = tmp;
+		tmp = w.x20; w.x20 = w.x21; w.x21 = tmp;
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * n);
+	if(tb == true){
+		STATS_BEGIN(STATS_TRACE);
+		diff_backtrack(P, off, n, m, mode == DIFF_GLOBAL ? n : j_max, mode, s1, s2, r1, r2);
+		STATS_END(STATS_TRACE);
+		free(P);
+		free(off);
+	}
+	free(buf);
+	return max_score;
+}
+
+/*
+ * global alignment with affine gap, drop-in for align_gla(); the
+ * planner's pick when the kernel would not score exactly
+ */
+double
+align_gla_diff(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align: parameter error\n");
+	if(diff_exact(opt) == false || s1->l == 0 || s2->l == 0) return plan_align(KMODE_GLOBAL, s1, s2, r1, r2, opt);
+	return diff_align(s1, s2, r1, r2, opt, DIFF_GLOBAL);
+}
+
+/*
+ * fit alignment with affine gap, drop-in for align_fit_affine_jump();
+ * the jump state is not part of this kernel, so -s goes to the planner
+ * too.
+ */
+double
+align_fit_diff(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align: parameter error\n");
+	if(s1->l > s2->l) die("first sequence must be shorter than the second to do fitting alignment");
+	if(diff_exact(opt) == false || opt->s == true || s1->l == 0) return plan_align(KMODE_FIT, s1, s2, r1, r2, opt);
+	return diff_align(s1, s2, r1, r2, opt, DIFF_FIT);
+}
@@ -0,0 +1,84 @@
+/*--------------------------------------------------------------------*/
+/* exact.c 		                                                      */
+/* Exact-match fast path in front of the fit, local and overlap DP.   */
+/*                                                                    */
+/* When a match scores m > 0, a mismatch less than m and every gap    */
+/* and jump less than 0, no alignment can beat m for each base of the */
+/* shorter side, and the only ones that reach it are gapless exact    */
+/* matches:                                                           */
+/* fit      s1 found in s2, score m*|s1|;                             */
+/* local    the shorter sequence found in the longer, score m*min;    */
+/* overlap  the suffix of s1 equal to the prefix of s2 is as long as  */
+/*          an overlap can be, min(|s1|, |s2|-1) as the last column   */
+/*          is never an end (kern_fill()), score m times that.        */
+/* Everything else is worse, so such a match is the unique optimum    */
+/* and the kernel traces back exactly it. Of several occurrences the  */
+/* kernel ends on the first one in row-major order, i.e. the leftmost */
+/* one, which is where the Boyer-Moore search kmemmem() (kstring.c)   */
+/* stops. The search is O(n/m) on average against the O(mn) fill and  */
+/* no matrix_t is allocated; when nothing matches it costs one pass   */
+/* over s2 and the DP runs as before.                                 */
+/*--------------------------------------------------------------------*/
+#include "alignment.h"
+
+/*
+ * whether an exact match is the unique optimum under this scoring
+ */
+bool
+exact_ok(int mode, const opt_t *opt){
+	if(mode != KMODE_FIT && mode != KMODE_LOCAL && mode != KMODE_OVERLAP) return false;
+	if(opt->m <= 0 || opt->u >= opt->m || opt->o >= 0) return false;
+	if(mode == KMODE_OVERLAP) return true; // linear gaps of o per base
+	if(opt->e > 0) return false;
+	if(mode == KMODE_FIT && opt->s == true && opt->j >= 0) return false;
+	if(mode == KMODE_FIT && opt->p == true && (opt->o2 >= 0 || opt->e2 > 0)) return false;
+	return true;
+}
+
+/*
+ * first occurrence of pat in str, -1 if none
+ */
+static long
+exact_find(const kstring_t *str, const kstring_t *pat){
+	int *prep = NULL;
+	if(pat->l > str->l || str->l > INT_MAX) return -1;
+	const char *p = kmemmem(str->s, str->l, pat->s, pat->l, &prep);
+	free(prep);
+	return p == NULL ? -1 : p - str->s;
+}
+
+static void
+exact_result(kstring_t *r, const char *s, size_t l){
+	memcpy(r->s, s, l);
+	r->s[l] = '\0';
+	r->l = l;
+}
+
+/*
+ * the optimal alignment (or, r1/r2 NULL, its score) of the mode when
+ * it is an exact match; false when it is not and the DP has to run
+ */
+bool
+exact_align(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, const opt_t *opt, double *score){
+	const size_t m = s1->l, n = s2->l;
+	size_t i1 = 0, i2 = 0, k;
+	long at;
+	if(m == 0 || n == 0 || exact_ok(mode, opt) == false) return false;
+	if(mode == KMODE_OVERLAP){
+		k = m < n - 1 ? m : n - 1;
+		if(k == 0 || memcmp(s1->s + m - k, s2->s, k) != 0) return false;
+		i1 = m - k;
+	}else if(m <= n){
+		if((at = exact_find(s2, s1)) < 0) return false;
+		k = m; i2 = at;
+	}else{
+		if(mode == KMODE_FIT || (at = exact_find(s1, s2)) < 0) return false;
+		k = n; i1 = at;
+	}
+	if(r1 != NULL && r2 != NULL){
+		exact_result(r1, s1->s + i1, k);
+		exact_result(r2, s2->s + i2, k);
+	}
+	*score = (double)opt->m * k;
+	return true;
+}
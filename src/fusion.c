@@ -0,0 +1,573 @@
+/*--------------------------------------------------------------------*/
+/* fusion.c 	                                                      */
+/* Multi-target fit with jumps between targets (fit -F -q), for       */
+/* fusion reads against a gene panel.                                 */
+/*                                                                    */
+/* Every sequence of the target file is a gene with its own junction  */
+/* sites. Within a gene the recurrences are those of fit -s. Besides  */
+/* its own J, a read may leave gene h from M at one of its sites d    */
+/* (as a splice jump does) and go on with M at a site a of any other  */
+/* gene g, the next base aligned to g[a], at the fusion penalty -J:   */
+/*                                                                    */
+/* M_g(i+1, a+1) = max{..., F_g(i) + s(x, g[a])}   (a a site of g)    */
+/* F_g(i) = max{M_h(i, d): h != g, d a site of h} + FUSION            */
+/*                                                                    */
+/* The genes are filled one after the other row by row, each in its   */
+/* own columns, with the score profile and the row kernels of prof.c; */
+/* the fusion input only touches the columns after a site. After     */
+/* each row the best donor of every gene is reduced to the best two   */
+/* of different genes, which is all F_g of the next row needs. So the */
+/* jumps cost O(sites + genes) per row instead of a J carried across  */
+/* a concatenated matrix, and no column is shared between genes.      */
+/*                                                                    */
+/* The forward pass keeps two rows and the best two donors of every   */
+/* row. With those fixed, each gene is a plain fit -s with a known    */
+/* extra input per row, so the traceback refills with pointers only   */
+/* the gene the alignment ends in, follows it up to the fusion, and   */
+/* repeats in the donor gene from the donor cell.                     */
+/*                                                                    */
+/* Reads are taken a chunk at a time and spread over the threads as   */
+/* in prof.c.                                                         */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <pthread.h>
+#include "alignment.h"
+
+#define FUS_CHUNK               16384           // reads per chunk
+#define FUS_SLOTS               256
+
+// pointer byte per cell: M in bits 0-2, L 3, U 4, J 5
+#define FUS_M_LOW               0
+#define FUS_M_MID               1
+#define FUS_M_UPP               2
+#define FUS_M_JUMP              3
+#define FUS_M_FUSE              4
+#define FUS_L_MID               0x08
+#define FUS_U_UPP               0x10
+#define FUS_J_JUMP              0x20
+
+/* what every worker reads */
+typedef struct {
+	int n;                  // genes
+	char **name;
+	kstring_t t;            // the genes one after the other
+	long *toff;             // gene g is t.s[toff[g], toff[g+1])
+	long *coff;             // and fills row columns [coff[g], coff[g+1]), one more than its length
+	char *site;             // site[toff[g] + p] != 0 iff a jump may start at g[p]
+	long *spos, *soff;      // sites of gene g: spos[soff[g], soff[g+1]), ascending
+	uint8_t slot[FUS_SLOTS];// byte -> profile row, as in prof.c
+	int32_t *prof;          // one row of s(slot, .) per slot over all columns
+	int32_t *fgate, *zero;  // J opens at column j iff fgate[j] = 0; all open
+	prof_ml_f ml;
+	prof_gap_f gap;
+	const opt_t *opt;
+} fus_t;
+
+/* a donor cell */
+typedef struct {
+	int32_t v;
+	int g;
+	long j;
+} fus_don_t;
+
+/* what a worker owns */
+typedef struct {
+	int32_t *buf;           // two rows per state, all genes
+	size_t cap;             // columns of buf
+	fus_don_t *top, *top2;  // best two donors of different genes per row, two strands
+	size_t top_cap, top2_cap;
+	uint8_t *P;             // pointers of one gene
+	size_t P_cap;
+	kstring_t rc;           // reverse complement of the read
+	kstring_t a1, a2, seg;  // alignment and segments, last first
+} fus_ws_t;
+
+typedef struct {
+	char *name;
+	kstring_t s, out;
+} fus_read_t;
+
+typedef struct {
+	const fus_t *f;
+	fus_read_t *r;
+	size_t n;
+	volatile size_t next;   // next read to take
+} fus_job_t;
+
+static inline long
+fus_len(const fus_t *f, int g){
+	return f->toff[g + 1] - f->toff[g];
+}
+
+/*
+ * F_g(i): the best donor of row i outside gene g, plus the penalty
+ */
+static inline int32_t
+fus_in(const fus_t *f, const fus_don_t *top, int g){
+	const fus_don_t *d = top[0].g != g ? &top[0] : &top[1];
+	return d->g < 0 ? PROF_NEG : d->v + f->opt->f;
+}
+
+static inline const fus_don_t
+*fus_src(const fus_don_t *top, int g){
+	return top[0].g != g ? &top[0] : &top[1];
+}
+
+static void
+fus_rows(fus_ws_t *w, size_t cols, prow_t *p, prow_t *c){
+	if(cols > w->cap){
+		free(w->buf);
+		w->cap = cols;
+		w->buf = mycalloc(8 * cols, int32_t);
+	}
+	p->M = w->buf;            p->L = p->M + w->cap; p->U = p->L + w->cap; p->J = p->U + w->cap;
+	c->M = p->J + w->cap;     c->L = c->M + w->cap; c->U = c->L + w->cap; c->J = c->U + w->cap;
+}
+
+static inline void
+fus_swap(prow_t *p, prow_t *c){
+	prow_t t = *p; *p = *c; *c = t;
+}
+
+/*
+ * row 0 of gene g: the read starts anywhere, not in a jump
+ */
+static void
+fus_first(const fus_t *f, int g, prow_t *c){
+	const long b = f->coff[g], n = fus_len(f, g);
+	long j;
+	for(j = 0; j <= n; j++){
+		c->M[b + j] = c->U[b + j] = 0;
+		c->L[b + j] = c->J[b + j] = PROF_NEG;
+	}
+}
+
+/*
+ * profile row of read base x, column 0 of gene g at offset coff[g]
+ */
+static inline const int32_t
+*fus_prof(const fus_t *f, char x){
+	return f->prof + (size_t)f->slot[(unsigned char)x] * f->coff[f->n];
+}
+
+/*
+ * one row of gene g with pointers to P[0..n], fusion input fin: the
+ * recurrences spelled out, for the traceback
+ */
+static void
+fus_row(const fus_t *f, int g, const int32_t *sp, const prow_t *p, prow_t *c, int32_t fin, uint8_t *P){
+	const opt_t *opt = f->opt;
+	const long b = f->coff[g], n = fus_len(f, g);
+	const char *site = f->site + f->toff[g];
+	const int32_t *sc = sp + b;
+	const int32_t *pM = p->M + b, *pL = p->L + b, *pU = p->U + b, *pJ = p->J + b;
+	int32_t *cM = c->M + b, *cL = c->L + b, *cU = c->U + b, *cJ = c->J + b;
+	int32_t h, v;
+	uint8_t k;
+	long j;
+	cM[0] = cL[0] = cU[0] = cJ[0] = PROF_NEG;
+	for(j = 1; j <= n; j++){
+		const int32_t s = sc[j];
+		h = pL[j-1]; k = FUS_M_LOW;
+		if(pM[j-1] > h){ h = pM[j-1]; k = FUS_M_MID; }
+		if(pU[j-1] > h){ h = pU[j-1]; k = FUS_M_UPP; }
+		if(pJ[j-1] > h){ h = pJ[j-1]; k = FUS_M_JUMP; }
+		if(site[j-1] && fin > h){ h = fin; k = FUS_M_FUSE; }
+		cM[j] = h + s;
+		cL[j] = pL[j] + opt->e;
+		if((v = pM[j] + opt->o) > cL[j]){ cL[j] = v; k |= FUS_L_MID; }
+		cU[j] = cM[j-1] + opt->o;
+		if((v = cU[j-1] + opt->e) > cU[j]){ cU[j] = v; k |= FUS_U_UPP; }
+		if(site[j-1]){
+			cJ[j] = cM[j-1] + opt->j;
+			if(cJ[j-1] > cJ[j]){ cJ[j] = cJ[j-1]; k |= FUS_J_JUMP; }
+		}else{
+			cJ[j] = cJ[j-1]; k |= FUS_J_JUMP;
+		}
+		P[j] = k;
+	}
+}
+
+/*
+ * the same row of gene g, score only, with the row kernels; returns
+ * the best donor, M of a site column, in *don
+ */
+static void
+fus_row_fast(const fus_t *f, int g, const int32_t *sp, const prow_t *p, prow_t *c, int32_t fin, fus_don_t *don){
+	const opt_t *opt = f->opt;
+	const long b = f->coff[g], n = fus_len(f, g);
+	const int32_t *sc = sp + b;
+	prow_t pg = {p->M + b, p->L + b, p->U + b, p->J + b};
+	prow_t cg = {c->M + b, c->L + b, c->U + b, c->J + b};
+	int32_t v;
+	long k, a;
+	cg.M[0] = cg.L[0] = cg.U[0] = cg.J[0] = PROF_NEG;
+	f->ml(&pg, &cg, sc, f->zero + b, 1, n, opt->o, opt->e, PROF_NEG);
+	// a fusion lands on M right after a site column
+	if(fin > PROF_NEG)
+		for(k = f->soff[g]; k < f->soff[g + 1]; k++){
+			a = f->spos[k] + 1;
+			if((v = fin + sc[a]) > cg.M[a]) cg.M[a] = v;
+		}
+	f->gap(cg.U, cg.M, f->zero + b, n, opt->o, opt->e);
+	f->gap(cg.J, cg.M, f->fgate + b, n, opt->j, 0);
+	don->v = PROF_NEG; don->g = g; don->j = 0;
+	for(k = f->soff[g]; k < f->soff[g + 1]; k++)
+		if(cg.M[f->spos[k]] > don->v){ don->v = cg.M[f->spos[k]]; don->j = f->spos[k]; }
+}
+
+/*
+ * fold the best donor of one gene into the best two of a row
+ */
+static inline void
+fus_top(fus_don_t *top, const fus_don_t *d){
+	if(d->v > top[0].v){
+		top[1] = top[0];
+		top[0] = *d;
+	}else if(d->v > top[1].v){
+		top[1] = *d;
+	}
+}
+
+/*
+ * score-only pass over all genes; fills w->top for rows 0..m-1 and
+ * returns the best score with its gene, column and state (MID or LOW)
+ */
+static int32_t
+fus_forward(const fus_t *f, fus_ws_t *w, const kstring_t *q, int *g_end, long *j_end, int *state){
+	const long m = q->l;
+	prow_t p, c;
+	fus_don_t none = {PROF_NEG, -1, 0}, d;
+	int32_t best = PROF_NEG;
+	long i, j;
+	int g;
+	STATS_BEGIN(STATS_FILL);
+	fus_rows(w, f->coff[f->n], &p, &c);
+	if((size_t)(2 * (m + 1)) > w->top_cap){
+		free(w->top);
+		w->top_cap = 2 * (m + 1);
+		w->top = mycalloc(w->top_cap, fus_don_t);
+	}
+	for(g = 0; g < f->n; g++) fus_first(f, g, &c);
+	w->top[0] = w->top[1] = none;
+	for(i = 1; i <= m; i++){
+		fus_swap(&p, &c);
+		fus_don_t *top = w->top + 2 * i;
+		const int32_t *sp = fus_prof(f, q->s[i-1]);
+		top[0] = top[1] = none;
+		for(g = 0; g < f->n; g++){
+			fus_row_fast(f, g, sp, &p, &c, fus_in(f, w->top + 2 * (i - 1), g), &d);
+			fus_top(top, &d);
+		}
+	}
+	*g_end = 0; *j_end = 0; *state = MID;
+	for(g = 0; g < f->n; g++)
+		for(j = 0; j <= fus_len(f, g); j++)
+			if(best < c.M[f->coff[g] + j]){ best = c.M[f->coff[g] + j]; *g_end = g; *j_end = j; *state = MID; }
+	for(g = 0; g < f->n; g++)
+		for(j = 0; j <= fus_len(f, g); j++)
+			if(best < c.L[f->coff[g] + j]){ best = c.L[f->coff[g] + j]; *g_end = g; *j_end = j; *state = LOW; }
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * (f->coff[f->n] - f->n));
+	return best;
+}
+
+/*
+ * refill rows 0..i of gene g with pointers into w->P
+ */
+static void
+fus_refill(const fus_t *f, fus_ws_t *w, const kstring_t *q, int g, long i){
+	const long n = fus_len(f, g);
+	prow_t p, c;
+	long r;
+	STATS_BEGIN(STATS_FILL);
+	if((size_t)((i + 1) * (n + 1)) > w->P_cap){
+		free(w->P);
+		w->P_cap = (i + 1) * (n + 1);
+		w->P = mycalloc(w->P_cap, uint8_t);
+	}
+	fus_rows(w, f->coff[f->n], &p, &c);
+	fus_first(f, g, &c);
+	for(r = 1; r <= i; r++){
+		fus_swap(&p, &c);
+		fus_row(f, g, fus_prof(f, q->s[r-1]), &p, &c, fus_in(f, w->top + 2 * (r - 1), g), w->P + r * (n + 1));
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(i * n);
+}
+
+/*
+ * trace the best alignment back through the genes; the alignment rows
+ * go to w->a1/a2 and the segment list to w->seg, all last column first
+ */
+static void
+fus_trace(const fus_t *f, fus_ws_t *w, const kstring_t *q, int g, long j, int state){
+	long i = q->l, n, hi, cur;
+	uint8_t k;
+	w->a1.l = w->a2.l = w->seg.l = 0;
+	while(1){
+		fus_refill(f, w, q, g, i);
+		STATS_BEGIN(STATS_TRACE);
+		n = fus_len(f, g);
+		hi = j;
+		const char *t = f->t.s + f->toff[g];
+		int fused = 0;
+		while(i > 0 && fused == 0){
+			k = w->P[i * (n + 1) + j];
+			switch(state){
+				case MID:
+					kputc(q->s[i-1], &w->a1);
+					kputc(t[j-1], &w->a2);
+					switch(k & 7){
+						case FUS_M_LOW: state = LOW; break;
+						case FUS_M_MID: state = MID; break;
+						case FUS_M_UPP: state = UPP; break;
+						case FUS_M_JUMP: state = JUMP; break;
+						default: fused = 1; break;
+					}
+					i--; j--;
+					break;
+				case LOW:
+					state = (k & FUS_L_MID) ? MID : LOW;
+					kputc(q->s[--i], &w->a1);
+					kputc('-', &w->a2);
+					break;
+				case UPP:
+					state = (k & FUS_U_UPP) ? UPP : MID;
+					kputc('-', &w->a1);
+					kputc(t[--j], &w->a2);
+					break;
+				case JUMP:
+					state = (k & FUS_J_JUMP) ? JUMP : MID;
+					kputc('-', &w->a1);
+					kputc(t[--j], &w->a2);
+					break;
+				default:
+					die("fus_trace: bad state %d", state);
+			}
+		}
+		// segments are written last first and reversed with the alignment
+		cur = w->seg.l;
+		ksprintf(&w->seg, "%s%s:%ld-%ld", cur ? "," : "", f->name[g], j, hi);
+		STATS_END(STATS_TRACE);
+		if(fused == 0) break;
+		const fus_don_t *d = fus_src(w->top + 2 * i, g);
+		g = d->g; j = d->j; state = MID;
+	}
+}
+
+static inline void
+fus_swap_top(fus_ws_t *w){
+	fus_don_t *t = w->top; w->top = w->top2; w->top2 = t;
+	size_t c = w->top_cap; w->top_cap = w->top2_cap; w->top2_cap = c;
+}
+
+/*
+ * one read, written to r->out
+ */
+static void
+fus_read(const fus_t *f, fus_ws_t *w, fus_read_t *r){
+	kstring_t *q = &r->s;
+	int g, rg, state, rstate;
+	long j, rj, k, a, b;
+	char strand = '+';
+	r->out.l = 0;
+	int32_t max = fus_forward(f, w, q, &g, &j, &state);
+	if(f->opt->b == true){
+		fus_swap_top(w);
+		revcomp(q, &w->rc);
+		int32_t rmax = fus_forward(f, w, &w->rc, &rg, &rj, &rstate);
+		if(rmax > max){
+			max = rmax; g = rg; j = rj; state = rstate;
+			q = &w->rc; strand = '-';
+		}else{
+			fus_swap_top(w); // back to the donors of the forward strand
+		}
+	}
+	if(max < f->opt->min_score) return;
+	fus_trace(f, w, q, g, j, state);
+	ksprintf(&r->out, ">%s\t", r->name);
+	// segments: put the comma separated list back in order
+	for(b = w->seg.l; b > 0; b = a - 1){
+		for(a = b; a > 0 && w->seg.s[a-1] != ','; a--);
+		kputsn(w->seg.s + a, b - a, &r->out);
+		if(a > 0) kputc(',', &r->out);
+		if(a == 0) break;
+	}
+	if(f->opt->b == true) ksprintf(&r->out, "\t%c", strand);
+	ksprintf(&r->out, "\nscore=%f\n", (double)max);
+	for(k = w->a1.l - 1; k >= 0; k--) kputc(w->a1.s[k], &r->out);
+	kputc('\n', &r->out);
+	for(k = w->a2.l - 1; k >= 0; k--) kputc(w->a2.s[k], &r->out);
+	kputc('\n', &r->out);
+}
+
+static void
+*fus_worker(void *data){
+	fus_job_t *job = (fus_job_t*)data;
+	fus_ws_t w;
+	size_t i;
+	memset(&w, 0, sizeof(w));
+	while((i = __sync_fetch_and_add(&job->next, 1)) < job->n) fus_read(job->f, &w, &job->r[i]);
+	free(w.buf);
+	free(w.top);
+	free(w.top2);
+	free(w.P);
+	free(w.rc.s);
+	free(w.a1.s); free(w.a2.s); free(w.seg.s);
+	STATS_FOLD();
+	return NULL;
+}
+
+/*
+ * read the genes of target_fn with their junction sites
+ */
+static void
+fus_init(fus_t *f, const char *target_fn, const opt_t *opt){
+	gzFile fp = gzopen(target_fn, "r");
+	if(fp == NULL) die("Can't open %s\n", target_fn);
+	kseq_t *seq = kseq_init(fp);
+	junction_t sites;
+	int cap = 0, g, i, n_slot;
+	size_t k;
+	long j, cols, ns;
+	memset(f, 0, sizeof(*f));
+	f->opt = opt;
+	kstring_t site = {0, 0, 0};
+	STATS_BEGIN(STATS_PARSE);
+	while(kseq_read(seq) >= 0){
+		if(f->n + 1 >= cap){
+			cap = cap ? cap * 2 : 16;
+			f->name = realloc(f->name, cap * sizeof(char*));
+			f->toff = realloc(f->toff, (cap + 1) * sizeof(long));
+			f->coff = realloc(f->coff, (cap + 1) * sizeof(long));
+			if(f->name == NULL || f->toff == NULL || f->coff == NULL) die("fus_init: out of memory");
+		}
+		f->name[f->n] = strdup(seq->name.s);
+		f->toff[f->n] = f->t.l;
+		f->coff[f->n] = f->t.l + f->n;
+		kputsn(seq->seq.s, seq->seq.l, &f->t);
+		// same junction convention as kstring_read(); a gene without sites takes no jumps
+		sites.size = 0; sites.pos = NULL;
+		if(seq->comment.s) junction_parse(seq->comment.s, &sites);
+		while(site.l < f->t.l) kputc(0, &site);
+		for(k = 0; k < sites.size; k++)
+			if(sites.pos[k] >= 0 && (size_t)sites.pos[k] < seq->seq.l) site.s[f->toff[f->n] + sites.pos[k]] = 1;
+		free(sites.pos);
+		f->n++;
+	}
+	if(f->n == 0) die("fail to read the targets from %s\n", target_fn);
+	f->toff[f->n] = f->t.l;
+	f->coff[f->n] = f->t.l + f->n;
+	while(site.l < f->t.l + 1) kputc(0, &site);
+	f->site = site.s;
+	STATS_END(STATS_PARSE);
+	kseq_destroy(seq);
+	gzclose(fp);
+	STATS_BEGIN(STATS_ALLOC);
+	cols = f->coff[f->n];
+	// site lists and gates
+	f->soff = mycalloc(f->n + 1, long);
+	for(g = 0, ns = 0; g < f->n; g++){
+		f->soff[g] = ns;
+		for(j = 0; j < fus_len(f, g); j++) ns += f->site[f->toff[g] + j] != 0;
+	}
+	f->soff[f->n] = ns;
+	f->spos = mycalloc(ns + 1, long);
+	f->fgate = mycalloc(cols + 1, int32_t);
+	f->zero = mycalloc(cols + 1, int32_t);
+	for(g = 0, ns = 0; g < f->n; g++){
+		f->fgate[f->coff[g]] = PROF_NEG;
+		for(j = 1; j <= fus_len(f, g); j++){
+			f->fgate[f->coff[g] + j] = f->site[f->toff[g] + j - 1] ? 0 : PROF_NEG;
+			if(f->site[f->toff[g] + j - 1]) f->spos[ns++] = j - 1;
+		}
+	}
+	// profile slots in order of first appearance; the last one matches nothing
+	for(i = 0; i < FUS_SLOTS; i++) f->slot[i] = FUS_SLOTS - 1;
+	for(k = 0, n_slot = 0; k < f->t.l; k++){
+		unsigned char c = f->t.s[k];
+		if(f->slot[c] == FUS_SLOTS - 1 && n_slot < FUS_SLOTS - 1) f->slot[c] = n_slot++;
+	}
+	for(i = 0; i < FUS_SLOTS; i++) if(f->slot[i] == FUS_SLOTS - 1) f->slot[i] = n_slot;
+	f->prof = mycalloc((size_t)(n_slot + 1) * cols, int32_t);
+	for(i = 0; i <= n_slot; i++)
+		for(g = 0; g < f->n; g++){
+			int32_t *r = f->prof + (size_t)i * cols + f->coff[g];
+			for(j = 1; j <= fus_len(f, g); j++)
+				r[j] = i < n_slot && f->slot[(unsigned char)f->t.s[f->toff[g] + j - 1]] == i ? opt->m : opt->u;
+		}
+	prof_kernels(&f->ml, &f->gap);
+	STATS_END(STATS_ALLOC);
+	fprintf(stderr, "[%s] %d targets, %ld bases\n", __func__, f->n, (long)f->t.l);
+}
+
+static void
+fus_destroy(fus_t *f){
+	int g;
+	for(g = 0; g < f->n; g++) free(f->name[g]);
+	free(f->name);
+	free(f->toff);
+	free(f->coff);
+	free(f->site);
+	free(f->spos);
+	free(f->soff);
+	free(f->fgate);
+	free(f->zero);
+	free(f->prof);
+	free(f->t.s);
+}
+
+/*
+ * align every read of fn against all sequences of target_fn at once,
+ * with fusion jumps between them, on n_threads threads
+ */
+int
+fusion_align_reads(const char *target_fn, const char *fn, opt_t *opt, int n_threads){
+	fus_t f;
+	if(opt->p == true) die("-F has no two-piece gap, drop -p");
+	fus_init(&f, target_fn, opt);
+	kstring_t empty = {0, 0, 0};
+	revcomp(&empty, &empty); // fills the complement table before the threads use it
+	free(empty.s);
+
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	kseq_t *seq = kseq_init(fp);
+	fus_read_t *r = mycalloc(FUS_CHUNK, fus_read_t);
+	pthread_t *tid = mycalloc(n_threads, pthread_t);
+	size_t n, i;
+	int t;
+	do{
+		STATS_BEGIN(STATS_PARSE);
+		for(n = 0; n < FUS_CHUNK && kseq_read(seq) >= 0; n++){
+			free(r[n].name);
+			r[n].name = strdup(seq->name.s);
+			r[n].s.l = 0;
+			kputsn(seq->seq.s, seq->seq.l, &r[n].s);
+		}
+		STATS_END(STATS_PARSE);
+		fus_job_t job = {&f, r, n, 0};
+		if(n_threads <= 1){
+			fus_worker(&job);
+		}else{
+			for(t = 0; t < n_threads; t++)
+				if(pthread_create(&tid[t], NULL, fus_worker, &job) != 0) die("fail to start thread %d", t);
+			for(t = 0; t < n_threads; t++) pthread_join(tid[t], NULL);
+		}
+		STATS_BEGIN(STATS_OUTPUT);
+		for(i = 0; i < n; i++) fwrite(r[i].out.s, 1, r[i].out.l, stdout);
+		STATS_END(STATS_OUTPUT);
+	}while(n == FUS_CHUNK);
+	for(i = 0; i < FUS_CHUNK; i++){
+		free(r[i].name);
+		free(r[i].s.s);
+		free(r[i].out.s);
+	}
+	free(r);
+	free(tid);
+	kseq_destroy(seq);
+	gzclose(fp);
+	fus_destroy(&f);
+	return 0;
+}
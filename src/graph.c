@@ -0,0 +1,263 @@
+/*--------------------------------------------------------------------*/
+/* graph.c 		                                                      */
+/* Fit alignment with jumps against an exon graph (fit -g).           */
+/*                                                                    */
+/* The junction sites are read as donor|acceptor pairs, one pair per  */
+/* intron: d1|a1|d2|a2|... with 0 <= d1 < a1 <= d2 < a2 ... <= n.    */
+/* s2[dk, ak) is intron k and the exons are what is left:             */
+/* s2[0, d1), s2[a1, d2), ..., s2[aK, n). The fill of align_fit_affine */
+/* _jump() runs over the intron columns only to carry J across them;  */
+/* here the DP columns are the exonic bases alone and the introns are */
+/* edges: the first base of exon k may follow, at the jump penalty,   */
+/* the last base of any exon before it (exon skipping included).      */
+/* DP area drops from read x gene to read x exonic length.            */
+/*                                                                    */
+/* Within an exon the recurrences, boundaries and tie-breaking are    */
+/* those of the fit kernel with -s (and -p). At an exon start only    */
+/* the jump edge enters: no M, gap or free diagonal step crosses an   */
+/* intron, and a jump still needs M on both sides. A jump ends at an  */
+/* acceptor rather than anywhere, so the score is at most that of     */
+/* fit -s with the same sites, and equal whenever its best alignment  */
+/* splices at annotated introns only. The skipped intron (and exons)  */
+/* is printed as '-' against s2, as fit -s does.                      */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+// pointer byte per state and cell, in bits: M 0-2, L 3, U 4, L2 5, U2 6
+#define GR_M_LOW                0
+#define GR_M_MID                1
+#define GR_M_UPP                2
+#define GR_M_JUMP               3
+#define GR_M_LOW2               4
+#define GR_M_UPP2               5
+#define GR_L_MID                0x08
+#define GR_U_UPP                0x10
+#define GR_L2_MID               0x20
+#define GR_U2_UPP               0x40
+
+typedef struct {
+	int n;                  // exons
+	long *beg, *end;        // exon k is s2[beg[k], end[k])
+	long *off;              // column before exon k's first base, off[n] = N
+	long N;                 // exonic bases
+	char *t;                // the exons joined, t[c-1] is column c
+	int *start;             // start[c] = k if c = off[k], k > 0; else -1
+} exon_graph_t;
+
+/*
+ * exons of s2 from the donor|acceptor pairs in opt->sites
+ */
+static void
+graph_build(const kstring_t *s2, const opt_t *opt, exon_graph_t *g){
+	const int *p = opt->sites.pos;
+	const long n = s2->l;
+	int k, K = opt->sites.size / 2;
+	long c, b, e, prev = 0;
+	if(opt->sites.size % 2 != 0) die("exon graph: junction sites must be donor|acceptor pairs, got %d sites", opt->sites.size);
+	for(k = 0; k < K; k++)
+		if(p[2*k] < prev || p[2*k] >= p[2*k+1] || p[2*k+1] > n)
+			die("exon graph: intron %d (%d|%d) is not within s2 or overlaps the one before", k + 1, p[2*k], p[2*k+1]);
+		else prev = p[2*k+1];
+	g->beg = mycalloc(K + 1, long);
+	g->end = mycalloc(K + 1, long);
+	g->off = mycalloc(K + 2, long);
+	g->n = 0; g->N = 0;
+	for(k = 0; k <= K; k++){
+		b = k == 0 ? 0 : p[2*k-1];
+		e = k == K ? n : p[2*k];
+		if(e <= b) continue; // an empty exon cannot hold M on either side of a jump
+		g->beg[g->n] = b; g->end[g->n] = e;
+		g->off[g->n++] = g->N;
+		g->N += e - b;
+	}
+	g->off[g->n] = g->N;
+	if(g->N == 0) die("exon graph: the introns cover all of s2");
+	g->t = mycalloc(g->N + 1, char);
+	g->start = mycalloc(g->N + 1, int);
+	for(c = 0; c <= g->N; c++) g->start[c] = -1;
+	for(k = 0; k < g->n; k++){
+		if(k > 0) g->start[g->off[k]] = k;
+		memcpy(g->t + g->off[k], s2->s + g->beg[k], g->end[k] - g->beg[k]);
+	}
+}
+
+static void
+graph_destroy(exon_graph_t *g){
+	free(g->beg); free(g->end); free(g->off);
+	free(g->t); free(g->start);
+}
+
+/*
+ * fit with jumps over the exon graph; pointers go to P (one byte per
+ * cell) and JP (source exon of J per row and exon), the end column
+ * and state of the best alignment to c_end and state
+ */
+static double
+graph_fill(const kstring_t *s1, const exon_graph_t *g, const opt_t *opt, uint8_t *P, int *JP,
+		int *state, long *c_end){
+	const double match = opt->m, mismatch = opt->u, gap = opt->o, extension = opt->e;
+	const double jump = opt->j, gap2 = opt->o2, extension2 = opt->e2, neg = -INFINITY;
+	const int lg = opt->p == true;
+	const long m = s1->l, N = g->N, K = g->n;
+	double *buf = mycalloc(10 * (N + 1) + 2 * K, double), *t;
+	double *pM = buf, *pL = pM + (N + 1), *pU = pL + (N + 1), *pL2 = pU + (N + 1), *pU2 = pL2 + (N + 1);
+	double *cM = pU2 + (N + 1), *cL = cM + (N + 1), *cU = cL + (N + 1), *cL2 = cU + (N + 1), *cU2 = cL2 + (N + 1);
+	double *pJ = cU2 + (N + 1), *cJ = pJ + K; // J entering exon k
+	double max_score = neg, v, run;
+	int max_state = MID, src;
+	long i, c, j_max = 0;
+	uint8_t *p, b;
+	STATS_BEGIN(STATS_FILL);
+	// row 0: the read may start anywhere, never with a jump
+	for(c = 0; c <= N; c++){
+		cM[c] = cU[c] = 0;
+		cL[c] = cL2[c] = cU2[c] = neg;
+	}
+	for(c = 0; c < K; c++) cJ[c] = neg;
+	for(i = 1; i <= m; i++){
+		t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;
+		t = pL2; pL2 = cL2; cL2 = t; t = pU2; pU2 = cU2; cU2 = t; t = pJ; pJ = cJ; cJ = t;
+		cM[0] = cL[0] = cU[0] = cL2[0] = cU2[0] = neg;
+		p = P + i * (N + 1);
+		run = neg; src = -1;
+		for(c = 1; c <= N; c++){
+			const double s = (s1->s[i-1] == g->t[c-1]) ? match : mismatch;
+			const int k = g->start[c-1];
+			if(k >= 0){
+				// first base of exon k: only the jump edge, or the read's first base, enters
+				if(i == 1){ cM[c] = pM[c-1] + s; b = GR_M_MID; }
+				else{ cM[c] = pJ[k] + s; b = GR_M_JUMP; }
+				cU[c] = cU2[c] = neg;
+			}else{
+				cM[c] = pL[c-1] + s; b = GR_M_LOW;
+				if((v = pM[c-1] + s) > cM[c]){ cM[c] = v; b = GR_M_MID; }
+				if((v = pU[c-1] + s) > cM[c]){ cM[c] = v; b = GR_M_UPP; }
+				if(lg && (v = pL2[c-1] + s) > cM[c]){ cM[c] = v; b = GR_M_LOW2; }
+				if(lg && (v = pU2[c-1] + s) > cM[c]){ cM[c] = v; b = GR_M_UPP2; }
+				cU[c] = cM[c-1] + gap;
+				if((v = cU[c-1] + extension) > cU[c]){ cU[c] = v; b |= GR_U_UPP; }
+				if(lg){
+					cU2[c] = cM[c-1] + gap2;
+					if((v = cU2[c-1] + extension2) > cU2[c]){ cU2[c] = v; b |= GR_U2_UPP; }
+				}
+			}
+			cL[c] = pL[c] + extension;
+			if((v = pM[c] + gap) > cL[c]){ cL[c] = v; b |= GR_L_MID; }
+			if(lg){
+				cL2[c] = pL2[c] + extension2;
+				if((v = pM[c] + gap2) > cL2[c]){ cL2[c] = v; b |= GR_L2_MID; }
+			}
+			p[c] = b;
+			// J of row i at the exon after this column; the latest donor wins ties, as in the kernel
+			if(g->start[c] >= 0){
+				if(cM[c] >= run){ run = cM[c]; src = g->start[c] - 1; }
+				cJ[g->start[c]] = run + jump;
+				JP[i * K + g->start[c]] = src;
+			}
+		}
+	}
+	for(c = 0; c <= N; c++) if(max_score < cM[c]){ max_score = cM[c]; j_max = c; max_state = MID; }
+	for(c = 0; c <= N; c++) if(max_score < cL[c]){ max_score = cL[c]; j_max = c; max_state = LOW; }
+	for(c = 0; lg && c <= N; c++) if(max_score < cL2[c]){ max_score = cL2[c]; j_max = c; max_state = LOW2; }
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * N);
+	free(buf);
+	*state = max_state;
+	*c_end = j_max;
+	return max_score;
+}
+
+/*
+ * trace back from row m, column c; an intron edge prints s2 between
+ * the donor and the acceptor against '-'
+ */
+static void
+graph_trace(const kstring_t *s1, const kstring_t *s2, const exon_graph_t *g, const uint8_t *P, const int *JP,
+		int state, long c, kstring_t *r1, kstring_t *r2){
+	const long N = g->N, K = g->n;
+	long i = s1->l, cur = 0, q;
+	int k, src;
+	uint8_t b;
+	while(i > 0){
+		b = P[i * (N + 1) + c];
+		switch(state){
+			case MID:
+				r1->s[cur] = s1->s[i-1];
+				r2->s[cur++] = g->t[c-1];
+				switch(b & 7){
+					case GR_M_LOW: state = LOW; break;
+					case GR_M_MID: state = MID; break;
+					case GR_M_UPP: state = UPP; break;
+					case GR_M_LOW2: state = LOW2; break;
+					case GR_M_UPP2: state = UPP2; break;
+					default: state = JUMP; break;
+				}
+				i--; c--;
+				if(state == JUMP){
+					k = g->start[c];
+					src = JP[i * K + k];
+					for(q = g->beg[k] - 1; q >= g->end[src]; q--){
+						r1->s[cur] = '-';
+						r2->s[cur++] = s2->s[q];
+					}
+					c = g->off[src + 1];
+					state = MID;
+				}
+				break;
+			case LOW:
+				state = (b & GR_L_MID) ? MID : LOW;
+				r1->s[cur] = s1->s[--i];
+				r2->s[cur++] = '-';
+				break;
+			case UPP:
+				state = (b & GR_U_UPP) ? UPP : MID;
+				r1->s[cur] = '-';
+				r2->s[cur++] = g->t[--c];
+				break;
+			case LOW2:
+				state = (b & GR_L2_MID) ? MID : LOW2;
+				r1->s[cur] = s1->s[--i];
+				r2->s[cur++] = '-';
+				break;
+			case UPP2:
+				state = (b & GR_U2_UPP) ? UPP2 : MID;
+				r1->s[cur] = '-';
+				r2->s[cur++] = g->t[--c];
+				break;
+			default:
+				die("graph_trace: bad state %d", state);
+		}
+	}
+	r1->l = r2->l = cur;
+	r1->s = strrev(r1->s);
+	r2->s = strrev(r2->s);
+}
+
+/*
+ * fit alignment of s1 against the exon graph of s2 (fit -g)
+ */
+double
+align_fit_graph(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_fit_graph: parameter error\n");
+	exon_graph_t g;
+	int state;
+	long c_end;
+	graph_build(s2, opt, &g);
+	// pointers, jump sources and the rows of graph_fill(), before any of them
+	const double need = (s1->l + 1.0) * (g.N + 1) + (s1->l + 1.0) * (g.n + 1) * sizeof(int)
+		+ (10.0 * (g.N + 1) + 2.0 * g.n) * sizeof(double);
+	if(need > plan_budget(opt)) plan_die_mem(s1->l, s2->l, need, opt);
+	STATS_BEGIN(STATS_ALLOC);
+	uint8_t *P = mycalloc((s1->l + 1) * (g.N + 1), uint8_t);
+	int *JP = mycalloc((s1->l + 1) * (g.n + 1), int);
+	STATS_BYTES((s1->l + 1) * (g.N + 1) + (s1->l + 1) * (g.n + 1) * sizeof(int));
+	STATS_END(STATS_ALLOC);
+	double score = graph_fill(s1, &g, opt, P, JP, &state, &c_end);
+	STATS_BEGIN(STATS_TRACE);
+	graph_trace(s1, s2, &g, P, JP, state, c_end, r1, r2);
+	STATS_END(STATS_TRACE);
+	free(P); free(JP);
+	graph_destroy(&g);
+	return score;
+}
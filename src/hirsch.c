@@ -0,0 +1,383 @@
+/*--------------------------------------------------------------------*/
+/* hirsch.c 		                                                  */
+/* Linear-space traceback (Hirschberg 1975, Myers-Miller 1988).       */
+/*                                                                    */
+/* The rectangle (i0,j0)-(i1,j1) is split at its middle row: a        */
+/* forward score pass from the top gives F_X(mid,j), the best score   */
+/* of reaching (mid,j) in state X = M/L/U, and a backward pass from   */
+/* the bottom gives B_X(mid,j), the best score of going on from there */
+/* to the end. The optimal path crosses the middle row at the (j, X)  */
+/* maximising F_X + B_X; the top half is then solved ending in X and  */
+/* the bottom half starting in X, until a half is small enough for a  */
+/* full fill with one pointer byte per cell. Splitting on the state   */
+/* as well as the column keeps affine gaps that cross the middle row  */
+/* from being charged a second gap open.                              */
+/*                                                                    */
+/* The recurrence and its boundaries are those of the kernel. Time is */
+/* about twice a score-only pass, memory 12 rows of doubles plus a    */
+/* fixed pointer block. The path is an optimal one, but ties between  */
+/* co-optimal paths may be broken differently from the full matrices, */
+/* which is why the planner only falls back to it when those do not   */
+/* fit in the memory budget.                                          */
+/*                                                                    */
+/* local and fit bound the rectangle with the two score-only passes   */
+/* of twopass.c; fit does not support -s or -p. overlap, which has a  */
+/* single state with a linear gap, runs as L/M/U with e = o and gaps   */
+/* allowed to follow each other directly.                             */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define HB_M                    0
+#define HB_L                    1
+#define HB_U                    2
+#define HB_ALL                  7       // end in any state
+#define HB_BASE                 (1 << 20)   // cells solved by a full fill
+
+typedef struct {
+	const char *a, *b;   // s1 and s2
+	double match, mismatch, gap, extension;
+	int adj;             // L and U may follow each other (overlap)
+	double *buf;         // 2 x 6 rows of n+1
+	uint8_t *P;          // pointers of the base case
+	size_t cap;          // cells of P
+	char *o1, *o2;       // the alignment, built back to front
+	size_t cur;
+} hb_t;
+
+static inline double
+max2(double a, double b){
+	return a > b ? a : b;
+}
+
+static inline double
+max3(double a, double b, double c){
+	return max2(max2(a, b), c);
+}
+
+/*
+ * forward pass over rows i0..i1, columns j0..j1, starting in S0 at
+ * (i0,j0); no gap opens out of the start unless open0. the last row
+ * is left in F[3] (indexed by j-j0).
+ */
+static AT_CLONES void
+hb_forward(hb_t *h, long i0, long i1, long j0, long j1, const double S0[3], bool open0, double *F[3]){
+	const double neg = -INFINITY, o = h->gap, e = h->extension;
+	const long W = j1 - j0;
+	double *pM = h->buf, *pL = pM + W + 1, *pU = pL + W + 1;
+	double *cM = pU + W + 1, *cL = cM + W + 1, *cU = cL + W + 1, *t;
+	long i, k;
+	cM[0] = S0[HB_M]; cL[0] = S0[HB_L]; cU[0] = S0[HB_U];
+	for(k = 1; k <= W; k++){
+		cM[k] = cL[k] = neg;
+		if(k == 1 && open0 == false) cU[k] = cU[0] + e;
+		else cU[k] = max3(cU[k-1] + e, cM[k-1] + o, h->adj ? cL[k-1] + o : neg);
+	}
+	for(i = i0 + 1; i <= i1; i++){
+		t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;
+		const char ai = h->a[i-1];
+		cM[0] = cU[0] = neg;
+		if(i == i0 + 1 && open0 == false) cL[0] = pL[0] + e;
+		else cL[0] = max3(pL[0] + e, pM[0] + o, h->adj ? pU[0] + o : neg);
+		for(k = 1; k <= W; k++){
+			const double s = ai == h->b[j0+k-1] ? h->match : h->mismatch;
+			cM[k] = max3(pL[k-1], pM[k-1], pU[k-1]) + s;
+			cL[k] = max3(pL[k] + e, pM[k] + o, h->adj ? pU[k] + o : neg);
+			cU[k] = max3(cU[k-1] + e, cM[k-1] + o, h->adj ? cL[k-1] + o : neg);
+		}
+	}
+	STATS_CELLS((i1 - i0) * W);
+	F[HB_M] = cM; F[HB_L] = cL; F[HB_U] = cU;
+}
+
+/*
+ * backward pass over rows i1..i0 (bottom up), ending at (i1,j1) in a
+ * state of mask; the first row is left in B[3].
+ */
+static AT_CLONES void
+hb_backward(hb_t *h, long i0, long i1, long j0, long j1, int mask, double *B[3]){
+	const double neg = -INFINITY, o = h->gap, e = h->extension;
+	const long W = j1 - j0;
+	double *pM = h->buf + 6 * (W + 1), *pL = pM + W + 1, *pU = pL + W + 1;
+	double *cM = pU + W + 1, *cL = cM + W + 1, *cU = cL + W + 1, *t;
+	long i, k;
+	cM[W] = (mask & (1 << HB_M)) ? 0 : neg;
+	cL[W] = (mask & (1 << HB_L)) ? 0 : neg;
+	cU[W] = (mask & (1 << HB_U)) ? 0 : neg;
+	for(k = W - 1; k >= 0; k--){
+		cM[k] = cU[k+1] + o;
+		cL[k] = h->adj ? cU[k+1] + o : neg;
+		cU[k] = cU[k+1] + e;
+	}
+	for(i = i1 - 1; i >= i0; i--){
+		t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;
+		const char ai = h->a[i];
+		cM[W] = pL[W] + o;
+		cL[W] = pL[W] + e;
+		cU[W] = h->adj ? pL[W] + o : neg;
+		for(k = W - 1; k >= 0; k--){
+			const double d = (ai == h->b[j0+k] ? h->match : h->mismatch) + pM[k+1];
+			cM[k] = max3(d, pL[k] + o, cU[k+1] + o);
+			cL[k] = max3(d, pL[k] + e, h->adj ? cU[k+1] + o : neg);
+			cU[k] = max3(d, cU[k+1] + e, h->adj ? pL[k] + o : neg);
+		}
+	}
+	STATS_CELLS((i1 - i0) * W);
+	B[HB_M] = cM; B[HB_L] = cL; B[HB_U] = cU;
+}
+
+static inline void
+hb_emit(hb_t *h, char c1, char c2){
+	h->o1[h->cur] = c1;
+	h->o2[h->cur++] = c2;
+}
+
+/*
+ * full fill of a small rectangle with one pointer byte per cell
+ * (bits 0-1 M, 2-3 L, 4-5 U: the state each comes from), then the
+ * trace back to the start. tie-breaking follows the kernel.
+ */
+static AT_CLONES double
+hb_base(hb_t *h, long i0, long i1, long j0, long j1, const double S0[3], bool open0, int mask){
+	const double neg = -INFINITY, o = h->gap, e = h->extension;
+	const long W = j1 - j0, R = i1 - i0;
+	double *pM = h->buf, *pL = pM + W + 1, *pU = pL + W + 1;
+	double *cM = pU + W + 1, *cL = cM + W + 1, *cU = cL + W + 1, *t, v;
+	uint8_t *P = h->P, b;
+	long i, k;
+	int x;
+	cM[0] = S0[HB_M]; cL[0] = S0[HB_L]; cU[0] = S0[HB_U];
+	P[0] = 0;
+	for(k = 1; k <= W; k++){
+		cM[k] = cL[k] = neg;
+		cU[k] = cM[k-1] + o; x = HB_M;
+		if(k == 1 && open0 == false) cU[k] = neg;
+		if((v = cU[k-1] + e) > cU[k]){ cU[k] = v; x = HB_U; }
+		if(h->adj && (k > 1 || open0 == true) && (v = cL[k-1] + o) > cU[k]){ cU[k] = v; x = HB_L; }
+		P[k] = x << 4;
+	}
+	for(i = 1; i <= R; i++){
+		t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;
+		const char ai = h->a[i0+i-1];
+		uint8_t *p = P + i * (W + 1);
+		const bool open = (i > 1 || open0 == true) ? true : false;
+		cM[0] = cU[0] = neg;
+		cL[0] = pL[0] + e; x = HB_L;
+		if(open == true && (v = pM[0] + o) > cL[0]){ cL[0] = v; x = HB_M; }
+		if(open == true && h->adj && (v = pU[0] + o) > cL[0]){ cL[0] = v; x = HB_U; }
+		p[0] = x << 2;
+		for(k = 1; k <= W; k++){
+			const double s = ai == h->b[j0+k-1] ? h->match : h->mismatch;
+			cM[k] = pL[k-1] + s; x = HB_L;
+			if((v = pM[k-1] + s) > cM[k]){ cM[k] = v; x = HB_M; }
+			if((v = pU[k-1] + s) > cM[k]){ cM[k] = v; x = HB_U; }
+			b = x;
+			cL[k] = pL[k] + e; x = HB_L;
+			if((v = pM[k] + o) > cL[k]){ cL[k] = v; x = HB_M; }
+			if(h->adj && (v = pU[k] + o) > cL[k]){ cL[k] = v; x = HB_U; }
+			b |= x << 2;
+			cU[k] = cM[k-1] + o; x = HB_M;
+			if((v = cU[k-1] + e) > cU[k]){ cU[k] = v; x = HB_U; }
+			if(h->adj && (v = cL[k-1] + o) > cU[k]){ cU[k] = v; x = HB_L; }
+			p[k] = b | x << 4;
+		}
+	}
+	STATS_CELLS(R * W);
+	/* end cell, in the kernel's global order */
+	double score = neg;
+	int state = -1;
+	if((mask & (1 << HB_L)) && (state < 0 || cL[W] > score)){ score = cL[W]; state = HB_L; }
+	if((mask & (1 << HB_M)) && (state < 0 || cM[W] > score)){ score = cM[W]; state = HB_M; }
+	if((mask & (1 << HB_U)) && (state < 0 || cU[W] > score)){ score = cU[W]; state = HB_U; }
+	i = R; k = W;
+	while(i > 0 || k > 0){
+		x = (P[i * (W + 1) + k] >> (2 * state)) & 3;
+		switch(state){
+			case HB_M: hb_emit(h, h->a[i0+i-1], h->b[j0+k-1]); i--; k--; break;
+			case HB_L: hb_emit(h, h->a[i0+i-1], '-'); i--; break;
+			default:   hb_emit(h, '-', h->b[j0+k-1]); k--; break;
+		}
+		state = x;
+	}
+	return score;
+}
+
+/*
+ * best path from (i0,j0) in S0 to (i1,j1) in a state of mask; its
+ * columns are appended back to front. returns its score.
+ */
+static double
+hb_solve(hb_t *h, long i0, long i1, long j0, long j1, const double S0[3], bool open0, int mask){
+	const long W = j1 - j0, mid = (i0 + i1) / 2;
+	if((size_t)(i1 - i0 + 1) * (W + 1) <= h->cap) return hb_base(h, i0, i1, j0, j1, S0, open0, mask);
+	double *F[3], *B[3], best = -INFINITY, v;
+	long k, kb = 0;
+	int x, xb = HB_M;
+	hb_forward(h, i0, mid, j0, j1, S0, open0, F);
+	hb_backward(h, mid, i1, j0, j1, mask, B);
+	for(k = 0; k <= W; k++)
+		for(x = HB_M; x <= HB_U; x++)
+			if((v = F[x][k] + B[x][k]) > best){ best = v; kb = k; xb = x; }
+	if(best == -INFINITY) die("hb_solve: no path through (%ld-%ld, %ld-%ld)", i0, i1, j0, j1);
+	double S1[3] = {-INFINITY, -INFINITY, -INFINITY};
+	S1[xb] = 0;
+	// the bottom half first, since the alignment is built back to front
+	hb_solve(h, mid, i1, j0 + kb, j1, S1, true, mask);
+	hb_solve(h, i0, mid, j0, j0 + kb, S0, open0, 1 << xb);
+	return best;
+}
+
+static void
+hb_init(hb_t *h, kstring_t *s1, kstring_t *s2, const opt_t *opt, int adj){
+	const size_t n = s2->l;
+	h->a = s1->s; h->b = s2->s;
+	h->match = opt->m; h->mismatch = opt->u;
+	h->gap = opt->o; h->extension = adj ? opt->o : opt->e;
+	h->adj = adj;
+	h->cap = HB_BASE > 2 * (n + 1) ? HB_BASE : 2 * (n + 1);
+	STATS_BEGIN(STATS_ALLOC);
+	h->buf = mycalloc(12 * (n + 1), double);
+	h->P = mycalloc(h->cap, uint8_t);
+	h->o1 = mycalloc(s1->l + s2->l + 1, char);
+	h->o2 = mycalloc(s1->l + s2->l + 1, char);
+	STATS_END(STATS_ALLOC);
+	h->cur = 0;
+}
+
+/*
+ * hand the alignment over to r1/r2, front to back
+ */
+static void
+hb_done(hb_t *h, kstring_t *r1, kstring_t *r2){
+	size_t k;
+	r1->s = realloc(r1->s, h->cur + 1);
+	r2->s = realloc(r2->s, h->cur + 1);
+	if(r1->s == NULL || r2->s == NULL) die("hb_done: fail to allocate %zu bytes", h->cur + 1);
+	for(k = 0; k < h->cur; k++){
+		r1->s[k] = h->o1[h->cur-1-k];
+		r2->s[k] = h->o2[h->cur-1-k];
+	}
+	r1->s[h->cur] = r2->s[h->cur] = '\0';
+	r1->l = r2->l = h->cur;
+	free(h->buf); free(h->P); free(h->o1); free(h->o2);
+}
+
+/*
+ * linear-space drop-in for align_gla()
+ */
+double
+align_gla_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_gla_hirsch: parameter error\n");
+	const double S0[3] = {0, opt->o, opt->o}; // M(0,0), L(0,0), U(0,0)
+	hb_t h;
+	hb_init(&h, s1, s2, opt, 0);
+	STATS_BEGIN(STATS_FILL);
+	double score = hb_solve(&h, 0, s1->l, 0, s2->l, S0, false, HB_ALL);
+	STATS_END(STATS_FILL);
+	hb_done(&h, r1, r2);
+	return score;
+}
+
+/*
+ * linear-space drop-in for align_local_affine()
+ */
+double
+align_local_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_local_hirsch: parameter error\n");
+	const double S0[3] = {0, -INFINITY, -INFINITY};
+	size_t di, dj;
+	int i, j;
+	double max_score = kern_score(s1, s2, opt, KMODE_LOCAL, &i, &j);
+	hb_t h;
+	hb_init(&h, s1, s2, opt, 0);
+	if(max_score > 0){
+		if(local_reverse(s1, s2, opt, i, j, max_score, &di, &dj) != 0) die("align_local_hirsch: no start for the best alignment");
+		STATS_BEGIN(STATS_FILL);
+		max_score = hb_solve(&h, i - di, i, j - dj, j, S0, true, 1 << HB_M);
+		STATS_END(STATS_FILL);
+	}
+	hb_done(&h, r1, r2);
+	return max_score;
+}
+
+/*
+ * linear-space drop-in for align_fit_affine_jump(), without -s and -p
+ */
+double
+align_fit_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_fit_hirsch: parameter error\n");
+	if(opt->s == true || opt->p == true) die("align_fit_hirsch: no jump state or two-piece gap");
+	const double S0[3] = {0, -INFINITY, 0}; // row 0 of fit
+	int j;
+	double max_score = kern_score(s1, s2, opt, KMODE_FIT, NULL, &j);
+	long j_start = fit_reverse(s1, s2, opt, NULL, j, max_score);
+	if(j_start < 0) die("align_fit_hirsch: no start for the best alignment");
+	hb_t h;
+	hb_init(&h, s1, s2, opt, 0);
+	STATS_BEGIN(STATS_FILL);
+	max_score = hb_solve(&h, 0, s1->l, j_start, j, S0, true, (1 << HB_M) | (1 << HB_L));
+	STATS_END(STATS_FILL);
+	hb_done(&h, r1, r2);
+	return max_score;
+}
+
+/*
+ * first row an overlap ending at (m, j_end) with max_score may start
+ * on: a reverse pass over the single overlap state. column 0 holds
+ * the starts, so no path runs along it, and row 0 can only be left
+ * diagonally.
+ */
+static long
+overlap_reverse(kstring_t *s1, kstring_t *s2, const opt_t *opt, size_t j_end, double max_score){
+	const double match = opt->m, mismatch = opt->u, gap = opt->o;
+	const size_t m = s1->l, n = j_end;
+	double *p = mycalloc(2 * (n + 1), double), *c = p + n + 1, *t;
+	size_t i, j;
+	long i_start = -1;
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) c[j] = gap * j;
+	for(i = 1; i <= m && c[n] < max_score; i++){
+		t = p; p = c; c = t;
+		c[0] = p[0] + gap;
+		for(j = 1; j <= n; j++){
+			const double s = s1->s[m-i] == s2->s[n-j] ? match : mismatch;
+			if(i == m) c[j] = j == n ? p[j-1] + s : -INFINITY;
+			else c[j] = max3(p[j-1] + s, j < n ? p[j] + gap : -INFINITY, c[j-1] + gap);
+		}
+	}
+	if(c[n] >= max_score) i_start = m - (i - 1);
+	STATS_END(STATS_FILL);
+	STATS_CELLS((i - 1) * n);
+	free(p < c ? p : c);
+	return i_start;
+}
+
+/*
+ * linear-space drop-in for align_overlap()
+ */
+double
+align_overlap_hirsch(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align_overlap_hirsch: parameter error\n");
+	const long m = s1->l;
+	double S0[3] = {0, -INFINITY, -INFINITY};
+	int j;
+	double max_score = kern_score(s1, s2, opt, KMODE_OVERLAP, NULL, &j);
+	hb_t h;
+	hb_init(&h, s1, s2, opt, 1);
+	if(m > 0 && j > 0){
+		long i_start = overlap_reverse(s1, s2, opt, j, max_score);
+		if(i_start < 0) die("align_overlap_hirsch: no start for the best alignment");
+		STATS_BEGIN(STATS_FILL);
+		if(i_start > 0){
+			max_score = hb_solve(&h, i_start, m, 0, j, S0, true, HB_ALL);
+		}else{
+			// (0,0) is only left diagonally; start on (1,1) with that pair
+			S0[HB_M] = s1->s[0] == s2->s[0] ? opt->m : opt->u;
+			max_score = hb_solve(&h, 1, m, 1, j, S0, true, HB_ALL);
+			hb_emit(&h, s1->s[0], s2->s[0]);
+		}
+		STATS_END(STATS_FILL);
+	}
+	hb_done(&h, r1, r2);
+	return max_score;
+}
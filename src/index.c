@@ -0,0 +1,463 @@
+/*--------------------------------------------------------------------*/
+/* index.c 		                                                      */
+/* Build, map and query the persistent target index (see index.h).    */
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "alignment.h"
+#include "index.h"
+
+#define IDX_MAX_OCC             1000 // ignore minimizers more frequent than this
+
+static const unsigned char seq_nt4_table[256] = {
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 0, 4, 1,  4, 4, 4, 2,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  3, 3, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 0, 4, 1,  4, 4, 4, 2,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  3, 3, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
+	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4
+};
+
+/* invertible integer hash, so that minimizers are not biased to poly-A */
+static inline uint64_t
+hash64(uint64_t key, uint64_t mask){
+	key = (~key + (key << 21)) & mask;
+	key = key ^ key >> 24;
+	key = ((key + (key << 3)) + (key << 8)) & mask;
+	key = key ^ key >> 14;
+	key = ((key + (key << 2)) + (key << 4)) & mask;
+	key = key ^ key >> 28;
+	key = (key + (key << 31)) & mask;
+	return key;
+}
+
+/*
+ * append the (w,k)-minimizers of s to *a; consecutive windows sharing
+ * the same minimizer contribute it once.
+ */
+static void
+mini_sketch(const char *s, size_t l, int k, int w, uint32_t tid, idx_mini_t **a, size_t *n, size_t *m){
+	if(l < (size_t)k) return;
+	uint64_t mask = (1ULL<<(2*k)) - 1, kmer = 0;
+	size_t i, p, nk = l - k + 1, last = (size_t)-1;
+	int span = 0;
+	uint64_t *h = mycalloc(nk, uint64_t);
+	for(i = 0; i < l; i++){
+		int c = seq_nt4_table[(unsigned char)s[i]];
+		if(c < 4){ kmer = (kmer << 2 | c) & mask; span++; }
+		else{ kmer = 0; span = 0; }
+		if(i + 1 >= (size_t)k) h[i+1-k] = span >= k ? hash64(kmer, mask) : UINT64_MAX;
+	}
+	for(p = 0; p + w <= nk || (p == 0 && nk < (size_t)w); p++){
+		size_t j, end = p + w < nk ? p + w : nk, best = p;
+		for(j = p + 1; j < end; j++) if(h[j] < h[best]) best = j;
+		if(h[best] == UINT64_MAX || best == last) continue;
+		if(*n == *m){
+			*m = *m ? *m << 1 : 256;
+			*a = realloc(*a, *m * sizeof(idx_mini_t));
+			if(*a == NULL) die("mini_sketch: out of memory");
+		}
+		(*a)[*n].h = h[best];
+		(*a)[*n].tid = tid;
+		(*a)[(*n)++].pos = best + k - 1;
+		last = best;
+	}
+	free(h);
+}
+
+static int
+mini_cmp(const void *a, const void *b){
+	const idx_mini_t *x = a, *y = b;
+	if(x->h != y->h) return x->h < y->h ? -1 : 1;
+	if(x->tid != y->tid) return x->tid < y->tid ? -1 : 1;
+	return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static void
+write_section(FILE *fp, const void *p, size_t size, uint64_t *off){
+	static const char pad[8] = {0};
+	long cur = ftell(fp);
+	if(cur % 8) fwrite(pad, 1, 8 - cur % 8, fp);
+	*off = ftell(fp);
+	if(size && fwrite(p, 1, size, fp) != size) die("fail to write index");
+}
+
+/*
+ * build the index of all sequences in fn and write it to out
+ */
+int
+idx_build(const char *fn, const char *out, int k, int w){
+	if(fn == NULL || out == NULL) die("idx_build: parameter error");
+	if(k < 1 || k > 28 || w < 1) die("idx_build: invalid -k/-w");
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	kseq_t *seq = kseq_init(fp);
+	idx_header_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = IDX_MAGIC; hdr.version = IDX_VERSION;
+	hdr.k = k; hdr.w = w;
+
+	idx_target_t *tgt = NULL; size_t n_tgt = 0, m_tgt = 0;
+	kstring_t names = {0, 0, 0};
+	uint8_t *packed = NULL; size_t n_bases = 0, m_packed = 0;
+	int32_t *junc = NULL; size_t n_junc = 0, m_junc = 0;
+	idx_amb_t *amb = NULL; size_t n_amb = 0, m_amb = 0;
+	idx_mini_t *mini = NULL; size_t n_mini = 0, m_mini = 0;
+	size_t i;
+
+	while(kseq_read(seq) >= 0){
+		if(n_tgt == m_tgt){
+			m_tgt = m_tgt ? m_tgt << 1 : 16;
+			tgt = realloc(tgt, m_tgt * sizeof(idx_target_t));
+		}
+		idx_target_t *t = &tgt[n_tgt];
+		memset(t, 0, sizeof(*t));
+		t->name_off = names.l;
+		kputsn(seq->name.s, seq->name.l, &names);
+		names.l++; // keep the '\0'
+		t->seq_off = n_bases;
+		t->len = seq->seq.l;
+		// 2-bit pack; anything but ACGT becomes an N run
+		if((n_bases + seq->seq.l + 3) / 4 > m_packed){
+			m_packed = (n_bases + seq->seq.l + 3) / 4 * 2;
+			packed = realloc(packed, m_packed);
+		}
+		t->amb_off = n_amb;
+		for(i = 0; i < seq->seq.l; i++){
+			int c = seq_nt4_table[(unsigned char)seq->seq.s[i]];
+			size_t b = n_bases + i;
+			if((b & 3) == 0) packed[b >> 2] = 0;
+			if(c > 3){
+				if(t->n_amb && amb[n_amb-1].pos + amb[n_amb-1].len == i) amb[n_amb-1].len++;
+				else{
+					if(n_amb == m_amb){
+						m_amb = m_amb ? m_amb << 1 : 16;
+						amb = realloc(amb, m_amb * sizeof(idx_amb_t));
+					}
+					amb[n_amb].pos = i; amb[n_amb++].len = 1;
+					t->n_amb++;
+				}
+				c = 0;
+			}
+			packed[b >> 2] |= c << ((b & 3) << 1);
+		}
+		n_bases += seq->seq.l;
+		// junction sites, same convention as kstring_read()
+		t->junc_off = n_junc;
+		if(seq->comment.l && seq->comment.s[0] >= '0' && seq->comment.s[0] <= '9'){
+			junction_t sites;
+			junction_parse(seq->comment.s, &sites);
+			if(n_junc + sites.size > m_junc){
+				m_junc = (n_junc + sites.size) * 2;
+				junc = realloc(junc, m_junc * sizeof(int32_t));
+			}
+			for(i = 0; i < sites.size; i++) junc[n_junc++] = sites.pos[i];
+			t->n_junc = sites.size;
+			free(sites.pos);
+		}
+		mini_sketch(seq->seq.s, seq->seq.l, k, w, n_tgt, &mini, &n_mini, &m_mini);
+		n_tgt++;
+	}
+	kseq_destroy(seq);
+	gzclose(fp);
+	if(n_tgt == 0) die("no sequence found in %s", fn);
+	qsort(mini, n_mini, sizeof(idx_mini_t), mini_cmp);
+
+	hdr.n_targets = n_tgt; hdr.n_junc = n_junc; hdr.n_amb = n_amb; hdr.n_mini = n_mini;
+	FILE *fo = fopen(out, "wb");
+	if(fo == NULL) die("Can't open %s for writing", out);
+	fwrite(&hdr, sizeof(hdr), 1, fo);
+	write_section(fo, tgt, n_tgt * sizeof(idx_target_t), &hdr.off_tgt);
+	write_section(fo, names.s, names.l, &hdr.off_name);
+	write_section(fo, packed, (n_bases + 3) / 4, &hdr.off_seq);
+	write_section(fo, junc, n_junc * sizeof(int32_t), &hdr.off_junc);
+	write_section(fo, amb, n_amb * sizeof(idx_amb_t), &hdr.off_amb);
+	write_section(fo, mini, n_mini * sizeof(idx_mini_t), &hdr.off_mini);
+	hdr.file_size = ftell(fo);
+	// rewrite the header now that the offsets are known
+	fseek(fo, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, fo);
+	if(fclose(fo) != 0) die("fail to write %s", out);
+
+	fprintf(stderr, "[%s] %lu targets, %lu bases, %lu junctions, %lu minimizers\n", __func__,
+		(unsigned long)n_tgt, (unsigned long)n_bases, (unsigned long)n_junc, (unsigned long)n_mini);
+	free(tgt); free(names.s); free(packed); free(junc); free(amb); free(mini);
+	return 0;
+}
+
+/*
+ * section [off, end) holds n records of size bytes and starts on an
+ * 8-byte boundary; written so that no sum can wrap
+ */
+static int
+idx_section_ok(uint64_t off, uint64_t end, uint64_t n, uint64_t size){
+	return off % 8 == 0 && off <= end && n <= (end - off) / size;
+}
+
+/*
+ * every section in bounds, or die
+ */
+static void
+idx_check_header(const idx_header_t *h, uint64_t size, const char *fn){
+	if(h->k < 1 || h->k > 28 || h->w < 1) die("%s is corrupted", fn);
+	// the sections follow each other in this order, each ending where the next starts
+	if(h->off_tgt < sizeof(idx_header_t)
+			|| !idx_section_ok(h->off_tgt, h->off_name, h->n_targets, sizeof(idx_target_t))
+			|| !idx_section_ok(h->off_name, h->off_seq, 0, 1)
+			|| !idx_section_ok(h->off_seq, h->off_junc, 0, 1)
+			|| !idx_section_ok(h->off_junc, h->off_amb, h->n_junc, sizeof(int32_t))
+			|| !idx_section_ok(h->off_amb, h->off_mini, h->n_amb, sizeof(idx_amb_t))
+			|| !idx_section_ok(h->off_mini, size, h->n_mini, sizeof(idx_mini_t)))
+		die("%s is corrupted", fn);
+}
+
+/*
+ * every target record in bounds, or die
+ */
+static void
+idx_check_targets(const idx_t *idx, const char *fn){
+	const idx_header_t *h = idx->hdr;
+	uint64_t i;
+	const uint64_t l_names = h->off_seq - h->off_name, n_bases = (h->off_junc - h->off_seq) * 4;
+	for(i = 0; i < h->n_targets; i++){
+		const idx_target_t *t = &idx->tgt[i];
+		if(t->name_off >= l_names || memchr(idx->names + t->name_off, '\0', l_names - t->name_off) == NULL
+				|| t->len > n_bases || t->seq_off > n_bases - t->len
+				|| t->junc_off > h->n_junc || t->n_junc > h->n_junc - t->junc_off
+				|| t->amb_off > h->n_amb || t->n_amb > h->n_amb - t->amb_off)
+			die("%s is corrupted", fn);
+	}
+}
+
+/*
+ * map an index written by idx_build()
+ */
+idx_t
+*idx_load(const char *fn){
+	if(fn == NULL) die("idx_load: parameter error");
+	int fd = open(fn, O_RDONLY);
+	if(fd < 0) die("Can't open %s\n", fn);
+	struct stat st;
+	if(fstat(fd, &st) != 0) die("Can't stat %s\n", fn);
+	if((size_t)st.st_size < sizeof(idx_header_t)) die("%s is not an alignTools index", fn);
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) die("fail to mmap %s", fn);
+	idx_t *idx = mycalloc(1, idx_t);
+	idx->base = base;
+	idx->size = st.st_size;
+	idx->hdr = base;
+	if(idx->hdr->magic != IDX_MAGIC) die("%s is not an alignTools index", fn);
+	if(idx->hdr->version != IDX_VERSION)
+		die("%s has index version %u, expected %u; rebuild it with `alignTools index`", fn, idx->hdr->version, IDX_VERSION);
+	if(idx->hdr->file_size != idx->size) die("%s is truncated", fn);
+	idx_check_header(idx->hdr, idx->size, fn);
+	idx->tgt   = (const idx_target_t*)((const char*)base + idx->hdr->off_tgt);
+	idx->names = (const char*)base + idx->hdr->off_name;
+	idx->seq   = (const uint8_t*)base + idx->hdr->off_seq;
+	idx->junc  = (const int32_t*)((const char*)base + idx->hdr->off_junc);
+	idx->amb   = (const idx_amb_t*)((const char*)base + idx->hdr->off_amb);
+	idx->mini  = (const idx_mini_t*)((const char*)base + idx->hdr->off_mini);
+	idx_check_targets(idx, fn);
+	return idx;
+}
+
+void
+idx_destroy(idx_t *idx){
+	if(idx == NULL) return;
+	munmap(idx->base, idx->size);
+	free(idx);
+}
+
+const char
+*idx_name(const idx_t *idx, int tid){
+	return idx->names + idx->tgt[tid].name_off;
+}
+
+/*
+ * unpack target tid into ks
+ */
+void
+idx_get_seq(const idx_t *idx, int tid, kstring_t *ks){
+	if(idx == NULL || ks == NULL || tid < 0 || (uint64_t)tid >= idx->hdr->n_targets) die("idx_get_seq: parameter error");
+	const idx_target_t *t = &idx->tgt[tid];
+	uint64_t i, j;
+	if(ks_resize(ks, t->len + 1) < 0) die("idx_get_seq: out of memory");
+	for(i = 0; i < t->len; i++){
+		uint64_t b = t->seq_off + i;
+		ks->s[i] = "ACGT"[idx->seq[b >> 2] >> ((b & 3) << 1) & 3];
+	}
+	for(i = 0; i < t->n_amb; i++){
+		const idx_amb_t *a = &idx->amb[t->amb_off + i];
+		if(a->pos > t->len || a->len > t->len - a->pos) die("the index of %s is corrupted", idx_name(idx, tid));
+		for(j = 0; j < a->len; j++) ks->s[a->pos + j] = 'N';
+	}
+	ks->s[t->len] = '\0';
+	ks->l = t->len;
+}
+
+/*
+ * copy the junction sites of target tid
+ */
+void
+idx_get_junc(const idx_t *idx, int tid, int **pos, size_t *size){
+	const idx_target_t *t = &idx->tgt[tid];
+	uint32_t i;
+	*size = t->n_junc;
+	*pos = t->n_junc ? mycalloc(t->n_junc, int) : NULL;
+	for(i = 0; i < t->n_junc; i++) (*pos)[i] = idx->junc[t->junc_off + i];
+}
+
+/*
+ * pick the target sharing the most minimizers with s; -1 if none
+ */
+int
+idx_best_target(const idx_t *idx, const char *s, int l, int *n_hits){
+	idx_mini_t *a = NULL; size_t n = 0, m = 0, i;
+	int best = -1, *votes = mycalloc(idx->hdr->n_targets, int);
+	mini_sketch(s, l, idx->hdr->k, idx->hdr->w, 0, &a, &n, &m);
+	for(i = 0; i < n; i++){
+		size_t lo = 0, hi = idx->hdr->n_mini, j;
+		while(lo < hi){ // lower bound
+			size_t mid = lo + (hi - lo) / 2;
+			if(idx->mini[mid].h < a[i].h) lo = mid + 1; else hi = mid;
+		}
+		for(j = lo; j < idx->hdr->n_mini && idx->mini[j].h == a[i].h; j++);
+		if(j - lo > IDX_MAX_OCC) continue;
+		uint32_t last = UINT32_MAX;
+		for(; lo < j; lo++){
+			if(idx->mini[lo].tid == last) continue; // one vote per target
+			last = idx->mini[lo].tid;
+			if(last >= idx->hdr->n_targets) die("the index is corrupted: minimizer of target %u", last);
+			votes[last]++;
+			if(best < 0 || votes[last] > votes[best]) best = last;
+		}
+	}
+	if(n_hits) *n_hits = best < 0 ? 0 : votes[best];
+	free(a);
+	free(votes);
+	return best;
+}
+
+/*
+ * align every read of fn against its best target from the index
+ */
+int
+idx_align_reads(const char *idx_fn, const char *fn, opt_t *opt, align_f align, int mode, bool need_shorter){
+	STATS_BEGIN(STATS_PARSE);
+	idx_t *idx = idx_load(idx_fn);
+	STATS_END(STATS_PARSE);
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	kseq_t *seq = kseq_init(fp);
+	kstring_t *ks1 = mycalloc(1, kstring_t);
+	kstring_t *ks2 = mycalloc(1, kstring_t);
+	kstring_t *r1 = mycalloc(1, kstring_t);
+	kstring_t *r2 = mycalloc(1, kstring_t);
+	kstring_t rc = {0, 0, 0};
+	int tid, cur = -1, n_hits, rc_tid = -1, rc_hits = 0;
+	char strand;
+	while(kseq_read(seq) >= 0){
+		tid = idx_best_target(idx, seq->seq.s, seq->seq.l, &n_hits);
+		if(opt->b == true){ // minimizers are not canonical, look the reverse strand up as well
+			ks1->l = 0;
+			kputsn(seq->seq.s, seq->seq.l, ks1);
+			revcomp(ks1, &rc);
+			rc_tid = idx_best_target(idx, rc.s, rc.l, &rc_hits);
+		}
+		strand = '+';
+		if(rc_tid >= 0 && rc_tid != tid && rc_hits > n_hits){
+			tid = rc_tid; n_hits = rc_hits;
+			strand = '-';
+		}
+		if(tid < 0){
+			fprintf(stderr, "[%s] %s: no target shares a minimizer, skipped\n", __func__, seq->name.s);
+			continue;
+		}
+		if(tid != cur){ // consecutive reads usually hit the same gene
+			STATS_BEGIN(STATS_PARSE);
+			idx_get_seq(idx, tid, ks2);
+			if(opt->sites.pos) free(opt->sites.pos);
+			idx_get_junc(idx, tid, &opt->sites.pos, &opt->sites.size);
+			cur = tid;
+			STATS_END(STATS_PARSE);
+		}
+		if(need_shorter == true && seq->seq.l > ks2->l){
+			fprintf(stderr, "[%s] %s: longer than target %s, skipped\n", __func__, seq->name.s, idx_name(idx, tid));
+			continue;
+		}
+		ks1->l = 0;
+		if(strand == '-') kputsn(rc.s, rc.l, ks1);
+		else kputsn(seq->seq.s, seq->seq.l, ks1);
+		r1->s = realloc(r1->s, ks1->l + ks2->l + 1);
+		r2->s = realloc(r2->s, ks1->l + ks2->l + 1);
+		memset(r1->s, 0, ks1->l + ks2->l + 1);
+		memset(r2->s, 0, ks1->l + ks2->l + 1);
+		double score;
+		if(opt->b == true && strand == '+' && rc_tid == tid) score = align_both_strands(align, mode, ks1, ks2, r1, r2, opt, &strand);
+		else score = align(ks1, ks2, r1, r2, opt);
+		if(score < opt->min_score) continue;
+		STATS_BEGIN(STATS_OUTPUT);
+		if(opt->b == true) printf(">%s\t%s\t%d\t%c\n", seq->name.s, idx_name(idx, tid), n_hits, strand);
+		else printf(">%s\t%s\t%d\n", seq->name.s, idx_name(idx, tid), n_hits);
+		printf("score=%f\n", score);
+		printf("%s\n%s\n", r1->s, r2->s);
+		STATS_END(STATS_OUTPUT);
+	}
+	if(opt->sites.pos) free(opt->sites.pos);
+	opt->sites.pos = NULL; opt->sites.size = 0;
+	kstring_destory(ks1);
+	kstring_destory(ks2);
+	kstring_destory(r1);
+	kstring_destory(r2);
+	free(rc.s);
+	kseq_destroy(seq);
+	gzclose(fp);
+	idx_destroy(idx);
+	return 0;
+}
+
+/* main function for building an index. */
+int
+main_index(int argc, char *argv[]){
+	int c, k = IDX_DEFAULT_K, w = IDX_DEFAULT_W;
+	char *out = NULL;
+	while ((c = getopt(argc, argv, "k:w:o:")) >= 0) {
+			switch (c) {
+			case 'k': k = atoi(optarg); break;
+			case 'w': w = atoi(optarg); break;
+			case 'o': out = optarg; break;
+			default: return 1;
+		}
+	}
+	if (optind + 1 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools index [options] <targets.fa>\n\n");
+				fprintf(stderr, "Options: -k INT   minimizer k-mer size [%d]\n", k);
+				fprintf(stderr, "         -w INT   minimizer window size [%d]\n", w);
+				fprintf(stderr, "         -o FILE  output index [<targets.fa>.idx]\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	kstring_t fn = {0, 0, 0};
+	if(out == NULL) ksprintf(&fn, "%s.idx", argv[optind]);
+	else kputs(out, &fn);
+	idx_build(argv[optind], fn.s, k, w);
+	free(fn.s);
+	return 0;
+}
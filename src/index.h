@@ -0,0 +1,92 @@
+/*--------------------------------------------------------------------*/
+/* index.h 		                                                      */
+/* Persistent on-disk target index.                                   */
+/*                                                                    */
+/* The file is written once by `alignTools index` and mapped read-    */
+/* only by later runs, so loading costs one mmap() regardless of the  */
+/* panel size. All integers are stored in native byte order; an index */
+/* is only valid on the architecture it was built on.                 */
+/*                                                                    */
+/* layout (every section starts on an 8-byte boundary):               */
+/* idx_header_t                                                       */
+/* idx_target_t[n_targets]     per-target record                      */
+/* char names[]                '\0' terminated target names           */
+/* uint8_t seq[]               2-bit packed bases, 4 per byte         */
+/* int32_t junc[]              junction sites from fasta comments     */
+/* idx_amb_t amb[]             runs of ambiguous bases (stored as N)  */
+/* idx_mini_t mini[n_mini]     minimizers sorted by hash              */
+/*--------------------------------------------------------------------*/
+#ifndef _INDEX_
+#define _INDEX_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kstring.h"
+
+#define IDX_MAGIC               0x58495441 /* "ATIX" */
+#define IDX_VERSION             1
+#define IDX_DEFAULT_K           15
+#define IDX_DEFAULT_W           10
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t k;          // minimizer k-mer size
+	uint32_t w;          // minimizer window
+	uint64_t n_targets;
+	uint64_t n_junc;
+	uint64_t n_amb;
+	uint64_t n_mini;
+	uint64_t file_size;
+	uint64_t off_tgt;    // file offsets of each section
+	uint64_t off_name;
+	uint64_t off_seq;
+	uint64_t off_junc;
+	uint64_t off_amb;
+	uint64_t off_mini;
+} idx_header_t;
+
+typedef struct {
+	uint64_t name_off;   // into names[]
+	uint64_t seq_off;    // in bases, into seq[]
+	uint64_t len;
+	uint64_t junc_off;   // into junc[]
+	uint64_t amb_off;    // into amb[]
+	uint32_t n_junc;
+	uint32_t n_amb;
+} idx_target_t;
+
+typedef struct {
+	uint64_t pos;
+	uint64_t len;
+} idx_amb_t;
+
+typedef struct {
+	uint64_t h;          // hashed k-mer
+	uint32_t tid;
+	uint32_t pos;        // last base of the k-mer
+} idx_mini_t;
+
+// a mapped index; every pointer points into the mapping
+typedef struct {
+	void   *base;
+	size_t  size;
+	const idx_header_t *hdr;
+	const idx_target_t *tgt;
+	const char         *names;
+	const uint8_t      *seq;
+	const int32_t      *junc;
+	const idx_amb_t    *amb;
+	const idx_mini_t   *mini;
+} idx_t;
+
+int idx_build(const char *fn, const char *out, int k, int w);
+idx_t *idx_load(const char *fn);
+void idx_destroy(idx_t *idx);
+const char *idx_name(const idx_t *idx, int tid);
+void idx_get_seq(const idx_t *idx, int tid, kstring_t *ks);
+void idx_get_junc(const idx_t *idx, int tid, int **pos, size_t *size);
+int idx_best_target(const idx_t *idx, const char *s, int l, int *n_hits);
+int main_index(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,38 @@
+/*--------------------------------------------------------------------*/
+/* isa.h 		                                                      */
+/* Per-ISA code paths for `make release`.                             */
+/*                                                                    */
+/* A normal build compiles every SIMD kernel for the widest vectors   */
+/* the compiler targets (-mavx2, -march=native, ...). With            */
+/* -DAT_MULTIVERSION (gcc or clang, x86-64) the intrinsics kernels    */
+/* are compiled for SSE2, AVX2 and AVX-512BW alike (AT_TARGET) and    */
+/* picked once at run time with ISA_HAS(), and the scalar DP loops    */
+/* are cloned for SSE4.2, AVX2 and AVX-512 (AT_CLONES) behind an      */
+/* ifunc, so one binary takes the fastest path on every node.         */
+/*--------------------------------------------------------------------*/
+#ifndef _ISA_
+#define _ISA_
+
+#if defined(AT_MULTIVERSION) && defined(__GNUC__) && defined(__x86_64__)
+#define AT_DISPATCH
+#define AT_CLONES               __attribute__((target_clones("default", "sse4.2", "avx2", "avx512f")))
+#define AT_TARGET(isa)          __attribute__((target(isa)))
+#define ISA_HAS(isa)            __builtin_cpu_supports(isa)
+#else
+#define AT_CLONES
+#define AT_TARGET(isa)
+#define ISA_HAS(isa)            1       // only compiled in when the compiler targets it
+#endif
+
+/* kernels compiled in, whether or not this cpu runs them */
+#if defined(__AVX2__) || defined(AT_DISPATCH)
+#define AT_HAVE_AVX2
+#endif
+#if defined(__AVX512BW__) || defined(AT_DISPATCH)
+#define AT_HAVE_AVX512BW
+#endif
+#if defined(__SSE2__) || defined(AT_HAVE_AVX2)
+#include <immintrin.h>
+#endif
+
+#endif
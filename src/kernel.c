@@ -0,0 +1,352 @@
+/*--------------------------------------------------------------------*/
+/* kernel.c 		                                                  */
+/* The L/M/U(/J/L2/U2) fill shared by the global, local, fit and      */
+/* overlap aligners.                                                  */
+/*                                                                    */
+/* KERN_FILL() writes one always-inline body per score type; mode,    */
+/* jump state, two-piece gap and traceback are plain int parameters.  */
+/* Every exported variant calls that body with literal constants, so  */
+/* the compiler folds the mode tests away and each variant ends up    */
+/* with its own branch-free inner loop. Boundaries, tie-breaking and  */
+/* pointer values are exactly those of the hand-written aligners      */
+/* they replace (see the comment blocks in alignment.h).              */
+/*                                                                    */
+/* traceback variants (tb = 1) fill the pointers of a matrix_t and    */
+/* only exist for double scores; score-only variants come in double   */
+/* and int. Scores are never kept whole: score-only fills keep two    */
+/* rows per state, traceback fills go down strips of KERN_TILE        */
+/* columns, so that the two rows of a strip (12 x 2049 doubles) stay  */
+/* in L2 and only the pointers stream out to memory. A strip starts   */
+/* from the last column of the strip before, carried for every row.   */
+/* Local ties go to the first maximum in row-major order either way.  */
+/*                                                                    */
+/* kern_score_min() stops the fill once min_score is out of reach     */
+/* (--min-score, prune.c): every state of row i is at most            */
+/*   B(i) = max(max_j M(i,j), B(i-1) + max(o, e[, O, E]))             */
+/* as U and J only come from M of the same row and L from row i-1,    */
+/* and each of the m-i rows left adds at most a match to it.          */
+/*--------------------------------------------------------------------*/
+#include "alignment.h"
+
+#define KERN_INLINE             static inline __attribute__((always_inline))
+#define KERN_TILE               2048    // columns per strip of a traceback fill
+
+/*
+ * the pointers of row i from column j on, about to be written; the
+ * hardware prefetcher follows each row but not the jump between rows
+ */
+KERN_INLINE void
+kern_prefetch(const matrix_t *S, long i, long j, int overlap, int jump, int two){
+	__builtin_prefetch(&S->pointerM[i][j], 1);
+	if(overlap) return;
+	__builtin_prefetch(&S->pointerL[i][j], 1);
+	__builtin_prefetch(&S->pointerU[i][j], 1);
+	if(jump) __builtin_prefetch(&S->pointerJ[i][j], 1);
+	if(two){
+		__builtin_prefetch(&S->pointerL2[i][j], 1);
+		__builtin_prefetch(&S->pointerU2[i][j], 1);
+	}
+}
+
+/*
+ * site[p] != 0 iff a jump may start at s2[p]
+ */
+char
+*site_mask(const opt_t *opt, size_t n){
+	char *site = mycalloc(n + 1, char);
+	size_t k;
+	for(k = 0; k < opt->sites.size; k++)
+		if(opt->sites.pos[k] >= 0 && (size_t)opt->sites.pos[k] < n) site[opt->sites.pos[k]] = 1;
+	return site;
+}
+
+#define KERN_FILL(T, SFX, NEG)                                                                  \
+KERN_INLINE T                                                                                   \
+kern_fill_##SFX(kstring_t *s1, kstring_t *s2, const opt_t *opt, matrix_t *S, const char *site,  \
+		const int mode, const int jump, const int two, const int tb, const double min_score,    \
+		int *state, int *i_end, int *j_end){                                                    \
+	const T match = opt->m, mismatch = opt->u, gap = opt->o, extension = opt->e;                \
+	const T jump_penality = opt->j, gap2 = opt->o2, extension2 = opt->e2, neg = NEG;            \
+	const long m = s1->l, n = s2->l;                                                            \
+	const int fit = mode == KMODE_FIT, global = mode == KMODE_GLOBAL;                           \
+	const int local = mode == KMODE_LOCAL, overlap = mode == KMODE_OVERLAP;                     \
+	const int jp = fit && jump, lg = fit && two, prune = min_score > -INFINITY;                 \
+	/* tb fills strips of KERN_TILE columns, score-only one strip of n */                       \
+	const long tile = tb ? KERN_TILE : (n > 0 ? n : 1);                                         \
+	T drop = gap > extension ? gap : extension, bound = 0, r;                                   \
+	T *buf, *t;                                                                                 \
+	T *pM, *pL, *pU, *pJ, *pL2, *pU2, *cM, *cL, *cU, *cJ, *cL2, *cU2;                           \
+	T *bM = NULL, *bL = NULL, *bU = NULL, *bJ = NULL, *bL2 = NULL, *bU2 = NULL;                 \
+	T *lM, *lL, *lU, *lL2;                                                                      \
+	T max_score = neg, v;                                                                       \
+	int i_max = 0, j_max = 0, max_state = MID, idx, pruned = 0;                                 \
+	long i, j, k, jb, je;                                                                       \
+	if(lg && gap2 > drop) drop = gap2;                                                          \
+	if(lg && extension2 > drop) drop = extension2;                                              \
+	STATS_BEGIN(STATS_FILL);                                                                    \
+	/* two rows of a strip per state; with tb also its left edge, the */                        \
+	/* column carried over from the strip before, and the last row    */                        \
+	buf = mycalloc(12 * (tile + 1) + (tb ? 6 * (m + 1) + 4 * (n + 1) : 0), T);                  \
+	cM = buf;               cL = cM + (tile + 1);  cU = cL + (tile + 1);                        \
+	cJ = cU + (tile + 1);   cL2 = cJ + (tile + 1); cU2 = cL2 + (tile + 1);                      \
+	pM = cU2 + (tile + 1);  pL = pM + (tile + 1);  pU = pL + (tile + 1);                        \
+	pJ = pU + (tile + 1);   pL2 = pJ + (tile + 1); pU2 = pL2 + (tile + 1);                      \
+	lM = cM; lL = cL; lU = cU; lL2 = cL2;                                                       \
+	if(tb){                                                                                     \
+		bM = pU2 + (tile + 1);  bL = bM + (m + 1);    bU = bL + (m + 1);                        \
+		bJ = bU + (m + 1);      bL2 = bJ + (m + 1);   bU2 = bL2 + (m + 1);                      \
+		lM = bU2 + (m + 1);     lL = lM + (n + 1);    lU = lL + (n + 1);  lL2 = lU + (n + 1);   \
+	}                                                                                           \
+	for(jb = 1; ; jb += tile){                                                                  \
+		je = jb + tile - 1 < n ? jb + tile - 1 : n;                                             \
+		/* first row, columns jb-1..je at 0..je-jb+1 */                                         \
+		for(j = jb - 1, k = 0; j <= je; j++, k++){                                              \
+			if(global){                                                                         \
+				cM[k] = j == 0 ? 0 : neg;                                                       \
+				cL[k] = j == 0 ? gap : neg;                                                     \
+				cU[k] = gap + extension * j;                                                    \
+			}else if(local){                                                                    \
+				cM[k] = cL[k] = cU[k] = 0;                                                      \
+			}else if(fit){                                                                      \
+				cM[k] = cU[k] = 0;                                                              \
+				cL[k] = cJ[k] = neg;                                                            \
+				if(lg) cL2[k] = cU2[k] = neg;                                                   \
+			}else{                                                                              \
+				cM[k] = j == 0 ? 0 : neg;                                                       \
+			}                                                                                   \
+		}                                                                                       \
+		for(i = 1; i <= m; i++){                                                                \
+			t = pM; pM = cM; cM = t;   t = pL; pL = cL; cL = t;   t = pU; pU = cU; cU = t;      \
+			t = pJ; pJ = cJ; cJ = t;   t = pL2; pL2 = cL2; cL2 = t; t = pU2; pU2 = cU2; cU2 = t; \
+			if(tb && i < m) kern_prefetch(S, i + 1, jb, overlap, jp, lg);                       \
+			/* first column, or the last one of the strip before */                             \
+			if(jb > 1){                                                                         \
+				cM[0] = bM[i]; cL[0] = bL[i]; cU[0] = bU[i];                                    \
+				cJ[0] = bJ[i]; cL2[0] = bL2[i]; cU2[0] = bU2[i];                                \
+			}else if(global){                                                                   \
+				cL[0] = gap + extension * i;                                                    \
+				cM[0] = cU[0] = neg;                                                            \
+			}else if(local){                                                                    \
+				cM[0] = cL[0] = cU[0] = 0;                                                      \
+			}else if(fit){                                                                      \
+				cM[0] = cL[0] = cU[0] = cJ[0] = neg;                                            \
+				if(lg) cL2[0] = cU2[0] = neg;                                                   \
+			}else{                                                                              \
+				cM[0] = 0;                                                                      \
+			}                                                                                   \
+			for(j = jb, k = 1; j <= je; j++, k++){                                              \
+				const T s = (s1->s[i-1] == s2->s[j-1]) ? match : mismatch;                      \
+				if(overlap){                                                                    \
+					cM[k] = cM[k-1] + gap; idx = LEFT;                                          \
+					if((v = pM[k-1] + s) > cM[k]){ cM[k] = v; idx = DIAGONAL; }                 \
+					if((v = pM[k] + gap) > cM[k]){ cM[k] = v; idx = RIGHT; }                    \
+					if(tb) S->pointerM[i][j] = idx;                                             \
+					continue;                                                                   \
+				}                                                                               \
+				/* MID */                                                                       \
+				cM[k] = pL[k-1] + s; idx = LOW;                                                 \
+				if((v = pM[k-1] + s) > cM[k]){ cM[k] = v; idx = MID; }                          \
+				if((v = pU[k-1] + s) > cM[k]){ cM[k] = v; idx = UPP; }                          \
+				if(jp && (v = pJ[k-1] + s) > cM[k]){ cM[k] = v; idx = JUMP; }                   \
+				if(local && 0 > cM[k]){ cM[k] = 0; idx = HOME; }                                \
+				if(lg && (v = pL2[k-1] + s) > cM[k]){ cM[k] = v; idx = LOW2; }                  \
+				if(lg && (v = pU2[k-1] + s) > cM[k]){ cM[k] = v; idx = UPP2; }                  \
+				if(tb) S->pointerM[i][j] = idx;                                                 \
+				/* the first maximum in row-major order, whatever the strips */                 \
+				if(local && (cM[k] > max_score || (tb && cM[k] == max_score && i < i_max))){    \
+					max_score = cM[k]; i_max = i; j_max = j;                                    \
+				}                                                                               \
+				/* LOW */                                                                       \
+				cL[k] = pL[k] + extension; idx = LOW;                                           \
+				if((v = pM[k] + gap) > cL[k]){ cL[k] = v; idx = MID; }                          \
+				if(tb) S->pointerL[i][j] = idx;                                                 \
+				/* UPP */                                                                       \
+				cU[k] = cM[k-1] + gap; idx = MID;                                               \
+				if((v = cU[k-1] + extension) > cU[k]){ cU[k] = v; idx = UPP; }                  \
+				if(tb) S->pointerU[i][j] = idx;                                                 \
+				/* JUMP only opens at junction sites */                                         \
+				if(jp){                                                                         \
+					if(site[j-1]){                                                              \
+						cJ[k] = cM[k-1] + jump_penality; idx = MID;                             \
+						if(cJ[k-1] > cJ[k]){ cJ[k] = cJ[k-1]; idx = JUMP; }                     \
+					}else{                                                                      \
+						cJ[k] = cJ[k-1]; idx = JUMP;                                            \
+					}                                                                           \
+					if(tb) S->pointerJ[i][j] = idx;                                             \
+				}                                                                               \
+				/* LOW2 and UPP2 */                                                             \
+				if(lg){                                                                         \
+					cL2[k] = pL2[k] + extension2; idx = LOW2;                                   \
+					if((v = pM[k] + gap2) > cL2[k]){ cL2[k] = v; idx = MID; }                   \
+					if(tb) S->pointerL2[i][j] = idx;                                            \
+					cU2[k] = cM[k-1] + gap2; idx = MID;                                         \
+					if((v = cU2[k-1] + extension2) > cU2[k]){ cU2[k] = v; idx = UPP2; }         \
+					if(tb) S->pointerU2[i][j] = idx;                                            \
+				}                                                                               \
+			}                                                                                   \
+			if(tb){                                                                             \
+				k = je - jb + 1;                                                                \
+				bM[i] = cM[k]; bL[i] = cL[k]; bU[i] = cU[k];                                    \
+				bJ[i] = cJ[k]; bL2[i] = cL2[k]; bU2[i] = cU2[k];                                \
+			}                                                                                   \
+			/* score-only is one strip, so the row is complete here */                          \
+			if(prune){                                                                          \
+				for(j = 1, r = cM[0]; j <= n; j++) if(cM[j] > r) r = cM[j];                     \
+				bound = (overlap || bound + drop < r) ? r : bound + drop;                       \
+				if(bound + (double)match * (m - i) < min_score){ pruned = 1; break; }           \
+			}                                                                                   \
+		}                                                                                       \
+		if(tb){                                                                                 \
+			for(j = jb - 1, k = 0; j <= je; j++, k++){                                          \
+				lM[j] = cM[k]; lL[j] = cL[k]; lU[j] = cU[k]; lL2[j] = cL2[k];                   \
+			}                                                                                   \
+		}else{                                                                                  \
+			lM = cM; lL = cL; lU = cU; lL2 = cL2;                                               \
+		}                                                                                       \
+		if(je >= n) break;                                                                      \
+	}                                                                                           \
+	/* end cell, from row m in lM, lL, lU and lL2 */                                            \
+	if(pruned){                                                                                 \
+		max_score = neg;                                                                        \
+	}else if(global){                                                                           \
+		max_score = lL[n]; max_state = LOW;                                                     \
+		if(lM[n] > max_score){ max_score = lM[n]; max_state = MID; }                            \
+		if(lU[n] > max_score){ max_score = lU[n]; max_state = UPP; }                            \
+		i_max = m; j_max = n;                                                                   \
+	}else if(fit){                                                                              \
+		i_max = m;                                                                              \
+		for(j = 0; j <= n; j++) if(max_score < lM[j]){ max_score = lM[j]; j_max = j; max_state = MID; } \
+		for(j = 0; j <= n; j++) if(max_score < lL[j]){ max_score = lL[j]; j_max = j; max_state = LOW; } \
+		for(j = 0; lg && j <= n; j++) if(max_score < lL2[j]){ max_score = lL2[j]; j_max = j; max_state = LOW2; } \
+	}else if(overlap){                                                                          \
+		i_max = m;                                                                              \
+		for(j = 0; j < n; j++) if(max_score < lM[j]){ max_score = lM[j]; j_max = j; }           \
+	}                                                                                           \
+	STATS_END(STATS_FILL);                                                                      \
+	STATS_CELLS(m * n);                                                                         \
+	free(buf);                                                                                  \
+	if(state) *state = max_state;                                                               \
+	if(i_end) *i_end = i_max;                                                                   \
+	if(j_end) *j_end = j_max;                                                                   \
+	return max_score;                                                                           \
+}
+
+KERN_FILL(double, dbl, -INFINITY)
+KERN_FILL(int, int, INT_MIN / 2)
+
+/*
+ * one function per configuration; the argument lists only differ in
+ * their constants. AT_CLONES: one copy per ISA in release builds
+ */
+#define KERN_VARIANT(NAME, T, SFX, MODE, JUMP, TWO, TB)                                          \
+static AT_CLONES T                                                                              \
+NAME(kstring_t *s1, kstring_t *s2, const opt_t *opt, matrix_t *S, const char *site,              \
+		double min_score, int *state, int *i_end, int *j_end){                                  \
+	return kern_fill_##SFX(s1, s2, opt, S, site, MODE, JUMP, TWO, TB, min_score,                \
+			state, i_end, j_end);                                                               \
+}
+
+KERN_VARIANT(kern_global_tb,        double, dbl, KMODE_GLOBAL,  0, 0, 1)
+KERN_VARIANT(kern_local_tb,         double, dbl, KMODE_LOCAL,   0, 0, 1)
+KERN_VARIANT(kern_overlap_tb,       double, dbl, KMODE_OVERLAP, 0, 0, 1)
+KERN_VARIANT(kern_fit_tb,           double, dbl, KMODE_FIT,     0, 0, 1)
+KERN_VARIANT(kern_fit_jump_tb,      double, dbl, KMODE_FIT,     1, 0, 1)
+KERN_VARIANT(kern_fit_long_tb,      double, dbl, KMODE_FIT,     0, 1, 1)
+KERN_VARIANT(kern_fit_jump_long_tb, double, dbl, KMODE_FIT,     1, 1, 1)
+
+KERN_VARIANT(kern_global_dbl,        double, dbl, KMODE_GLOBAL,  0, 0, 0)
+KERN_VARIANT(kern_local_dbl,         double, dbl, KMODE_LOCAL,   0, 0, 0)
+KERN_VARIANT(kern_overlap_dbl,       double, dbl, KMODE_OVERLAP, 0, 0, 0)
+KERN_VARIANT(kern_fit_dbl,           double, dbl, KMODE_FIT,     0, 0, 0)
+KERN_VARIANT(kern_fit_jump_dbl,      double, dbl, KMODE_FIT,     1, 0, 0)
+KERN_VARIANT(kern_fit_long_dbl,      double, dbl, KMODE_FIT,     0, 1, 0)
+KERN_VARIANT(kern_fit_jump_long_dbl, double, dbl, KMODE_FIT,     1, 1, 0)
+
+KERN_VARIANT(kern_global_int,        int, int, KMODE_GLOBAL,  0, 0, 0)
+KERN_VARIANT(kern_local_int,         int, int, KMODE_LOCAL,   0, 0, 0)
+KERN_VARIANT(kern_overlap_int,       int, int, KMODE_OVERLAP, 0, 0, 0)
+KERN_VARIANT(kern_fit_int,           int, int, KMODE_FIT,     0, 0, 0)
+KERN_VARIANT(kern_fit_jump_int,      int, int, KMODE_FIT,     1, 0, 0)
+KERN_VARIANT(kern_fit_long_int,      int, int, KMODE_FIT,     0, 1, 0)
+KERN_VARIANT(kern_fit_jump_long_int, int, int, KMODE_FIT,     1, 1, 0)
+
+typedef double (*kern_dbl_f)(kstring_t*, kstring_t*, const opt_t*, matrix_t*, const char*, double, int*, int*, int*);
+typedef int (*kern_int_f)(kstring_t*, kstring_t*, const opt_t*, matrix_t*, const char*, double, int*, int*, int*);
+
+// indexed by mode, then jump + 2*two for fit
+static const kern_dbl_f kern_tb[4][4] = {
+	{kern_global_tb},
+	{kern_local_tb},
+	{kern_fit_tb, kern_fit_jump_tb, kern_fit_long_tb, kern_fit_jump_long_tb},
+	{kern_overlap_tb}
+};
+static const kern_dbl_f kern_dbl[4][4] = {
+	{kern_global_dbl},
+	{kern_local_dbl},
+	{kern_fit_dbl, kern_fit_jump_dbl, kern_fit_long_dbl, kern_fit_jump_long_dbl},
+	{kern_overlap_dbl}
+};
+static const kern_int_f kern_int[4][4] = {
+	{kern_global_int},
+	{kern_local_int},
+	{kern_fit_int, kern_fit_jump_int, kern_fit_long_int, kern_fit_jump_long_int},
+	{kern_overlap_int}
+};
+
+static inline int
+kern_pick(int mode, const opt_t *opt){
+	if(mode < KMODE_GLOBAL || mode > KMODE_OVERLAP) die("kern: unknown mode %d\n", mode);
+	if(mode != KMODE_FIT) return 0;
+	return (opt->s == true ? 1 : 0) + (opt->p == true ? 2 : 0);
+}
+
+/*
+ * fill S for a traceback; S must be (s1->l+1) x (s2->l+1), with the
+ * long gap states allocated when opt->p is set. *state is where the
+ * traceback starts, (*i_end, *j_end) the end cell.
+ */
+double
+kern_fill(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, matrix_t *S, int *state, int *i_end, int *j_end){
+	int k = kern_pick(mode, opt);
+	char *site = (k & 1) ? site_mask(opt, s2->l) : NULL;
+	double score = kern_tb[mode][k](s1, s2, opt, S, site, -INFINITY, state, i_end, j_end);
+	if(site) free(site);
+	return score;
+}
+
+/*
+ * score only, O(n) memory
+ */
+double
+kern_score(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, int *i_end, int *j_end){
+	int k = kern_pick(mode, opt);
+	char *site = (k & 1) ? site_mask(opt, s2->l) : NULL;
+	double score = kern_dbl[mode][k](s1, s2, opt, NULL, site, -INFINITY, NULL, i_end, j_end);
+	if(site) free(site);
+	return score;
+}
+
+/*
+ * kern_score(), or -INFINITY as soon as no alignment can reach
+ * min_score; only for the scorings of prune_ok()
+ */
+double
+kern_score_min(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, double min_score){
+	int k = kern_pick(mode, opt);
+	char *site = (k & 1) ? site_mask(opt, s2->l) : NULL;
+	double score = kern_dbl[mode][k](s1, s2, opt, NULL, site, min_score, NULL, NULL, NULL);
+	if(site) free(site);
+	return score;
+}
+
+/*
+ * score only in int; unreachable scores come back below INT_MIN/4
+ */
+int
+kern_score_int(kstring_t *s1, kstring_t *s2, opt_t *opt, int mode, int *i_end, int *j_end){
+	int k = kern_pick(mode, opt);
+	char *site = (k & 1) ? site_mask(opt, s2->l) : NULL;
+	int score = kern_int[mode][k](s1, s2, opt, NULL, site, -INFINITY, NULL, i_end, j_end);
+	if(site) free(site);
+	return score;
+}
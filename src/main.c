@@ -2,6 +2,12 @@
 #include <string.h>
 #include "kstring.h"
 #include "alignment.h"
+#include "index.h"
+#include "stats.h"
+#ifdef AT_STATS
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
 
 #ifndef PACKAGE_VERSION
 #define PACKAGE_VERSION "0.7.23-r15"
@@ -12,6 +18,47 @@ int main_local_affine(int argc, char *argv[]);
 int main_overlap(int argc, char *argv[]);
 int main_fit_affine_jump(int argc, char *argv[]);
 int main_edit_dist(int argc, char *argv[]);
+int main_index(int argc, char *argv[]);
+int main_batch(int argc, char *argv[]);
+int main_search(int argc, char *argv[]);
+int main_pairwise(int argc, char *argv[]);
+int main_serve(int argc, char *argv[]);
+int main_faidx(int argc, char *argv[]);
+
+#ifdef AT_STATS
+__thread stats_t at_stats;
+static stats_t stats_total;  // of every thread that folded its own
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * move the counters of the calling thread into the total
+ */
+void stats_fold(void){
+	pthread_mutex_lock(&stats_lock);
+	stats_add(&stats_total, &at_stats);
+	memset(&at_stats, 0, sizeof(at_stats));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_print(FILE *fp, const char *cmd, double t_real){
+	static const char *const phase[STATS_N] = {"parse", "alloc", "fill", "traceback", "output"};
+	const stats_t *s = &stats_total;
+	struct rusage r;
+	int i, ret;
+	stats_fold();
+	getrusage(RUSAGE_SELF, &r);
+	fprintf(fp, "{\"command\":\"%s\",\"real_s\":%.6f,\"phases_s\":{", cmd, stats_now() - t_real);
+	for (i = 0; i < STATS_N; ++i)
+		fprintf(fp, "%s\"%s\":%.6f", i? "," : "", phase[i], s->t[i]);
+	fprintf(fp, "},\"cells\":%llu,\"bytes_allocated\":%llu,\"peak_rss_kb\":%ld,\"engines\":{",
+			(unsigned long long)s->cells, (unsigned long long)s->bytes, r.ru_maxrss);
+	for (i = ret = 0; i < ENG_N; ++i)
+		if (s->engine[i]) fprintf(fp, "%s\"%s\":%llu", ret++? "," : "", plan_name(i), (unsigned long long)s->engine[i]);
+	fprintf(fp, "}");
+	if (at_perf) perf_print(fp, s, phase);
+	fprintf(fp, "}\n");
+}
+#endif
 
 static int usage()
 {
@@ -19,21 +66,39 @@ static int usage()
 	fprintf(stderr, "Program: alignTools (pairwise DNA sequence alignment)\n");
 	fprintf(stderr, "Version: %s\n", PACKAGE_VERSION);
 	fprintf(stderr, "Contact: Rongxin Fang <r3fang@ucsd.edu>\n\n");
-	fprintf(stderr, "Usage:   alignTools <command> [options]\n\n");
+	fprintf(stderr, "Usage:   alignTools [--stats] [--perf] <command> [options]\n\n");
 	fprintf(stderr, "Command: global     global (needle) alignment allows affine gap\n");
 	fprintf(stderr, "         local      smith-waterman with affine gap\n");
 	fprintf(stderr, "         fit        fit alingment allows affine gap plus jump state\n");
 	fprintf(stderr, "         overlap    overlap alignment\n");
 	fprintf(stderr, "         edit       edit distance\n");
+	fprintf(stderr, "         index      build a persistent target index\n");
+	fprintf(stderr, "         batch      score many short pairs, one per SIMD lane\n");
+	fprintf(stderr, "         search     find every occurrence of short queries with up to k edits\n");
+	fprintf(stderr, "         pairwise   all-vs-all score or distance matrix\n");
+	fprintf(stderr, "         serve      alignment server on a Unix domain socket\n");
+	fprintf(stderr, "         faidx      index a FASTA file for --shard\n");
 	fprintf(stderr, "\n");
 	return 1;
 }
 
 int main(int argc, char *argv[])
 {
-	int i, ret;
-	double t_real;
+	int i, ret, stats = 0, perf = 0;
 	kstring_t pg = {0,0,0};
+	// --stats and --perf may appear anywhere; drop them before the sub-command sees argv
+	for (i = ret = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--stats") == 0) stats = 1;
+		else if (strcmp(argv[i], "--perf") == 0) stats = perf = 1;
+		else argv[ret++] = argv[i];
+	}
+	argc = ret;
+#ifdef AT_STATS
+	if (perf) perf_init();
+	double t_real = stats_now();
+#else
+	if (stats) fprintf(stderr, "[%s] --%s ignored, rebuild with 'make STATS=1'\n", __func__, perf? "perf" : "stats");
+#endif
 	ksprintf(&pg, "@PG\tID:bwa\tPN:bwa\tVN:%s\tCL:%s", PACKAGE_VERSION, argv[0]);
 	for (i = 1; i < argc; ++i) ksprintf(&pg, " %s", argv[i]);
 	if (argc < 2) return usage();
@@ -42,6 +107,12 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[1], "fit") == 0) ret = main_fit_affine_jump(argc-1, argv+1);
 	else if (strcmp(argv[1], "overlap") == 0) ret = main_overlap(argc-1, argv+1);
 	else if (strcmp(argv[1], "edit") == 0) ret = main_edit_dist(argc-1, argv+1);
+	else if (strcmp(argv[1], "index") == 0) ret = main_index(argc-1, argv+1);
+	else if (strcmp(argv[1], "batch") == 0) ret = main_batch(argc-1, argv+1);
+	else if (strcmp(argv[1], "search") == 0) ret = main_search(argc-1, argv+1);
+	else if (strcmp(argv[1], "pairwise") == 0) ret = main_pairwise(argc-1, argv+1);
+	else if (strcmp(argv[1], "serve") == 0) ret = main_serve(argc-1, argv+1);
+	else if (strcmp(argv[1], "faidx") == 0) ret = main_faidx(argc-1, argv+1);
 	else {
 		fprintf(stderr, "[main] unrecognized command '%s'\n", argv[1]);
 		return 1;
@@ -53,5 +124,8 @@ int main(int argc, char *argv[])
 			fprintf(stderr, " %s", argv[i]);
 		fprintf(stderr, "\n");
 	}
+#ifdef AT_STATS
+	if (stats) stats_print(stderr, argv[1], t_real);
+#endif
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*--------------------------------------------------------------------*/
+/* myers.c 		                                                      */
+/* Bit-parallel unit-cost edit distance (Myers 1999).                 */
+/*                                                                    */
+/* A column of the edit matrix is kept as two bit-vectors of the      */
+/* vertical differences D(i,j)-D(i-1,j) = +1 (Pv) and -1 (Mv), so one */
+/* column of 64 rows costs a handful of word operations. s1 is cut    */
+/* into 64-row blocks (Hyyro 2003); the horizontal difference carried */
+/* out of the bottom of a block feeds the next one. For the global    */
+/* distance the top row is D(0,j) = j, i.e. every column enters the   */
+/* first block with a horizontal difference of +1.                    */
+/*                                                                    */
+/* Match 0, mismatch 1, indel 1: edit_dist() with opt->u = 1. The     */
+/* column step myers_block() is shared with search.c (alignment.h).   */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+/*
+ * unit-cost global edit distance between s1 and s2
+ */
+AT_CLONES long
+edit_myers(const kstring_t *s1, const kstring_t *s2){
+	const size_t m = s1->l, n = s2->l, B = (m + MYERS_W - 1) / MYERS_W;
+	if(m == 0 || n == 0) return m + n;
+	// class 0 matches nothing; every distinct base of s1 gets its own
+	unsigned char cls[256] = {0};
+	int k = 0;
+	size_t i, j, b;
+	for(i = 0; i < m; i++) if(cls[(unsigned char)s1->s[i]] == 0) cls[(unsigned char)s1->s[i]] = ++k;
+	STATS_BEGIN(STATS_ALLOC);
+	uint64_t *peq = mycalloc((k + 1) * B, uint64_t);
+	uint64_t *pv = mycalloc(B, uint64_t), *mv = mycalloc(B, uint64_t);
+	STATS_END(STATS_ALLOC);
+	STATS_BEGIN(STATS_FILL);
+	for(i = 0; i < m; i++) peq[cls[(unsigned char)s1->s[i]] * B + i / MYERS_W] |= (uint64_t)1 << (i % MYERS_W);
+	for(b = 0; b < B; b++) pv[b] = ~(uint64_t)0; // D(i,0) = i
+	long score = B * MYERS_W; // D(64B,j), the last row of the last block
+	for(j = 0; j < n; j++){
+		const uint64_t *eq = peq + cls[(unsigned char)s2->s[j]] * B;
+		int h = 1;
+		for(b = 0; b < B; b++) h = myers_block(&pv[b], &mv[b], eq[b], h, MYERS_HIGH);
+		score += h;
+	}
+	// walk back up from row 64B to row m through the padding rows
+	for(i = B * MYERS_W; i > m; i--){
+		uint64_t bit = (uint64_t)1 << ((i - 1) % MYERS_W);
+		if(pv[B-1] & bit) score--;
+		else if(mv[B-1] & bit) score++;
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * n);
+	free(peq); free(pv); free(mv);
+	return score;
+}
@@ -0,0 +1,226 @@
+/*--------------------------------------------------------------------*/
+/* pairwise.c 		                                                  */
+/* All-vs-all scores of N sequences as a PHYLIP or binary matrix.     */
+/*                                                                    */
+/* Only the N(N-1)/2 pairs i < j are scored (global, local and edit   */
+/* are symmetric), plus the diagonal for the two score modes; edit    */
+/* puts 0 there. Every score goes through batch_score() (batch.c), so */
+/* short pairs run one per SIMD lane and long ones through the        */
+/* planner, score only, and no traceback matrix is ever allocated.    */
+/*                                                                    */
+/* The upper triangle is cut into tiles of PAIR_TILE x PAIR_TILE      */
+/* sequences that threads take in turn from a shared counter; a tile  */
+/* touches 2*PAIR_TILE sequences, which stay in cache while its pairs */
+/* are scored, and is large enough to fill SIMD batches of equal      */
+/* lengths. Scores are kept as the triangle, N(N+1)/2 doubles.        */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include "alignment.h"
+
+#define PAIR_TILE               64
+#define PAIR_PHYLIP             0
+#define PAIR_BINARY             1
+
+typedef struct {
+	size_t n;              // sequences
+	char **name;
+	kstring_t *seq;
+	double *d;             // upper triangle with the diagonal, row by row
+	size_t nb;             // tiles per side
+	size_t n_tiles;
+	volatile size_t next;  // next tile to score
+	opt_t *opt;
+	int mode;
+} pair_job_t;
+
+static inline size_t
+pair_tri(size_t n, size_t i, size_t j){
+	return i * n - i * (i - 1) / 2 + (j - i);
+}
+
+static inline double
+pair_get(const pair_job_t *job, size_t i, size_t j){
+	return i <= j ? job->d[pair_tri(job->n, i, j)] : job->d[pair_tri(job->n, j, i)];
+}
+
+/*
+ * tile t in row-major order over the upper triangle of tiles
+ */
+static void
+pair_tile(size_t nb, size_t t, size_t *bi, size_t *bj){
+	size_t i = 0;
+	while(t >= nb - i){ t -= nb - i; i++; }
+	*bi = i; *bj = i + t;
+}
+
+/*
+ * the pairs of tile t; a, s and at (where each score goes) hold a tile
+ */
+static void
+pair_score_tile(pair_job_t *job, size_t t, pair_t *a, pair_t **s, size_t *at){
+	size_t bi, bj, i, j, k = 0;
+	pair_tile(job->nb, t, &bi, &bj);
+	const size_t i1 = (bi + 1) * PAIR_TILE < job->n ? (bi + 1) * PAIR_TILE : job->n;
+	const size_t j1 = (bj + 1) * PAIR_TILE < job->n ? (bj + 1) * PAIR_TILE : job->n;
+	for(i = bi * PAIR_TILE; i < i1; i++){
+		for(j = bi == bj ? i : bj * PAIR_TILE; j < j1; j++){
+			if(i == j && job->mode == BATCH_EDIT){
+				job->d[pair_tri(job->n, i, j)] = 0;
+				continue;
+			}
+			a[k].s1 = job->seq[i]; // shared, owned by job
+			a[k].s2 = job->seq[j];
+			at[k] = pair_tri(job->n, i, j);
+			s[k] = &a[k];
+			k++;
+		}
+	}
+	batch_score(s, k, job->opt, job->mode);
+	for(i = 0; i < k; i++) job->d[at[i]] = a[i].score;
+}
+
+static void
+*pair_worker(void *data){
+	pair_job_t *job = (pair_job_t*)data;
+	pair_t *a = mycalloc(PAIR_TILE * PAIR_TILE, pair_t);
+	pair_t **s = mycalloc(PAIR_TILE * PAIR_TILE, pair_t*);
+	size_t *at = mycalloc(PAIR_TILE * PAIR_TILE, size_t), t;
+	while((t = __sync_fetch_and_add(&job->next, 1)) < job->n_tiles) pair_score_tile(job, t, a, s, at);
+	free(a);
+	free(s);
+	free(at);
+	STATS_FOLD();
+	return NULL;
+}
+
+static void
+pair_read(pair_job_t *job, const char *fn){
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	kseq_t *seq = kseq_init(fp);
+	size_t cap = 0;
+	STATS_BEGIN(STATS_PARSE);
+	while(kseq_read(seq) >= 0){
+		if(job->n == cap){
+			cap = cap ? cap * 2 : 256;
+			job->name = realloc(job->name, cap * sizeof(char*));
+			job->seq = realloc(job->seq, cap * sizeof(kstring_t));
+			if(job->name == NULL || job->seq == NULL) die("pair_read: fail to allocate %zu sequences\n", cap);
+		}
+		job->name[job->n] = strdup(seq->name.s);
+		memset(&job->seq[job->n], 0, sizeof(kstring_t));
+		kputsn(seq->seq.s, seq->seq.l, &job->seq[job->n]);
+		job->n++;
+	}
+	STATS_END(STATS_PARSE);
+	kseq_destroy(seq);
+	gzclose(fp);
+	if(job->n < 2) die("%s has fewer than two sequences\n", fn);
+}
+
+/*
+ * relaxed PHYLIP: the count, then one row per sequence, its name first
+ */
+static void
+pair_write_phylip(const pair_job_t *job, FILE *fp){
+	size_t i, j;
+	fprintf(fp, "%zu\n", job->n);
+	for(i = 0; i < job->n; i++){
+		fprintf(fp, "%-10s", job->name[i]);
+		for(j = 0; j < job->n; j++) fprintf(fp, " %.0f", pair_get(job, i, j));
+		fputc('\n', fp);
+	}
+}
+
+/*
+ * N as a uint64_t, then the full N x N matrix of doubles row by row,
+ * native byte order; rows are in input order
+ */
+static void
+pair_write_binary(const pair_job_t *job, FILE *fp){
+	const uint64_t n = job->n;
+	double *row = mycalloc(job->n, double);
+	size_t i, j;
+	if(fwrite(&n, sizeof(n), 1, fp) != 1) die("fail to write the matrix\n");
+	for(i = 0; i < job->n; i++){
+		for(j = 0; j < job->n; j++) row[j] = pair_get(job, i, j);
+		if(fwrite(row, sizeof(double), job->n, fp) != job->n) die("fail to write the matrix\n");
+	}
+	free(row);
+}
+
+int
+main_pairwise(int argc, char *argv[]){
+	opt_t *opt = init_opt();
+	int c, t, mode = BATCH_EDIT, format = PAIR_PHYLIP, n_threads = 1;
+	bool u_set = false;
+	while ((c = getopt_long(argc, argv, "m:u:o:e:a:f:T:M:", plan_long_opts, NULL)) >= 0) {
+			switch (c) {
+			case 'm': opt->m = atoi(optarg); break;
+			case 'u': opt->u = atoi(optarg); u_set = true; break;
+			case 'o': opt->o = atoi(optarg); break;
+			case 'e': opt->e = atoi(optarg); break;
+			case 'a':
+				if(strcmp(optarg, "global") == 0) mode = BATCH_GLOBAL;
+				else if(strcmp(optarg, "local") == 0) mode = BATCH_LOCAL;
+				else if(strcmp(optarg, "edit") == 0) mode = BATCH_EDIT;
+				else die("unknown recurrence '%s'\n", optarg);
+				break;
+			case 'f':
+				if(strcmp(optarg, "phylip") == 0) format = PAIR_PHYLIP;
+				else if(strcmp(optarg, "bin") == 0) format = PAIR_BINARY;
+				else die("unknown format '%s'\n", optarg);
+				break;
+			case 'T': n_threads = atoi(optarg); break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case 'b': case PLAN_OPT_MIN_SCORE: die("--both-strands and --min-score are not options of pairwise\n");
+			default: return 1;
+		}
+	}
+	if (optind + 1 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools pairwise [options] <seqs.fa>\n\n");
+				fprintf(stderr, "Options: -m INT   score for a match [%d]\n", opt->m);
+				fprintf(stderr, "         -u INT   mismatch penalty [%d, 1 for edit]\n", opt->u);
+				fprintf(stderr, "         -o INT   gap open penalty [%d]\n", opt->o);
+				fprintf(stderr, "         -e INT   gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -a STR   recurrence: global, local or edit [edit]\n");
+				fprintf(stderr, "         -f STR   matrix format: phylip or bin [phylip]\n");
+				fprintf(stderr, "         -T INT   threads [%d]\n", n_threads);
+				fprintf(stderr, "         -M SIZE  memory budget, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "\n");
+				fprintf(stderr, "bin is N as a uint64, then the N x N doubles row by row, native byte order.\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	if(n_threads < 1) die("-T must be at least 1");
+	if(mode == BATCH_EDIT && u_set == false) opt->u = 1;
+	pair_job_t job;
+	memset(&job, 0, sizeof(job));
+	job.opt = opt;
+	job.mode = mode;
+	pair_read(&job, argv[optind]);
+	job.nb = (job.n + PAIR_TILE - 1) / PAIR_TILE;
+	job.n_tiles = job.nb * (job.nb + 1) / 2;
+	STATS_BEGIN(STATS_ALLOC);
+	job.d = mycalloc(job.n * (job.n + 1) / 2, double);
+	STATS_END(STATS_ALLOC);
+	if(n_threads <= 1){
+		pair_worker(&job);
+	}else{
+		pthread_t *tid = mycalloc(n_threads, pthread_t);
+		for(t = 0; t < n_threads; t++)
+			if(pthread_create(&tid[t], NULL, pair_worker, &job) != 0) die("fail to start thread %d", t);
+		for(t = 0; t < n_threads; t++) pthread_join(tid[t], NULL);
+		free(tid);
+	}
+	STATS_BEGIN(STATS_OUTPUT);
+	if(format == PAIR_BINARY) pair_write_binary(&job, stdout);
+	else pair_write_phylip(&job, stdout);
+	STATS_END(STATS_OUTPUT);
+	size_t i;
+	for(i = 0; i < job.n; i++){ free(job.name[i]); free(job.seq[i].s); }
+	free(job.name); free(job.seq); free(job.d);
+	free(opt);
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*--------------------------------------------------------------------*/
+/* perf.c 		                                                      */
+/* Hardware counters for --perf, through Linux perf_event_open().     */
+/*                                                                    */
+/* Each thread opens one group of counters, user space only, the      */
+/* first time it reads them; STATS_BEGIN/STATS_END (stats.h) read the */
+/* group around every phase and add the difference to at_stats, so    */
+/* the counters fold across threads like the timers. A read is one    */
+/* read(2), about a microsecond, which shows on tiny alignments.      */
+/*                                                                    */
+/* A counter the CPU or the kernel refuses (no PMU in a VM, or        */
+/* kernel.perf_event_paranoid > 2) is left out and printed as null;   */
+/* the others still count. Counts are scaled when the kernel had to   */
+/* multiplex the group.                                               */
+/*--------------------------------------------------------------------*/
+#include "alignment.h"
+
+#ifdef AT_STATS
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+int at_perf = 0;
+static int perf_avail[PERF_N];       // counters the main thread could open
+static pthread_key_t perf_key;
+
+typedef struct {
+	int fd[PERF_N];                  // -1 when not counted
+	int leader;                      // fd of the group, -1 when none opened
+	int n;                           // counters in the group, in PERF_* order
+} perf_group_t;
+
+static __thread perf_group_t *perf_g;
+
+static const char *perf_names[PERF_N] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "page_faults"};
+
+#ifdef __linux__
+static void
+perf_attr(int k, struct perf_event_attr *a){
+	memset(a, 0, sizeof(*a));
+	a->size = sizeof(*a);
+	a->type = PERF_TYPE_HARDWARE;
+	switch(k){
+		case PERF_CYCLES:    a->config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case PERF_INSNS:     a->config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case PERF_L1D_MISS:
+			a->type = PERF_TYPE_HW_CACHE;
+			a->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		case PERF_LLC_MISS:  a->config = PERF_COUNT_HW_CACHE_MISSES; break;
+		case PERF_BR_MISS:   a->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		default:
+			a->type = PERF_TYPE_SOFTWARE;
+			a->config = PERF_COUNT_SW_PAGE_FAULTS;
+			break;
+	}
+	a->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	a->exclude_kernel = 1;
+	a->exclude_hv = 1;
+}
+#endif
+
+/*
+ * thread exit, through perf_key
+ */
+static void
+perf_close(void *data){
+	perf_group_t *g = (perf_group_t*)data;
+	int k;
+	for(k = 0; k < PERF_N; k++) if(g->fd[k] >= 0) close(g->fd[k]);
+	free(g);
+}
+
+/*
+ * the counters of the calling thread; errno of the first refused one
+ * in *err
+ */
+static perf_group_t
+*perf_open(int *err){
+	perf_group_t *g = mycalloc(1, perf_group_t);
+	int k;
+	g->leader = -1;
+	*err = 0;
+	for(k = 0; k < PERF_N; k++){
+		g->fd[k] = -1;
+#ifdef __linux__
+		struct perf_event_attr a;
+		perf_attr(k, &a);
+		g->fd[k] = syscall(SYS_perf_event_open, &a, 0, -1, g->leader, 0);
+		if(g->fd[k] < 0){
+			if(*err == 0) *err = errno;
+			continue;
+		}
+		if(g->leader < 0) g->leader = g->fd[k];
+		g->n++;
+#else
+		*err = ENOSYS;
+#endif
+	}
+	pthread_setspecific(perf_key, g);
+	return g;
+}
+
+/*
+ * open the counters of the main thread; at_perf stays 0 if none opens
+ */
+void
+perf_init(void){
+	int k, err, n_hw = 0;
+	if(pthread_key_create(&perf_key, perf_close) != 0) die("perf_init: fail to create a thread key\n");
+	perf_g = perf_open(&err);
+	for(k = 0; k < PERF_N; k++){
+		perf_avail[k] = perf_g->fd[k] >= 0;
+		if(perf_avail[k] && k != PERF_FAULTS) n_hw++;
+	}
+	if(n_hw < PERF_N - 1)
+		fprintf(stderr, "[%s] %d of %d hardware counters available (%s); see kernel.perf_event_paranoid\n",
+				__func__, n_hw, PERF_N - 1, strerror(err));
+	at_perf = perf_g->n > 0;
+}
+
+/*
+ * current counts of the calling thread in PERF_* order, 0 for a counter
+ * not counted
+ */
+void
+perf_read(uint64_t *v){
+	uint64_t buf[3 + PERF_N];
+	int k, i, err;
+	memset(v, 0, PERF_N * sizeof(uint64_t));
+	if(perf_g == NULL) perf_g = perf_open(&err);
+	if(perf_g->leader < 0) return;
+	if(read(perf_g->leader, buf, sizeof(buf)) < (ssize_t)((3 + perf_g->n) * sizeof(uint64_t))) return;
+	// nr, time enabled, time running, then one value per counter
+	const double scale = buf[2] > 0 && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0;
+	for(k = i = 0; k < PERF_N; k++)
+		if(perf_g->fd[k] >= 0) v[k] = (uint64_t)(buf[3 + i++] * scale);
+}
+
+static void
+perf_print_one(FILE *fp, const char *name, const uint64_t *v){
+	int k;
+	fprintf(fp, "\"%s\":{", name);
+	for(k = 0; k < PERF_N; k++){
+		if(perf_avail[k]) fprintf(fp, "%s\"%s\":%llu", k? "," : "", perf_names[k], (unsigned long long)v[k]);
+		else fprintf(fp, "%s\"%s\":null", k? "," : "", perf_names[k]);
+	}
+	if(perf_avail[PERF_CYCLES] && perf_avail[PERF_INSNS] && v[PERF_CYCLES] > 0)
+		fprintf(fp, ",\"ipc\":%.3f}", (double)v[PERF_INSNS] / v[PERF_CYCLES]);
+	else fprintf(fp, ",\"ipc\":null}");
+}
+
+/*
+ * ,"perf":{...} of --stats: the counters per phase, then per engine of
+ * the planner (from its entry to its return, the phases included)
+ */
+void
+perf_print(FILE *fp, const stats_t *s, const char *const *phase){
+	int i, ret;
+	fprintf(fp, ",\"perf\":{");
+	for(i = 0; i < STATS_N; i++){
+		if(i) fputc(',', fp);
+		perf_print_one(fp, phase[i], s->hw[i]);
+	}
+	fprintf(fp, ",\"engines\":{");
+	for(i = ret = 0; i < ENG_N; i++){
+		if(s->engine[i] == 0) continue;
+		if(ret++) fputc(',', fp);
+		perf_print_one(fp, plan_name(i), s->engine_hw[i]);
+	}
+	fprintf(fp, "}}");
+}
+#endif
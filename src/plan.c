@@ -0,0 +1,330 @@
+/*--------------------------------------------------------------------*/
+/* plan.c 		                                                      */
+/* Engine planner in front of the aligners.                           */
+/*                                                                    */
+/* plan_pick() lists every engine that gives the requested output, an */
+/* alignment or (r1/r2 NULL) a score, for the mode and scoring, costs */
+/* it from m and n, and keeps the cheapest whose memory fits in the   */
+/* budget (opt->max_mem, or half the physical memory). Costs are in   */
+/* ns per cell as measured on x86-64; only their ratios matter.       */
+/*                                                                    */
+/* full     kern_fill() on matrix_t, 16 bytes per cell (24 with -p)   */
+/* diff     int8 SIMD kernel (diff.c), one byte per cell; only when   */
+/*          diff_exact(), i.e. it scores like the L/M/U recurrence    */
+/* twopass  fit only: two score-only passes, then full on the aligned */
+/*          rectangle; counted at full's memory, which bounds it      */
+/* band     global only, see below                                    */
+/* score    two-row score-only kernel                                 */
+/* myers    bit-parallel edit distance (myers.c), unit costs only     */
+/* ckpt     checkpointed traceback (ckpt.c), O(n sqrt(m)) memory;     */
+/*          same alignment as full, -s and -p included; no overlap.   */
+/* hirsch   linear-space traceback (hirsch.c), O(n) memory; only      */
+/*          offered once the full matrices do not fit, as it may      */
+/*          break ties differently, and listed after ckpt, which wins */
+/*          an equal cost. No -s or -p for fit.                       */
+/*                                                                    */
+/* The budget is --max-mem/-M, e.g. 512M or 4G. An alignment that no  */
+/* engine can run within it stops with an error before allocating.    */
+/*                                                                    */
+/* Whether the banded engine (band.c) is exact depends on how similar */
+/* the pair is, which is only known once it has run: plan_align()     */
+/* tries it first with a growing half-width, score only, until the   */
+/* band score proves itself optimal or the attempts would cost half   */
+/* of the best other engine. Identical pairs then cost O(m*w).        */
+/*                                                                    */
+/* edit_plan() likewise first tries the score-only wavefront edit     */
+/* distance (wfa.c), O(ns) for a distance s, for up to half the cost  */
+/* of the engine picked; myers and score run only if it gives up.     */
+/*                                                                    */
+/* Fit, local and overlap first look for an exact match (exact.c),    */
+/* which is the optimal alignment under the usual scorings and is     */
+/* found without any DP.                                              */
+/*                                                                    */
+/* With --min-score, global, fit and overlap pairs are first checked  */
+/* against the q-gram bound and a score-only fill that stops once the */
+/* threshold is out of reach (prune.c); the engine picked only runs   */
+/* for the pairs that pass. Alignments below it come back as          */
+/* -INFINITY.                                                         */
+/*                                                                    */
+/* With a STATS=1 build the engine of every alignment is counted and  */
+/* reported by --stats.                                               */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <unistd.h>
+#include "alignment.h"
+
+#define PLAN_NS_FULL            30.0
+#define PLAN_NS_SCORE           5.0
+#define PLAN_NS_DIFF            1.0
+#define PLAN_NS_BAND            6.0
+#define PLAN_NS_MYERS           0.05
+#define PLAN_NS_CKPT            (3 * PLAN_NS_SCORE)  // fill, then the blocks again with pointers
+#define PLAN_NS_HIRSCH          (3 * PLAN_NS_SCORE)
+#define PLAN_NS_WFA             8.0     // per wavefront cell
+#define PLAN_BAND_W0            32      // first band half-width tried
+
+static const char *plan_names[ENG_N] = {"full", "diff", "twopass", "band", "score", "myers", "hirsch", "ckpt", "wfa", "exact", "qgram", "prune"};
+
+const struct option plan_long_opts[] = {
+	{"both-strands", no_argument, NULL, 'b'},
+	{"max-mem", required_argument, NULL, 'M'},
+	{"min-score", required_argument, NULL, PLAN_OPT_MIN_SCORE},
+	{NULL, 0, NULL, 0}
+};
+
+const char
+*plan_name(int engine){
+	return engine >= 0 && engine < ENG_N ? plan_names[engine] : "none";
+}
+
+/*
+ * bytes an alignment may allocate
+ */
+size_t
+plan_budget(const opt_t *opt){
+	if(opt->max_mem > 0) return opt->max_mem;
+	long pages = sysconf(_SC_PHYS_PAGES), size = sysconf(_SC_PAGE_SIZE);
+	if(pages <= 0 || size <= 0) return SIZE_MAX;
+	return (size_t)pages * size / 2;
+}
+
+/*
+ * bytes from a size such as 800000, 512K, 64M or 2G
+ */
+size_t
+plan_parse_mem(const char *s){
+	char *end;
+	double x = strtod(s, &end);
+	switch(*end){
+		case 'k': case 'K': x *= 1024.0; end++; break;
+		case 'm': case 'M': x *= 1048576.0; end++; break;
+		case 'g': case 'G': x *= 1073741824.0; end++; break;
+		case 't': case 'T': x *= 1099511627776.0; end++; break;
+		default: break;
+	}
+	if(end == s || *end != '\0' || !(x >= 1) || x >= (double)SIZE_MAX) die("bad memory size '%s'", s);
+	return (size_t)x;
+}
+
+static inline void
+plan_add(plan_t *pl, int engine, double cost, double mem, double budget){
+	if(mem < pl->least) pl->least = mem;
+	if(mem > budget) return;
+	if(pl->engine < 0 || cost < pl->cost){
+		pl->engine = engine;
+		pl->cost = cost;
+		pl->mem = mem;
+	}
+}
+
+/*
+ * cheapest engine for an m x n alignment (tb) or score; pl->engine is
+ * -1 when none fits in the budget, pl->full is what the full
+ * matrices would take and pl->least what the smallest engine would.
+ */
+void
+plan_pick(int mode, size_t m, size_t n, const opt_t *opt, bool tb, plan_t *pl){
+	const double cells = (double)m * n, budget = plan_budget(opt);
+	const double rows = 12.0 * (n + 1) * sizeof(double);
+	pl->engine = -1;
+	pl->cost = pl->mem = 0;
+	pl->least = INFINITY;
+	pl->full = (m + 1.0) * (n + 1.0) * (mode == KMODE_FIT && opt->p == true ? 24 : 16);
+	if(mode == KMODE_EDIT){
+		pl->full = (m + 1.0) * (n + 1.0) * 48;
+		if(opt->u == 1) plan_add(pl, ENG_MYERS, cells * PLAN_NS_MYERS, 258.0 * (m / 64 + 1) * 8, budget);
+		plan_add(pl, ENG_SCORE, cells * PLAN_NS_SCORE, 2.0 * (n + 1) * sizeof(double), budget);
+		return;
+	}
+	if(tb == false){
+		plan_add(pl, ENG_SCORE, cells * PLAN_NS_SCORE, rows, budget);
+		return;
+	}
+	plan_add(pl, ENG_FULL, cells * PLAN_NS_FULL, pl->full, budget);
+	if(m > 0 && n > 0 && diff_exact(opt) == true && (mode == KMODE_GLOBAL || (mode == KMODE_FIT && opt->s == false)))
+		plan_add(pl, ENG_DIFF, cells * PLAN_NS_DIFF, cells + 32.0 * (m + n), budget);
+	// the aligned rectangle of a fit is about m x m; no such guess holds for local
+	if(mode == KMODE_FIT && opt->p == false)
+		plan_add(pl, ENG_TWOPASS, 2 * cells * PLAN_NS_SCORE + (double)m * (n < 2*m ? n : 2*m) * PLAN_NS_FULL, pl->full, budget);
+	const bool plain = (mode != KMODE_FIT || (opt->s == false && opt->p == false)) ? true : false;
+	if(mode != KMODE_OVERLAP)
+		plan_add(pl, ENG_CKPT, cells * PLAN_NS_CKPT, ckpt_mem(mode, m, n, opt), budget);
+	if(pl->full > budget && plain == true)
+		plan_add(pl, ENG_HIRSCH, cells * PLAN_NS_HIRSCH, 12.0 * (n + 1) * sizeof(double) + (1 << 20) + 4.0 * (m + n), budget);
+}
+
+/*
+ * speculative banded global alignment; false when the band could not
+ * be proven optimal within the budget
+ */
+static bool
+plan_band(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, const plan_t *pl, double *score){
+	const size_t m = s1->l, n = s2->l, mn = m < n ? m : n;
+	const double budget = plan_budget(opt), limit = pl->engine < 0 ? INFINITY : pl->cost / 2;
+	const bool tb = (r1 != NULL && r2 != NULL) ? true : false;
+	double spent = 0, s, drop;
+	long w = PLAN_BAND_W0, need;
+	if(m == 0 || n == 0 || band_bound(opt, m, n, 0) == INFINITY) return false;
+	// band_bound() is linear in w, falling by drop per unit of width
+	drop = band_bound(opt, m, n, 0) - band_bound(opt, m, n, 1);
+	if(drop <= 0) return false;
+	while(1){
+		if((size_t)w > mn) w = mn; // the whole matrix, trivially exact
+		double width = band_width(m, n, w);
+		spent += m * width * PLAN_NS_BAND;
+		if(spent > limit) return false;
+		if(tb == true && (m + 1.0) * width + 6.0 * (n + 1) * sizeof(double) > budget) return false;
+		s = align_gla_band(s1, s2, NULL, NULL, opt, w);
+		if(s > band_bound(opt, m, n, w)) break;
+		// a wider band scores at least s; the width at which s would
+		// pass is a guess that keeps dissimilar pairs from doubling on
+		need = w + (long)((band_bound(opt, m, n, w) - s) / drop) + 1;
+		w = need > 2 * w ? need : 2 * w;
+	}
+	*score = tb == true ? align_gla_band(s1, s2, r1, r2, opt, w) : s;
+	return true;
+}
+
+/*
+ * what plan_align() returns for an alignment below --min-score
+ */
+static double
+plan_drop(kstring_t *r1, kstring_t *r2){
+	if(r1 != NULL && r2 != NULL && r1->s != NULL && r2->s != NULL){
+		r1->l = r2->l = 0;
+		r1->s[0] = r2->s[0] = '\0';
+	}
+	return -INFINITY;
+}
+
+/*
+ * bytes in KB below 1 MB, else in MB; the unit is returned
+ */
+static const char
+*plan_unit(double bytes, double *x){
+	if(bytes < 1048576.0){
+		*x = bytes / 1024.0;
+		return "KB";
+	}
+	*x = bytes / 1048576.0;
+	return "MB";
+}
+
+/*
+ * stop on an m x n alignment that needs more than the memory budget;
+ * need is rounded up, so that it is enough as printed
+ */
+void
+plan_die_mem(size_t m, size_t n, double need, const opt_t *opt){
+	double x, y;
+	const char *u = plan_unit(need, &x), *v = plan_unit(plan_budget(opt), &y);
+	x = ceil(x * 10) / 10;
+	die("%zu x %zu alignment needs %.1f %s, over the %.1f %s memory budget", m, n, x, u, y, v);
+}
+
+/*
+ * the engine picked by plan_pick()
+ */
+static double
+plan_run(int mode, int engine, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	switch(engine){
+		case ENG_SCORE:   return kern_score(s1, s2, opt, mode, NULL, NULL);
+		case ENG_DIFF:    return mode == KMODE_GLOBAL ? align_gla_diff(s1, s2, r1, r2, opt) : align_fit_diff(s1, s2, r1, r2, opt);
+		case ENG_TWOPASS: return align_fit_twopass(s1, s2, r1, r2, opt);
+		case ENG_CKPT:    return align_ckpt(mode, s1, s2, r1, r2, opt);
+		case ENG_HIRSCH:
+			switch(mode){
+				case KMODE_GLOBAL: return align_gla_hirsch(s1, s2, r1, r2, opt);
+				case KMODE_LOCAL:  return align_local_hirsch(s1, s2, r1, r2, opt);
+				case KMODE_FIT:    return align_fit_hirsch(s1, s2, r1, r2, opt);
+				default:           return align_overlap_hirsch(s1, s2, r1, r2, opt);
+			}
+		default:          break;
+	}
+	switch(mode){
+		case KMODE_GLOBAL: return align_gla(s1, s2, r1, r2, opt);
+		case KMODE_LOCAL:  return align_local_affine(s1, s2, r1, r2, opt);
+		case KMODE_FIT:    return align_fit_affine_jump(s1, s2, r1, r2, opt);
+		default:           return align_overlap(s1, s2, r1, r2, opt);
+	}
+}
+
+/*
+ * align (or score, when r1/r2 are NULL) with the cheapest engine;
+ * -INFINITY and empty r1/r2 below opt->min_score
+ */
+double
+plan_align(int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || opt == NULL) die("plan_align: parameter error\n");
+	const bool tb = (r1 != NULL && r2 != NULL) ? true : false;
+	const bool prune = prune_ok(mode, opt);
+	plan_t pl;
+	double score;
+	STATS_HW_BEGIN(engine);
+	if(exact_align(mode, s1, s2, r1, r2, opt, &score) == true){
+		STATS_ENGINE(ENG_EXACT);
+		return score < opt->min_score ? plan_drop(r1, r2) : score;
+	}
+	if(prune == true && prune_qgram(mode, s1, s2, opt) < opt->min_score){
+		STATS_ENGINE(ENG_QGRAM);
+		return plan_drop(r1, r2);
+	}
+	plan_pick(mode, s1->l, s2->l, opt, tb, &pl);
+	if(mode == KMODE_GLOBAL && plan_band(s1, s2, r1, r2, opt, &pl, &score) == true){
+		STATS_ENGINE(ENG_BAND);
+		return score < opt->min_score ? plan_drop(r1, r2) : score;
+	}
+	if(prune == true){
+		// score-only and stopped early when below; the engine only runs if not
+		score = kern_score_min(s1, s2, opt, mode, opt->min_score);
+		if(score < opt->min_score || tb == false){
+			STATS_ENGINE(ENG_PRUNE);
+			return score < opt->min_score ? plan_drop(r1, r2) : score;
+		}
+	}
+	if(pl.engine < 0) plan_die_mem(s1->l, s2->l, pl.least, opt);
+	score = plan_run(mode, pl.engine, s1, s2, r1, r2, opt);
+	STATS_ENGINE(pl.engine);
+	return score < opt->min_score ? plan_drop(r1, r2) : score;
+}
+
+/*
+ * edit distance with the cheapest engine
+ */
+int
+edit_plan(kstring_t *s1, kstring_t *s2, opt_t *opt){
+	plan_t pl;
+	STATS_HW_BEGIN(engine);
+	plan_pick(KMODE_EDIT, s1->l, s2->l, opt, false, &pl);
+	long d = edit_wfa(s1, s2, opt, pl.engine < 0 ? 0 : pl.cost / 2 / PLAN_NS_WFA);
+	if(d >= 0){
+		STATS_ENGINE(ENG_WFA);
+		return d;
+	}
+	if(pl.engine < 0) die("edit distance of %zu x %zu does not fit in the memory budget", s1->l, s2->l);
+	d = pl.engine == ENG_MYERS ? edit_myers(s1, s2) : edit_dist(s1, s2, opt);
+	STATS_ENGINE(pl.engine);
+	return d;
+}
+
+/* drop-in align_f for each mode */
+double
+align_gla_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	return plan_align(KMODE_GLOBAL, s1, s2, r1, r2, opt);
+}
+
+double
+align_local_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	return plan_align(KMODE_LOCAL, s1, s2, r1, r2, opt);
+}
+
+double
+align_fit_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1->l > s2->l) die("first sequence must be shorter than the second to do fitting alignment");
+	return plan_align(KMODE_FIT, s1, s2, r1, r2, opt);
+}
+
+double
+align_overlap_plan(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	return plan_align(KMODE_OVERLAP, s1, s2, r1, r2, opt);
+}
@@ -0,0 +1,655 @@
+/*--------------------------------------------------------------------*/
+/* prof.c 		                                                      */
+/* One-vs-many: every read of a file against a single long target     */
+/* (fit -q, local -q).                                                */
+/*                                                                    */
+/* Everything that only depends on the target is built once in a      */
+/* prof_t and shared read-only by the worker threads:                 */
+/*  - the target encoding: each distinct byte of the target gets a    */
+/*    slot, every other byte the last one (it never matches);         */
+/*  - the score profile, one int32 row per slot with s(slot, t[j]),   */
+/*    forward and reversed, so that the inner loop loads the scores   */
+/*    of a whole vector of columns instead of comparing bases;        */
+/*  - the junction mask of site_mask() and its reversed gate.         */
+/* Each read then runs the two-pass pipeline of twopass.c with int32  */
+/* rows: M and L of a row only depend on the previous row, so they    */
+/* are filled 8 (AVX2) or 16 (AVX-512) columns at a time from the     */
+/* profile (isa.h); U and J, which run along the row, follow as a     */
+/* vector prefix max. The traceback is built for the sub-rectangle    */
+/* found by the reverse pass, in matrices kept by the worker and only */
+/* regrown for a larger read. Scores and alignments are those of -t,  */
+/* except that a sub-rectangle missing the score goes to the planner  */
+/* (plan.c), which may pick another co-optimal alignment.             */
+/*                                                                    */
+/* A read that occurs exactly in the target (exact.c) skips all this. */
+/*                                                                    */
+/* Reads are taken a chunk at a time; workers pick reads off a shared */
+/* counter and the chunk is printed in input order once all are done. */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <pthread.h>
+#include "alignment.h"
+
+#define PROF_CHUNK              16384           // reads per chunk
+#define PROF_SLOTS              256
+
+/* what every worker reads */
+typedef struct {
+	const char *name;       // target name
+	kstring_t t;            // target
+	int mode;               // KMODE_FIT or KMODE_LOCAL
+	const opt_t *opt;
+	uint8_t slot[256];      // byte -> profile row
+	int n_slot;
+	int32_t *fwd, *rev;     // n_slot rows of n+1 scores: fwd[j] = s(., t[j-1]), rev[k] = s(., t[n-k])
+	char *site;             // site_mask()
+	int32_t *gate;          // reversed jump gate: gate[k] = 0 iff site[n+1-k], else PROF_NEG
+	int32_t *fgate;         // forward jump gate: fgate[j] = 0 iff site[j-1], else PROF_NEG
+	int32_t *zero, *none;   // all open, all closed
+	bool prune;             // --min-score bounds apply (prune.c)
+	qgram_t qg;             // q-grams of the target, when prune
+} prof_t;
+
+/* what a worker owns */
+typedef struct {
+	int32_t *buf;           // two rows per state
+	size_t cap;             // columns of buf
+	matrix_t *S;            // traceback matrices, S->m x S->n
+	kstring_t rc;           // reverse complement of the read
+} prof_ws_t;
+
+typedef struct {
+	char *name;
+	kstring_t s, out;
+} prof_read_t;
+
+typedef struct {
+	const prof_t *p;
+	prof_read_t *r;
+	size_t n;
+	volatile size_t next;   // next read to take
+} prof_job_t;
+
+static inline int32_t
+max32(int32_t a, int32_t b){
+	return a > b ? a : b;
+}
+
+/*--------------------------------------------------------------------*/
+/* row kernels (prof_ml_f and prof_gap_f in alignment.h)              */
+/*--------------------------------------------------------------------*/
+static int32_t
+prof_ml_scalar(const prow_t *p, prow_t *c, const int32_t *s, const int32_t *gate,
+		long j0, long n, int32_t o, int32_t e, int32_t floor){
+	int32_t best = PROF_NEG;
+	long j;
+	for(j = j0; j <= n; j++){
+		int32_t h = max32(max32(p->L[j-1], p->M[j-1]), max32(p->U[j-1], p->J[j-1] + gate[j]));
+		c->M[j] = max32(h + s[j], floor);
+		c->L[j] = max32(p->L[j] + e, p->M[j] + o);
+		best = max32(best, c->M[j]);
+	}
+	return best;
+}
+
+static void
+prof_gap_scalar(int32_t *U, const int32_t *M, const int32_t *gate, long n, int32_t o, int32_t e){
+	long j;
+	for(j = 1; j <= n; j++) U[j] = max32(M[j-1] + o + gate[j], U[j-1] + e);
+}
+
+#ifdef AT_HAVE_AVX2
+static AT_TARGET("avx2") int32_t
+prof_ml_avx2(const prow_t *p, prow_t *c, const int32_t *s, const int32_t *gate,
+		long j0, long n, int32_t o, int32_t e, int32_t floor){
+	const __m256i vo = _mm256_set1_epi32(o), ve = _mm256_set1_epi32(e), vf = _mm256_set1_epi32(floor);
+	__m256i vb = _mm256_set1_epi32(PROF_NEG);
+	int32_t b[8], best;
+	long j;
+	int k;
+#define LD(x)                   _mm256_loadu_si256((const __m256i*)(x))
+	for(j = j0; j + 7 <= n; j += 8){
+		__m256i h = _mm256_max_epi32(_mm256_max_epi32(LD(p->L + j - 1), LD(p->M + j - 1)),
+				_mm256_max_epi32(LD(p->U + j - 1), _mm256_add_epi32(LD(p->J + j - 1), LD(gate + j))));
+		__m256i m = _mm256_max_epi32(_mm256_add_epi32(h, LD(s + j)), vf);
+		_mm256_storeu_si256((__m256i*)(c->M + j), m);
+		_mm256_storeu_si256((__m256i*)(c->L + j), _mm256_max_epi32(_mm256_add_epi32(LD(p->L + j), ve),
+				_mm256_add_epi32(LD(p->M + j), vo)));
+		vb = _mm256_max_epi32(vb, m);
+	}
+#undef LD
+	_mm256_storeu_si256((__m256i*)b, vb);
+	best = prof_ml_scalar(p, c, s, gate, j, n, o, e, floor);
+	for(k = 0; k < 8; k++) best = max32(best, b[k]);
+	return best;
+}
+
+static AT_TARGET("avx2") void
+prof_gap_avx2(int32_t *U, const int32_t *M, const int32_t *gate, long n, int32_t o, int32_t e){
+	const __m256i vo = _mm256_set1_epi32(o), vn = _mm256_set1_epi32(PROF_NEG);
+	const __m256i ke = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(e));
+	const __m256i s1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+	const __m256i s2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+	const __m256i s4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+	long j;
+	for(j = 1; j + 7 <= n; j += 8){
+		__m256i x = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(M + j - 1)), vo);
+		x = _mm256_sub_epi32(_mm256_add_epi32(x, _mm256_loadu_si256((const __m256i*)(gate + j))), ke);
+		x = _mm256_max_epi32(x, _mm256_blend_epi32(_mm256_permutevar8x32_epi32(x, s1), vn, 0x01));
+		x = _mm256_max_epi32(x, _mm256_blend_epi32(_mm256_permutevar8x32_epi32(x, s2), vn, 0x03));
+		x = _mm256_max_epi32(x, _mm256_blend_epi32(_mm256_permutevar8x32_epi32(x, s4), vn, 0x0f));
+		x = _mm256_max_epi32(x, _mm256_set1_epi32(U[j-1] + e));
+		_mm256_storeu_si256((__m256i*)(U + j), _mm256_add_epi32(x, ke));
+	}
+	prof_gap_scalar(U + j - 1, M + j - 1, gate + j - 1, n - j + 1, o, e);
+}
+#endif
+
+#ifdef AT_HAVE_AVX512BW
+static AT_TARGET("avx512f") int32_t
+prof_ml_avx512(const prow_t *p, prow_t *c, const int32_t *s, const int32_t *gate,
+		long j0, long n, int32_t o, int32_t e, int32_t floor){
+	const __m512i vo = _mm512_set1_epi32(o), ve = _mm512_set1_epi32(e), vf = _mm512_set1_epi32(floor);
+	__m512i vb = _mm512_set1_epi32(PROF_NEG);
+	long j;
+#define LD(x)                   _mm512_loadu_si512(x)
+	for(j = j0; j + 15 <= n; j += 16){
+		__m512i h = _mm512_max_epi32(_mm512_max_epi32(LD(p->L + j - 1), LD(p->M + j - 1)),
+				_mm512_max_epi32(LD(p->U + j - 1), _mm512_add_epi32(LD(p->J + j - 1), LD(gate + j))));
+		__m512i m = _mm512_max_epi32(_mm512_add_epi32(h, LD(s + j)), vf);
+		_mm512_storeu_si512(c->M + j, m);
+		_mm512_storeu_si512(c->L + j, _mm512_max_epi32(_mm512_add_epi32(LD(p->L + j), ve),
+				_mm512_add_epi32(LD(p->M + j), vo)));
+		vb = _mm512_max_epi32(vb, m);
+	}
+#undef LD
+	return max32(prof_ml_scalar(p, c, s, gate, j, n, o, e, floor), _mm512_reduce_max_epi32(vb));
+}
+
+static AT_TARGET("avx512f") void
+prof_gap_avx512(int32_t *U, const int32_t *M, const int32_t *gate, long n, int32_t o, int32_t e){
+	const __m512i vo = _mm512_set1_epi32(o), vn = _mm512_set1_epi32(PROF_NEG);
+	const __m512i ke = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+			_mm512_set1_epi32(e));
+	long j;
+	for(j = 1; j + 15 <= n; j += 16){
+		__m512i x = _mm512_add_epi32(_mm512_loadu_si512(M + j - 1), vo);
+		x = _mm512_sub_epi32(_mm512_add_epi32(x, _mm512_loadu_si512(gate + j)), ke);
+		x = _mm512_max_epi32(x, _mm512_alignr_epi32(x, vn, 15));
+		x = _mm512_max_epi32(x, _mm512_alignr_epi32(x, vn, 14));
+		x = _mm512_max_epi32(x, _mm512_alignr_epi32(x, vn, 12));
+		x = _mm512_max_epi32(x, _mm512_alignr_epi32(x, vn, 8));
+		x = _mm512_max_epi32(x, _mm512_set1_epi32(U[j-1] + e));
+		_mm512_storeu_si512(U + j, _mm512_add_epi32(x, ke));
+	}
+	prof_gap_scalar(U + j - 1, M + j - 1, gate + j - 1, n - j + 1, o, e);
+}
+#endif
+
+static prof_ml_f prof_ml;
+static prof_gap_f prof_gap;
+
+/*
+ * the widest row kernels this cpu runs (isa.h)
+ */
+static void
+prof_pick(void){
+	prof_ml = prof_ml_scalar;
+	prof_gap = prof_gap_scalar;
+#ifdef AT_HAVE_AVX2
+	if(ISA_HAS("avx2")){
+		prof_ml = prof_ml_avx2;
+		prof_gap = prof_gap_avx2;
+	}
+#endif
+#ifdef AT_HAVE_AVX512BW
+	if(ISA_HAS("avx512f")){
+		prof_ml = prof_ml_avx512;
+		prof_gap = prof_gap_avx512;
+	}
+#endif
+}
+
+/*
+ * the row kernels for the other one-vs-many modes (fusion.c)
+ */
+void
+prof_kernels(prof_ml_f *ml, prof_gap_f *gap){
+	prof_pick();
+	*ml = prof_ml;
+	*gap = prof_gap;
+}
+
+static inline void
+prow_swap(prow_t *p, prow_t *c){
+	prow_t t = *p; *p = *c; *c = t;
+}
+
+/*
+ * rows for n columns in the worker's buffer
+ */
+static void
+prof_rows(prof_ws_t *w, size_t n, prow_t *p, prow_t *c){
+	if(n + 1 > w->cap){
+		free(w->buf);
+		w->cap = n + 1;
+		w->buf = mycalloc(8 * w->cap, int32_t);
+	}
+	p->M = w->buf;            p->L = p->M + w->cap; p->U = p->L + w->cap; p->J = p->U + w->cap;
+	c->M = p->J + w->cap;     c->L = c->M + w->cap; c->U = c->L + w->cap; c->J = c->U + w->cap;
+}
+
+/*--------------------------------------------------------------------*/
+/* passes                                                             */
+/*--------------------------------------------------------------------*/
+/*
+ * forward score-only pass of kern_score(), same score and end cell
+ */
+static int32_t
+prof_forward(const prof_t *pf, prof_ws_t *w, const kstring_t *q, long *i_end, long *j_end){
+	const opt_t *opt = pf->opt;
+	const int32_t o = opt->o, e = opt->e, jpen = opt->j;
+	const long m = q->l, n = pf->t.l;
+	const int fit = pf->mode == KMODE_FIT, jp = fit && opt->s == true;
+	const int32_t floor = fit ? PROF_NEG : 0, drop = o > e ? o : e;
+	const int prune = fit && pf->prune == true;
+	int32_t best = PROF_NEG, bound = 0;
+	long i, j, bi = 0, bj = 0;
+	prow_t p, c;
+	prof_rows(w, n, &p, &c);
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++){
+		c.M[j] = c.U[j] = 0;
+		c.L[j] = c.J[j] = fit ? PROF_NEG : 0;
+	}
+	for(i = 1; i <= m; i++){
+		prow_swap(&p, &c);
+		if(fit) c.M[0] = c.L[0] = c.U[0] = c.J[0] = PROF_NEG;
+		else c.M[0] = c.L[0] = c.U[0] = c.J[0] = 0;
+		const int32_t *s = pf->fwd + (size_t)pf->slot[(unsigned char)q->s[i-1]] * (n + 1);
+		// J only feeds M for fit -s; elsewhere pJ + PROF_NEG never wins
+		int32_t row = prof_ml(&p, &c, s, jp ? pf->zero : pf->none, 1, n, o, e, floor);
+		prof_gap(c.U, c.M, pf->zero, n, o, e);
+		if(jp) prof_gap(c.J, c.M, pf->fgate, n, jpen, 0);
+		if(!fit && row > best){ // first cell of the new best
+			for(j = 1; c.M[j] != row; j++);
+			best = row; bi = i; bj = j;
+		}
+		if(prune){ // the row bound of kern_score_min()
+			bound = bound + drop > row ? bound + drop : row;
+			if(bound + (double)opt->m * (m - i) < opt->min_score){
+				STATS_END(STATS_FILL);
+				STATS_CELLS(i * n);
+				*i_end = *j_end = 0;
+				return PROF_NEG;
+			}
+		}
+	}
+	if(fit){
+		bi = m;
+		for(j = 0; j <= n; j++) if(best < c.M[j]){ best = c.M[j]; bj = j; }
+		for(j = 0; j <= n; j++) if(best < c.L[j]){ best = c.L[j]; bj = j; }
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * n);
+	*i_end = bi; *j_end = bj;
+	return best;
+}
+
+/*
+ * prof_forward() unless the q-gram bound already rules out --min-score
+ */
+static int32_t
+prof_forward_min(const prof_t *pf, prof_ws_t *w, const kstring_t *q, long *i_end, long *j_end){
+	if(pf->prune == true && qgram_bound(&pf->qg, pf->mode, q, pf->t.l, pf->opt) < pf->opt->min_score){
+		*i_end = *j_end = 0;
+		return PROF_NEG;
+	}
+	return prof_forward(pf, w, q, i_end, j_end);
+}
+
+/*
+ * fit_reverse() over the reversed profile: the start column of an
+ * alignment of q scoring max that ends at column j_end, or -1
+ */
+static long
+prof_fit_reverse(const prof_t *pf, prof_ws_t *w, const kstring_t *q, long j_end, int32_t max){
+	const opt_t *opt = pf->opt;
+	const int32_t o = opt->o, e = opt->e, jpen = opt->j;
+	const long m = q->l, n = j_end, off = pf->t.l - j_end;
+	const int jp = opt->s == true;
+	long i, j, j_start = -1;
+	prow_t p, c;
+	prof_rows(w, n, &p, &c);
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) c.M[j] = c.L[j] = c.U[j] = c.J[j] = PROF_NEG;
+	c.M[0] = 0;
+	for(i = 1; i <= m; i++){
+		prow_swap(&p, &c);
+		c.M[0] = c.U[0] = c.J[0] = PROF_NEG;
+		c.L[0] = max32(p.L[0] + e, p.M[0] + o);
+		const int32_t *s = pf->rev + (size_t)pf->slot[(unsigned char)q->s[m-i]] * (pf->t.l + 1) + off;
+		// a reversed jump ends right before a junction site, never in column 1
+		prof_ml(&p, &c, s, pf->none, 1, n < 1 ? n : 1, o, e, PROF_NEG);
+		prof_ml(&p, &c, s, jp ? pf->gate + off : pf->none, 2, n, o, e, PROF_NEG);
+		prof_gap(c.U, c.M, pf->zero, n, o, e);
+		if(jp && i < m) prof_gap(c.J, c.M, pf->zero, n, jpen, 0);
+		else for(j = 1; j <= n; j++) c.J[j] = PROF_NEG;
+	}
+	for(j = 0; j <= n; j++){
+		if(c.M[j] >= max || (j < n && c.L[j] >= max)){
+			j_start = n - j;
+			break;
+		}
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS(m * n);
+	return j_start;
+}
+
+/*
+ * local_reverse() over the reversed profile; 0 and the extent
+ * (*di, *dj) of the alignment ending at (i_end, j_end) on success
+ */
+static int
+prof_local_reverse(const prof_t *pf, prof_ws_t *w, const kstring_t *q, long i_end, long j_end, int32_t max, long *di, long *dj){
+	const int32_t o = pf->opt->o, e = pf->opt->e;
+	const long n = j_end, off = pf->t.l - j_end;
+	long i, j;
+	int ret = -1;
+	prow_t p, c;
+	prof_rows(w, n, &p, &c);
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) c.M[j] = c.L[j] = c.U[j] = c.J[j] = PROF_NEG;
+	c.M[0] = 0;
+	for(i = 1; i <= i_end && ret != 0; i++){
+		prow_swap(&p, &c);
+		c.M[0] = c.U[0] = PROF_NEG;
+		c.L[0] = max32(p.L[0] + e, p.M[0] + o);
+		const int32_t *s = pf->rev + (size_t)pf->slot[(unsigned char)q->s[i_end-i]] * (pf->t.l + 1) + off;
+		if(prof_ml(&p, &c, s, pf->none, 1, n, o, e, PROF_NEG) >= max){
+			for(j = 1; c.M[j] < max; j++);
+			*di = i; *dj = j;
+			ret = 0;
+		}
+		prof_gap(c.U, c.M, pf->zero, n, o, e);
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS((i - 1) * n);
+	return ret;
+}
+
+/*
+ * empty r1/r2 for an alignment of n columns at most; the trace back
+ * functions replace the buffers with ones of the aligned length
+ */
+static void
+prof_result(kstring_t *r1, kstring_t *r2, size_t n){
+	free(r1->s);
+	free(r2->s);
+	r1->s = mycalloc(n + 1, char);
+	r2->s = mycalloc(n + 1, char);
+	r1->l = r2->l = 0;
+}
+
+/*
+ * fill and trace back q against t in the worker's matrices, as the
+ * full-matrix fit and local aligners do
+ */
+static double
+prof_trace(prof_ws_t *w, int mode, kstring_t *q, kstring_t *t, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	int i_max, j_max, state;
+	long i;
+	prof_result(r1, r2, q->l + t->l);
+	if(w->S == NULL || w->S->m < q->l + 1 || w->S->n < t->l + 1){
+		size_t m = q->l + 1, n = t->l + 1;
+		if(w->S != NULL){
+			if(w->S->m > m) m = w->S->m;
+			if(w->S->n > n) n = w->S->n;
+			destory_matrix(w->S);
+		}
+		w->S = create_matrix(m, n);
+	}
+	// kern_fill() leaves column 0 of the pointers to the fresh calloc
+	for(i = 1; i <= (long)q->l; i++)
+		w->S->pointerL[i][0] = w->S->pointerM[i][0] = w->S->pointerU[i][0] = w->S->pointerJ[i][0] = 0;
+	double score = kern_fill(q, t, opt, mode, w->S, &state, &i_max, &j_max);
+	STATS_BEGIN(STATS_TRACE);
+	if(mode == KMODE_FIT) trace_back_fit_affine_jump(w->S, q, t, r1, r2, state, i_max, j_max);
+	else trace_back_local_affine(w->S, q, t, r1, r2, i_max, j_max);
+	STATS_END(STATS_TRACE);
+	return score;
+}
+
+/*
+ * align q to the target: align_fit_twopass() / align_local_twopass()
+ */
+static double
+prof_align(const prof_t *pf, prof_ws_t *w, kstring_t *q, int32_t max, long i_end, long j_end, kstring_t *r1, kstring_t *r2){
+	kstring_t t = pf->t;
+	opt_t opt = *pf->opt;
+	size_t k;
+	if(pf->mode == KMODE_LOCAL){
+		long di, dj;
+		if(max <= 0){ // nothing aligns
+			prof_result(r1, r2, 0);
+			return max;
+		}
+		if(prof_local_reverse(pf, w, q, i_end, j_end, max, &di, &dj) == 0){
+			kstring_t sub1 = {di, di, q->s + i_end - di};
+			kstring_t sub2 = {dj, dj, t.s + j_end - dj};
+			double score = prof_trace(w, KMODE_LOCAL, &sub1, &sub2, r1, r2, &opt);
+			if(score == max) return score;
+		}
+	}else{
+		long j_start = max <= PROF_NEG / 2 ? -1 : prof_fit_reverse(pf, w, q, j_end, max);
+		if(j_start >= 0){
+			// the fit aligner wants s1 no longer than the target slice
+			size_t st = j_start, en = j_end;
+			if(en - st < q->l){
+				st = en > q->l ? en - q->l : 0;
+				if(st + q->l > en) en = st + q->l;
+			}
+			kstring_t sub = {en - st, en - st, t.s + st};
+			opt.sites.size = 0;
+			opt.sites.pos = mycalloc(pf->opt->sites.size + 1, int);
+			for(k = 0; k < pf->opt->sites.size; k++)
+				if(pf->opt->sites.pos[k] >= (int)st && pf->opt->sites.pos[k] < (int)en)
+					opt.sites.pos[opt.sites.size++] = pf->opt->sites.pos[k] - st;
+			double score = prof_trace(w, KMODE_FIT, q, &sub, r1, r2, &opt);
+			free(opt.sites.pos);
+			if(score == max) return score;
+			opt.sites = pf->opt->sites;
+		}
+	}
+	// the sub-rectangle did not reproduce the score
+	prof_result(r1, r2, q->l + t.l);
+	return plan_align(pf->mode, q, &t, r1, r2, &opt);
+}
+
+/*
+ * one read, written to r->out
+ */
+static void
+prof_read(const prof_t *pf, prof_ws_t *w, prof_read_t *r){
+	kstring_t *q = &r->s, r1 = {0, 0, 0}, r2 = {0, 0, 0};
+	long i_end, j_end, ri, rj;
+	char strand = '+';
+	r->out.l = 0;
+	if(pf->mode == KMODE_FIT && q->l > pf->t.l){
+		fprintf(stderr, "[%s] %s: longer than target %s, skipped\n", __func__, r->name, pf->name);
+		return;
+	}
+	kstring_t t = pf->t;
+	double score;
+	prof_result(&r1, &r2, q->l);
+	// an exact match on the forward strand cannot be beaten by the reverse one
+	bool exact = exact_align(pf->mode, q, &t, &r1, &r2, pf->opt, &score);
+	if(exact == false && pf->opt->b == true){
+		revcomp(q, &w->rc);
+		if((exact = exact_align(pf->mode, &w->rc, &t, &r1, &r2, pf->opt, &score)) == true){
+			q = &w->rc; strand = '-';
+		}
+	}
+	if(exact == false){
+		int32_t max = prof_forward_min(pf, w, q, &i_end, &j_end);
+		if(pf->opt->b == true){
+			int32_t rmax = prof_forward_min(pf, w, &w->rc, &ri, &rj);
+			if(rmax > max){
+				max = rmax; i_end = ri; j_end = rj;
+				q = &w->rc; strand = '-';
+			}
+		}
+		score = max < pf->opt->min_score ? -INFINITY : prof_align(pf, w, q, max, i_end, j_end, &r1, &r2);
+	}
+	if(score < pf->opt->min_score){
+		free(r1.s);
+		free(r2.s);
+		return;
+	}
+	if(pf->opt->b == true) ksprintf(&r->out, ">%s\t%s\t%c\n", r->name, pf->name, strand);
+	else ksprintf(&r->out, ">%s\t%s\n", r->name, pf->name);
+	ksprintf(&r->out, "score=%f\n%s\n%s\n", score, r1.s, r2.s);
+	free(r1.s);
+	free(r2.s);
+}
+
+static void
+*prof_worker(void *data){
+	prof_job_t *job = (prof_job_t*)data;
+	prof_ws_t w;
+	size_t i;
+	memset(&w, 0, sizeof(w));
+	while((i = __sync_fetch_and_add(&job->next, 1)) < job->n) prof_read(job->p, &w, &job->r[i]);
+	free(w.buf);
+	free(w.rc.s);
+	if(w.S) destory_matrix(w.S);
+	STATS_FOLD();
+	return NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/* profile                                                            */
+/*--------------------------------------------------------------------*/
+static void
+prof_init(prof_t *pf, const opt_t *opt, int mode){
+	const long n = pf->t.l;
+	long i, j, k;
+	pf->opt = opt;
+	pf->mode = mode;
+	STATS_BEGIN(STATS_ALLOC);
+	// slots in order of first appearance; the last one matches nothing
+	for(i = 0; i < PROF_SLOTS; i++) pf->slot[i] = PROF_SLOTS - 1;
+	for(j = 0, k = 0; j < n; j++){
+		unsigned char b = pf->t.s[j];
+		if(pf->slot[b] == PROF_SLOTS - 1 && k < PROF_SLOTS - 1) pf->slot[b] = k++;
+	}
+	pf->n_slot = k + 1;
+	for(i = 0; i < PROF_SLOTS; i++) if(pf->slot[i] == PROF_SLOTS - 1) pf->slot[i] = k;
+	pf->fwd = mycalloc((size_t)pf->n_slot * (n + 1), int32_t);
+	pf->rev = mycalloc((size_t)pf->n_slot * (n + 1), int32_t);
+	for(i = 0; i < pf->n_slot; i++){
+		int32_t *f = pf->fwd + i * (n + 1), *r = pf->rev + i * (n + 1);
+		for(j = 1; j <= n; j++) f[j] = pf->slot[(unsigned char)pf->t.s[j-1]] == i && i < k ? opt->m : opt->u;
+		r[0] = opt->u;
+		for(j = 1; j <= n; j++) r[j] = f[n + 1 - j];
+	}
+	pf->site = site_mask(opt, n);
+	// shifted by n - j_end, gate[j] opens column j of fit_reverse()
+	pf->gate = mycalloc(n + 2, int32_t);
+	pf->zero = mycalloc(n + 2, int32_t);
+	pf->fgate = mycalloc(n + 2, int32_t);
+	pf->none = mycalloc(n + 2, int32_t);
+	for(j = 0; j <= n + 1; j++){
+		pf->gate[j] = (j >= 1 && pf->site[n + 1 - j]) ? 0 : PROF_NEG;
+		pf->fgate[j] = (j >= 1 && j <= n && pf->site[j - 1]) ? 0 : PROF_NEG;
+		pf->none[j] = PROF_NEG;
+	}
+	if((pf->prune = prune_ok(mode, opt)) == true) qgram_build(&pf->qg, &pf->t);
+	STATS_END(STATS_ALLOC);
+}
+
+static void
+prof_destroy(prof_t *pf){
+	free(pf->fwd);
+	free(pf->rev);
+	free(pf->site);
+	free(pf->gate);
+	free(pf->fgate);
+	free(pf->zero);
+	free(pf->none);
+	if(pf->prune == true) qgram_free(&pf->qg);
+}
+
+/*
+ * align every read of fn against the first sequence of target_fn
+ * (mode KMODE_FIT or KMODE_LOCAL) on n_threads threads
+ */
+int
+prof_align_reads(const char *target_fn, const char *fn, opt_t *opt, int mode, int n_threads){
+	prof_t pf;
+	memset(&pf, 0, sizeof(pf));
+	if(opt->p == true) die("-q has no two-piece gap pass, drop -p");
+	STATS_BEGIN(STATS_PARSE);
+	gzFile fp = gzopen(target_fn, "r");
+	if(fp == NULL) die("Can't open %s\n", target_fn);
+	kseq_t *seq = kseq_init(fp);
+	if(kseq_read(seq) < 0) die("fail to read the target from %s\n", target_fn);
+	kputsn(seq->seq.s, seq->seq.l, &pf.t);
+	pf.name = strdup(seq->name.s);
+	if(opt->s == true){
+		if(seq->comment.s == NULL) die("fail to read junction sites");
+		junction_parse(seq->comment.s, &opt->sites);
+	}
+	kseq_destroy(seq);
+	gzclose(fp);
+	STATS_END(STATS_PARSE);
+	prof_init(&pf, opt, mode);
+	prof_pick();
+	kstring_t empty = {0, 0, 0};
+	revcomp(&empty, &empty); // fills the complement table before the threads use it
+	free(empty.s);
+
+	if((fp = gzopen(fn, "r")) == NULL) die("Can't open %s\n", fn);
+	seq = kseq_init(fp);
+	prof_read_t *r = mycalloc(PROF_CHUNK, prof_read_t);
+	pthread_t *tid = mycalloc(n_threads, pthread_t);
+	size_t n, i;
+	int t;
+	do{
+		STATS_BEGIN(STATS_PARSE);
+		for(n = 0; n < PROF_CHUNK && kseq_read(seq) >= 0; n++){
+			free(r[n].name);
+			r[n].name = strdup(seq->name.s);
+			r[n].s.l = 0;
+			kputsn(seq->seq.s, seq->seq.l, &r[n].s);
+		}
+		STATS_END(STATS_PARSE);
+		prof_job_t job = {&pf, r, n, 0};
+		if(n_threads <= 1){
+			prof_worker(&job);
+		}else{
+			for(t = 0; t < n_threads; t++)
+				if(pthread_create(&tid[t], NULL, prof_worker, &job) != 0) die("fail to start thread %d", t);
+			for(t = 0; t < n_threads; t++) pthread_join(tid[t], NULL);
+		}
+		STATS_BEGIN(STATS_OUTPUT);
+		for(i = 0; i < n; i++) if(r[i].out.l > 0) fwrite(r[i].out.s, 1, r[i].out.l, stdout);
+		STATS_END(STATS_OUTPUT);
+	}while(n == PROF_CHUNK);
+	for(i = 0; i < PROF_CHUNK; i++){
+		free(r[i].name);
+		free(r[i].s.s);
+		free(r[i].out.s);
+	}
+	free(r);
+	free(tid);
+	kseq_destroy(seq);
+	gzclose(fp);
+	prof_destroy(&pf);
+	free(pf.t.s);
+	free((char*)pf.name);
+	if(opt->sites.pos) free(opt->sites.pos);
+	opt->sites.pos = NULL; opt->sites.size = 0;
+	return 0;
+}
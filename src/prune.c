@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------*/
+/* prune.c 		                                                      */
+/* --min-score: drop global, fit and overlap alignments scoring less  */
+/* than a threshold without paying for their DP.                      */
+/*                                                                    */
+/* Two upper bounds on the optimal score are checked, both valid when */
+/* a match scores m > 0, more than a mismatch, and no gap or jump     */
+/* adds to the score (prune_ok()):                                    */
+/*                                                                    */
+/* q-gram   before any DP. Each mismatch and each deleted base of s1  */
+/*          breaks at most q of its q-grams, each insertion between   */
+/*          two of its bases at most q-1, so an alignment of the L    */
+/*          aligned bases of s1 with d of those has at least          */
+/*          L-q+1-qd q-grams of s1 found intact in s2. With C the     */
+/*          q-grams of s1 present in s2 anywhere, d >= (L-q+1-C)/q,   */
+/*          and each of them costs at least w (the cheapest of a      */
+/*          mismatch, a deleted base and an insertion) against m*L.   */
+/*          s2 is kept as a bitset of hashed q-grams; collisions only */
+/*          make C larger and the bound weaker, never wrong.          */
+/* row      during the score-only fill, kern_score_min() (kernel.c).  */
+/*                                                                    */
+/* plan_align() runs both before its engine, so a pair that fails     */
+/* costs O(m+n) or the rows filled until it did, and one that passes  */
+/* a score-only pass more than without --min-score; fit -q checks     */
+/* each read against a bitset of the target built once (prof.c).      */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include "alignment.h"
+
+#define QGRAM_MIN               4
+#define QGRAM_MAX               16
+
+/*
+ * whether both bounds hold for the mode and scoring
+ */
+bool
+prune_ok(int mode, const opt_t *opt){
+	if(opt->min_score == -INFINITY || mode == KMODE_LOCAL) return false;
+	if(mode != KMODE_GLOBAL && mode != KMODE_FIT && mode != KMODE_OVERLAP) return false;
+	if(opt->m <= 0 || opt->u >= opt->m || opt->o > 0) return false;
+	if(mode == KMODE_OVERLAP) return true; // linear gaps of o per base
+	if(opt->e > 0) return false;
+	if(mode == KMODE_FIT && opt->s == true && opt->j > 0) return false;
+	if(mode == KMODE_FIT && opt->p == true && (opt->o2 > 0 || opt->e2 > 0)) return false;
+	return true;
+}
+
+static inline uint64_t
+qgram_slot(const qgram_t *g, uint64_t h){
+	return (h * 0x9E3779B97F4A7C15ULL) >> (64 - g->bits);
+}
+
+/*
+ * q-grams of t: q grows with t so that random q-grams rarely hit
+ */
+void
+qgram_build(qgram_t *g, const kstring_t *t){
+	size_t i;
+	uint64_t h = 0, top = 1;
+	for(g->q = QGRAM_MIN; g->q < QGRAM_MAX && (1ULL << (2 * g->q)) < 4 * (uint64_t)t->l; g->q++);
+	for(g->bits = 10; g->bits < 28 && (1ULL << g->bits) < 8 * (uint64_t)t->l; g->bits++);
+	g->set = mycalloc(((size_t)1 << g->bits) / 64, uint64_t);
+	for(i = 1; i < (size_t)g->q; i++) top *= 257;
+	for(i = 0; i < t->l; i++){
+		if(i >= (size_t)g->q) h -= (unsigned char)t->s[i - g->q] * top;
+		h = h * 257 + (unsigned char)t->s[i];
+		if(i + 1 >= (size_t)g->q){
+			uint64_t k = qgram_slot(g, h);
+			g->set[k >> 6] |= 1ULL << (k & 63);
+		}
+	}
+}
+
+void
+qgram_free(qgram_t *g){
+	free(g->set);
+	g->set = NULL;
+}
+
+/*
+ * q-grams of s in g
+ */
+static size_t
+qgram_count(const qgram_t *g, const kstring_t *s){
+	size_t i, c = 0;
+	uint64_t h = 0, top = 1;
+	for(i = 1; i < (size_t)g->q; i++) top *= 257;
+	for(i = 0; i < s->l; i++){
+		if(i >= (size_t)g->q) h -= (unsigned char)s->s[i - g->q] * top;
+		h = h * 257 + (unsigned char)s->s[i];
+		if(i + 1 >= (size_t)g->q){
+			uint64_t k = qgram_slot(g, h);
+			if(g->set[k >> 6] >> (k & 63) & 1) c++;
+		}
+	}
+	return c;
+}
+
+/*
+ * best score of L aligned bases of s1 with C of its q-grams in s2
+ */
+static inline double
+qgram_score(const qgram_t *g, double w, long L, long C, const opt_t *opt){
+	long d = L - g->q + 1 - C;
+	d = d > 0 ? (d + g->q - 1) / g->q : 0;
+	return (double)opt->m * L - w * d;
+}
+
+/*
+ * upper bound on the score of s1 against the target of g
+ */
+double
+qgram_bound(const qgram_t *g, int mode, const kstring_t *s1, size_t n, const opt_t *opt){
+	const long m = s1->l, C = qgram_count(g, s1);
+	double del = (mode == KMODE_OVERLAP || opt->o > opt->e) ? opt->o : opt->e, ins = opt->o, w;
+	if(mode == KMODE_FIT && opt->p == true){
+		if(opt->o2 > del) del = opt->o2;
+		if(opt->e2 > del) del = opt->e2;
+		if(opt->o2 > ins) ins = opt->o2;
+	}
+	if(mode == KMODE_FIT && opt->s == true && opt->j > ins) ins = opt->j;
+	w = opt->m - opt->u;
+	if(opt->m - del < w) w = opt->m - del;
+	if(-ins < w) w = -ins;
+	if(mode != KMODE_OVERLAP) return qgram_score(g, w, m, C, opt);
+	// overlap aligns a suffix of s1 of any length L <= min(m, n-1): the
+	// bound is m*L up to L0 = C+q-1, then at most linear in L, so its
+	// maximum is at L0 or, without rounding d up, at the longest L
+	long L = (long)n - 1 < m ? (long)n - 1 : m, L0 = C + g->q - 1 < L ? C + g->q - 1 : L;
+	if(L <= 0) return 0;
+	double a = (double)opt->m * L - w * (L - L0) / g->q, b = qgram_score(g, w, L0, C, opt);
+	return a > b ? a : b;
+}
+
+/*
+ * qgram_bound() for a single pair
+ */
+double
+prune_qgram(int mode, const kstring_t *s1, const kstring_t *s2, const opt_t *opt){
+	qgram_t g;
+	qgram_build(&g, s2);
+	double b = qgram_bound(&g, mode, s1, s2->l, opt);
+	qgram_free(&g);
+	return b;
+}
@@ -0,0 +1,377 @@
+/*--------------------------------------------------------------------*/
+/* search.c 		                                                      */
+/* Approximate search: every occurrence of short queries (primers,    */
+/* barcodes) with at most k edits in a long, possibly gzipped, text.  */
+/*                                                                    */
+/* The text is streamed through a semi-global Myers matcher           */
+/* (myers.c): the top row is D(0,j) = 0, so a match may start at any  */
+/* text position and D(m,j) is the fewest edits of the query against  */
+/* a substring ending at j. A column costs a few word operations per  */
+/* 64 query bases; each line of text is run through one query after   */
+/* the other, its last block kept in registers.                       */
+/*                                                                    */
+/* The ends with D(m,j) <= k come in runs around each occurrence;     */
+/* by default only the first end of the lowest plateau of a run is    */
+/* reported (one more every m bases of a flat run, as in tandem       */
+/* repeats), -a reports all of them. Each reported end is traced back */
+/* over the m+D text bases before it, the longest an alignment of D   */
+/* edits can span, which also gives its start. The last line and the  */
+/* 2m+k+1 bases before it are kept in a ring, so memory does not      */
+/* depend on the text, which is read a buffer at a time and never as  */
+/* a whole record.                                                    */
+/*                                                                    */
+/* Matching is case-insensitive. IUPAC codes in a query (N, R, Y...)  */
+/* match any of their bases; in the text anything but A, C, G, T or U */
+/* matches nothing. Hits are printed as                               */
+/* query target begin end edits query-row text-row [strand]           */
+/* with 0-based, end-exclusive coordinates on the target.             */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <ctype.h>
+#include "alignment.h"
+
+#define SEARCH_BUF              (1 << 16)   // bytes of text read at a time
+#define SEARCH_K                2
+#define SEARCH_DIAG             0
+#define SEARCH_UP               1           // a query base against a gap
+#define SEARCH_LEFT             2           // a text base against a gap
+
+typedef struct {
+	char *name;
+	kstring_t s;         // as searched, reverse complemented for '-'
+	char strand;
+	size_t B;            // 64-row blocks
+	uint64_t *peq;       // [text class][block]
+	uint64_t *pv, *mv;
+	uint64_t high;       // row m in the last block
+	long score;          // D(m,j) of the last column
+	long pd, cand, cv;   // previous D, pending end and its D
+	bool open;           // cand is a hit not reported yet
+} sq_t;
+
+typedef struct {
+	long k;
+	bool all, both;
+	sq_t *q;
+	size_t n;
+	unsigned char *ring; // the last mask+1 text bases
+	size_t mask;
+	long pos;            // bases of the current record so far
+	kstring_t tname;
+	unsigned char *tb;   // traceback, (m+1) x (m+k+1)
+	int *row[2];
+	kstring_t r1, r2;
+} search_t;
+
+static unsigned char search_tcls[256], search_qbit[256], search_comp[256];
+
+/*
+ * text classes 1-4 for A, C, G, T/U, and the bases each query code stands for
+ */
+static void
+search_tables(void){
+	static const char *code = "ACGTURYSWKMBDHVN", *comp = "TGCAAYRSWMKVHDBN";
+	static const unsigned char bit[] = {1, 2, 4, 8, 8, 5, 10, 6, 9, 12, 3, 14, 13, 11, 7, 15};
+	int i;
+	for(i = 0; i < 256; i++) search_comp[i] = i;
+	for(i = 0; code[i]; i++){
+		unsigned char u = code[i], l = tolower(u);
+		search_qbit[u] = search_qbit[l] = bit[i];
+		search_comp[u] = comp[i]; search_comp[l] = tolower(comp[i]);
+		if(i < 5) search_tcls[u] = search_tcls[l] = i < 4 ? i + 1 : 4;
+	}
+}
+
+static inline bool
+search_match(unsigned char qc, unsigned char tc){
+	return search_tcls[tc] != 0 && (search_qbit[qc] >> (search_tcls[tc] - 1) & 1) ? true : false;
+}
+
+static void
+search_reset(sq_t *q){
+	size_t b;
+	for(b = 0; b < q->B; b++){ q->pv[b] = ~(uint64_t)0; q->mv[b] = 0; } // D(i,0) = i
+	q->score = q->s.l;
+	q->pd = LONG_MAX;
+	q->open = false;
+}
+
+static void
+search_query(sq_t *q, const char *name, const char *s, size_t l, char strand){
+	size_t i, c;
+	q->name = strdup(name);
+	q->strand = strand;
+	kputsn(s, l, &q->s);
+	if(strand == '-'){
+		for(i = 0; i < l; i++) q->s.s[i] = search_comp[(unsigned char)s[l - 1 - i]];
+	}
+	q->B = (l + MYERS_W - 1) / MYERS_W;
+	q->high = (uint64_t)1 << ((l - 1) % MYERS_W);
+	q->peq = mycalloc(5 * q->B, uint64_t);
+	q->pv = mycalloc(q->B, uint64_t);
+	q->mv = mycalloc(q->B, uint64_t);
+	for(i = 0; i < l; i++){
+		unsigned char qc = q->s.s[i];
+		for(c = 1; c <= 4; c++)
+			if(search_qbit[qc] >> (c - 1) & 1) q->peq[c * q->B + i / MYERS_W] |= (uint64_t)1 << (i % MYERS_W);
+	}
+	search_reset(q);
+}
+
+static void
+search_reverse(kstring_t *r){
+	size_t i;
+	for(i = 0; i < r->l / 2; i++){
+		char t = r->s[i];
+		r->s[i] = r->s[r->l - 1 - i];
+		r->s[r->l - 1 - i] = t;
+	}
+}
+
+/*
+ * trace back the alignment of q ending at text base end with d edits
+ * and print it
+ */
+static void
+search_hit(search_t *S, const sq_t *q, long end, long d){
+	const long m = q->s.l, W = m + d < end + 1 ? m + d : end + 1, t0 = end - W + 1;
+	int *p = S->row[0], *c = S->row[1], *t;
+	long i, j;
+	STATS_BEGIN(STATS_TRACE);
+	for(j = 0; j <= W; j++) p[j] = 0; // free start
+	for(i = 1; i <= m; i++){
+		const unsigned char qc = q->s.s[i-1];
+		unsigned char *tb = S->tb + i * (W + 1);
+		c[0] = i; tb[0] = SEARCH_UP;
+		for(j = 1; j <= W; j++){
+			int x = p[j-1] + (search_match(qc, S->ring[(t0 + j - 1) & S->mask]) == true ? 0 : 1), s = SEARCH_DIAG;
+			if(p[j] + 1 < x){ x = p[j] + 1; s = SEARCH_UP; }
+			if(c[j-1] + 1 < x){ x = c[j-1] + 1; s = SEARCH_LEFT; }
+			c[j] = x; tb[j] = s;
+		}
+		t = p; p = c; c = t;
+	}
+	S->r1.l = S->r2.l = 0;
+	for(i = m, j = W; i > 0;){
+		int s = S->tb[i * (W + 1) + j];
+		kputc(s == SEARCH_LEFT ? '-' : q->s.s[i-1], &S->r1);
+		kputc(s == SEARCH_UP ? '-' : S->ring[(t0 + j - 1) & S->mask], &S->r2);
+		if(s != SEARCH_LEFT) i--;
+		if(s != SEARCH_UP) j--;
+	}
+	search_reverse(&S->r1);
+	search_reverse(&S->r2);
+	STATS_END(STATS_TRACE);
+	STATS_BEGIN(STATS_OUTPUT);
+	printf("%s\t%s\t%ld\t%ld\t%d\t%s\t%s", q->name, S->tname.s, t0 + j, end + 1, p[W], S->r1.s, S->r2.s);
+	if(S->both == true) printf("\t%c", q->strand);
+	putchar('\n');
+	STATS_END(STATS_OUTPUT);
+}
+
+/*
+ * the end pos of q with D edits; q->pd is the D of the end before
+ */
+static void
+search_track(search_t *S, sq_t *q, long pos, long D){
+	if(S->all == true){
+		if(D <= S->k) search_hit(S, q, pos, D);
+	}else if(D < q->pd){
+		q->cand = pos; q->cv = D;
+		q->open = D <= S->k ? true : false;
+	}else if(D > q->pd){
+		if(q->open == true) search_hit(S, q, q->cand, q->cv);
+		q->open = false;
+	}else if(q->open == true && pos - q->cand >= (long)q->s.l){
+		search_hit(S, q, q->cand, q->cv);
+		q->cand = pos;
+	}
+	q->pd = D;
+}
+
+/*
+ * the next l text bases through q; its last block stays in registers
+ */
+static void
+search_run(search_t *S, sq_t *q, const unsigned char *t, long l){
+	const size_t B = q->B;
+	const uint64_t *peq = q->peq, high = q->high;
+	const long k = S->k;
+	uint64_t pv = q->pv[B-1], mv = q->mv[B-1];
+	long D = q->score, pd = q->pd, j;
+	size_t b;
+	for(j = 0; j < l; j++){
+		const uint64_t *eq = peq + search_tcls[t[j]] * B;
+		int h = 0; // D(0,j) = 0
+		for(b = 0; b + 1 < B; b++) h = myers_block(&q->pv[b], &q->mv[b], eq[b], h, MYERS_HIGH);
+		D += myers_block(&pv, &mv, eq[B-1], h, high);
+		if(D > k && q->open == false){ // nearly every column: nothing to track
+			pd = D;
+			continue;
+		}
+		q->pd = pd;
+		search_track(S, q, S->pos + j, D);
+		pd = D;
+	}
+	q->pv[B-1] = pv; q->mv[B-1] = mv;
+	q->score = D; q->pd = pd;
+}
+
+/*
+ * the next l text bases through every query
+ */
+static void
+search_span(search_t *S, const unsigned char *t, long l){
+	long j;
+	size_t i;
+	for(j = 0; j < l; j++) S->ring[(S->pos + j) & S->mask] = t[j];
+	for(i = 0; i < S->n; i++) search_run(S, &S->q[i], t, l);
+	S->pos += l;
+}
+
+/*
+ * report what is pending at the end of a record and start over
+ */
+static void
+search_flush(search_t *S){
+	size_t i;
+	for(i = 0; i < S->n; i++){
+		if(S->q[i].open == true) search_hit(S, &S->q[i], S->q[i].cand, S->q[i].cv);
+		STATS_CELLS((uint64_t)S->pos * S->q[i].s.l);
+		search_reset(&S->q[i]);
+	}
+	S->pos = 0;
+}
+
+/*
+ * stream the fasta records of fn through the queries
+ */
+static void
+search_text(search_t *S, const char *fn){
+	enum { SEQ, NAME, SKIP } state = SEQ;
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	unsigned char *buf = mycalloc(SEARCH_BUF, unsigned char), *e;
+	bool bol = true; // at the start of a line
+	int l, i;
+	kputs("", &S->tname);
+	while(1){
+		STATS_BEGIN(STATS_PARSE);
+		l = gzread(fp, buf, SEARCH_BUF);
+		STATS_END(STATS_PARSE);
+		if(l < 0) die("fail to read %s\n", fn);
+		if(l == 0) break;
+		STATS_BEGIN(STATS_FILL);
+		for(i = 0; i < l;){
+			if(state == NAME){
+				if(isspace(buf[i])) state = buf[i] == '\n' ? SEQ : SKIP;
+				else kputc(buf[i], &S->tname);
+				bol = buf[i++] == '\n' ? true : false;
+			}else if(state == SKIP){
+				if((e = memchr(buf + i, '\n', l - i)) == NULL){ i = l; continue; }
+				i = e - buf + 1;
+				state = SEQ; bol = true;
+			}else if(bol == true && buf[i] == '>'){
+				search_flush(S);
+				S->tname.l = 0; S->tname.s[0] = '\0';
+				state = NAME; i++;
+			}else{
+				int end = (e = memchr(buf + i, '\n', l - i)) == NULL ? l : e - buf;
+				int w = i, x;
+				for(x = i; x < end; x++) if(buf[x] > ' ') buf[w++] = buf[x]; // drop \r and blanks
+				search_span(S, buf + i, w - i);
+				i = end;
+				if(e != NULL){ i++; bol = true; }
+				else bol = false;
+			}
+		}
+		STATS_END(STATS_FILL);
+	}
+	search_flush(S);
+	free(buf);
+	gzclose(fp);
+}
+
+/*
+ * the queries of fn, and their reverse complements with -b
+ */
+static void
+search_load(search_t *S, const char *fn){
+	gzFile fp = gzopen(fn, "r");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	kseq_t *seq = kseq_init(fp);
+	size_t cap = 0, m = 0;
+	while(kseq_read(seq) >= 0){
+		if(seq->seq.l == 0){
+			fprintf(stderr, "[%s] query '%s' is empty, skipped\n", __func__, seq->name.s);
+			continue;
+		}
+		if((long)seq->seq.l <= S->k) fprintf(stderr, "[%s] query '%s' is not longer than -k, every base is a hit\n", __func__, seq->name.s);
+		if(S->n + 2 > cap){
+			cap = cap ? cap * 2 : 16;
+			S->q = realloc(S->q, cap * sizeof(sq_t));
+			if(S->q == NULL) die("search_load: fail to allocate %zu queries\n", cap);
+		}
+		memset(S->q + S->n, 0, 2 * sizeof(sq_t));
+		search_query(&S->q[S->n++], seq->name.s, seq->seq.s, seq->seq.l, '+');
+		if(S->both == true) search_query(&S->q[S->n++], seq->name.s, seq->seq.s, seq->seq.l, '-');
+		if(seq->seq.l > m) m = seq->seq.l;
+	}
+	kseq_destroy(seq);
+	gzclose(fp);
+	if(S->n == 0) die("no query in %s\n", fn);
+	// a hit is traced back at most m bases after its end, over m+k bases,
+	// and a span of up to SEARCH_BUF bases is stored before it is run
+	for(S->mask = 1; S->mask < SEARCH_BUF + 2 * m + S->k + 1; S->mask <<= 1);
+	S->ring = mycalloc(S->mask, unsigned char);
+	S->mask--;
+	S->tb = mycalloc((m + 1) * (m + S->k + 1), unsigned char);
+	S->row[0] = mycalloc(m + S->k + 1, int);
+	S->row[1] = mycalloc(m + S->k + 1, int);
+}
+
+static void
+search_destroy(search_t *S){
+	size_t i;
+	for(i = 0; i < S->n; i++){
+		free(S->q[i].name); free(S->q[i].s.s);
+		free(S->q[i].peq); free(S->q[i].pv); free(S->q[i].mv);
+	}
+	free(S->q); free(S->ring); free(S->tb);
+	free(S->row[0]); free(S->row[1]);
+	free(S->tname.s); free(S->r1.s); free(S->r2.s);
+}
+
+int
+main_search(int argc, char *argv[]){
+	search_t S;
+	int c;
+	memset(&S, 0, sizeof(search_t));
+	S.k = SEARCH_K; S.all = false; S.both = false;
+	while ((c = getopt_long(argc, argv, "k:ab", plan_long_opts, NULL)) >= 0) {
+			switch (c) {
+			case 'k': S.k = atol(optarg); break;
+			case 'a': S.all = true; break;
+			case 'b': S.both = true; break;
+			case 'M': case PLAN_OPT_MIN_SCORE: die("--max-mem and --min-score are not options of search\n");
+			default: return 1;
+		}
+	}
+	if (optind + 2 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools search [options] <queries.fa> <text.fa[.gz]>\n\n");
+				fprintf(stderr, "Options: -k INT   most edits of a hit [%d]\n", SEARCH_K);
+				fprintf(stderr, "         -a       report every end of a hit, not only the best of each run\n");
+				fprintf(stderr, "         -b       also search the reverse complement of the queries (--both-strands)\n");
+				fprintf(stderr, "\n");
+				fprintf(stderr, "Output:  query target begin end edits query-row text-row [strand], 0-based, end-exclusive\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	if(S.k < 0) die("-k must be at least 0\n");
+	search_tables();
+	search_load(&S, argv[optind]);
+	search_text(&S, argv[optind+1]);
+	search_destroy(&S);
+	return 0;
+}
@@ -0,0 +1,425 @@
+/*--------------------------------------------------------------------*/
+/* serve.c 		                                                      */
+/* Alignment server on a Unix domain socket.                          */
+/*                                                                    */
+/* For short pairs, process start-up and argument parsing cost more   */
+/* than the DP; `alignTools serve` pays them once. Each request is    */
+/* one line of tab-separated fields, answered by one line, in order,  */
+/* so a client may pipeline any number of them on a connection; the   */
+/* last one may end at the end of the input instead of a newline:     */
+/*                                                                    */
+/* request  MODE s1 s2 [KEY=VALUE ...]                                */
+/*          MODE global, local, fit, overlap or edit; KEY m, u, o, e  */
+/*          (scoring, default the server's) or tb (0: score only)     */
+/* reply    ok score b1 e1 b2 e2 CIGAR                                */
+/*          ok score                   (tb=0, edit)                   */
+/*          err message                                               */
+/*                                                                    */
+/* b1-e1 and b2-e2 are the aligned parts of s1 and s2 (0-based, end-  */
+/* exclusive); the CIGAR has =, X, I (s1 only) and D (s2 only). When  */
+/* an aligned part occurs more than once, the first occurrence is     */
+/* reported; it aligns with the same score.                           */
+/*                                                                    */
+/* A request no engine can run (fit with s1 longer than s2, a gap     */
+/* penalty above 0, over the budget) gets an err reply.               */
+/*                                                                    */
+/* The main thread accepts connections and queues them; -T workers    */
+/* take one connection at a time and keep their buffers (input,       */
+/* replies, aligned rows) across requests and connections. Replies to */
+/* all the requests of one read() go out in one write(). Alignments   */
+/* run through the planner (plan.c) as in the align commands.         */
+/*                                                                    */
+/* An open connection holds its worker, so clients should not hold    */
+/* more connections than there are workers. On SIGINT or SIGTERM the  */
+/* server stops accepting, answers the requests already received, and */
+/* removes the socket.                                                */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "alignment.h"
+
+#define SERVE_BUF               65536           // bytes read at a time
+#define SERVE_MAX_LINE          (256 << 20)     // longest request
+#define SERVE_QUEUE             256             // connections waiting for a worker
+#define SERVE_MAX_FIELDS        16
+
+typedef struct {
+	int fd[SERVE_QUEUE];
+	int head, n;
+	pthread_mutex_t lock;
+	pthread_cond_t more, room;
+	int stop;              // no more connections; idle workers return
+	int *busy;             // each worker's connection, or -1
+	int n_workers;
+	const opt_t *opt;      // default scoring
+} serve_t;
+
+// a worker's buffers, kept across requests
+typedef struct {
+	kstring_t in, out;
+	kstring_t r1, r2;
+	kstring_t u;           // an aligned row without its gaps
+	size_t cap;            // bytes of r1.s and r2.s
+} serve_ws_t;
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void
+serve_signal(int sig){
+	(void)sig;
+	serve_stop = 1;
+}
+
+static void
+serve_push(serve_t *sv, int fd){
+	pthread_mutex_lock(&sv->lock);
+	while(sv->n == SERVE_QUEUE) pthread_cond_wait(&sv->room, &sv->lock);
+	sv->fd[(sv->head + sv->n++) % SERVE_QUEUE] = fd;
+	pthread_cond_signal(&sv->more);
+	pthread_mutex_unlock(&sv->lock);
+}
+
+/*
+ * the next connection for worker id, or -1 once the server stops
+ */
+static int
+serve_pop(serve_t *sv, int id){
+	int fd = -1;
+	pthread_mutex_lock(&sv->lock);
+	sv->busy[id] = -1;
+	while(sv->n == 0 && sv->stop == 0) pthread_cond_wait(&sv->more, &sv->lock);
+	if(sv->n > 0){
+		fd = sv->fd[sv->head];
+		sv->head = (sv->head + 1) % SERVE_QUEUE;
+		sv->n--;
+		sv->busy[id] = fd;
+		if(sv->stop) shutdown(fd, SHUT_RD); // queued before the stop: answer what it sent
+		pthread_cond_signal(&sv->room);
+	}
+	pthread_mutex_unlock(&sv->lock);
+	return fd;
+}
+
+/*
+ * let the workers finish the requests they have read, then return
+ */
+static void
+serve_drain(serve_t *sv){
+	int i;
+	pthread_mutex_lock(&sv->lock);
+	sv->stop = 1;
+	for(i = 0; i < sv->n_workers; i++)
+		if(sv->busy[i] >= 0) shutdown(sv->busy[i], SHUT_RD); // the next read() returns 0
+	pthread_cond_broadcast(&sv->more);
+	pthread_mutex_unlock(&sv->lock);
+}
+
+/*
+ * offset of the gapless row r in s, searched from s itself
+ */
+static long
+serve_find(serve_ws_t *w, const kstring_t *s, const kstring_t *r){
+	size_t i;
+	int *prep = NULL;
+	w->u.l = 0;
+	for(i = 0; i < r->l; i++) if(r->s[i] != '-') kputc(r->s[i], &w->u);
+	if(w->u.l == 0) return 0;
+	const char *p = kmemmem(s->s, s->l, w->u.s, w->u.l, &prep);
+	free(prep);
+	return p == NULL ? 0 : p - s->s;
+}
+
+static size_t
+serve_bases(const kstring_t *r){
+	size_t i, n = 0;
+	for(i = 0; i < r->l; i++) if(r->s[i] != '-') n++;
+	return n;
+}
+
+static void
+serve_cigar(const kstring_t *r1, const kstring_t *r2, kstring_t *out){
+	size_t i, n = 0;
+	char op = 0, c;
+	for(i = 0; i <= r1->l; i++){
+		if(i == r1->l) c = 0;
+		else if(r1->s[i] == '-') c = 'D';
+		else if(r2->s[i] == '-') c = 'I';
+		else c = r1->s[i] == r2->s[i] ? '=' : 'X';
+		if(c != op && n > 0){ ksprintf(out, "%zu%c", n, op); n = 0; }
+		op = c; n++;
+	}
+}
+
+/*
+ * drop gap columns at either end of a local alignment, which the local
+ * traceback may leave and which do not count in its score
+ */
+static void
+serve_trim(serve_ws_t *w){
+	size_t b = 0, e = w->r1.l;
+	while(b < e && (w->r1.s[b] == '-' || w->r2.s[b] == '-')) b++;
+	while(e > b && (w->r1.s[e-1] == '-' || w->r2.s[e-1] == '-')) e--;
+	memmove(w->r1.s, w->r1.s + b, e - b);
+	memmove(w->r2.s, w->r2.s + b, e - b);
+	w->r1.l = w->r2.l = e - b;
+	w->r1.s[e - b] = w->r2.s[e - b] = '\0';
+}
+
+static void
+serve_error(kstring_t *out, const char *msg){
+	ksprintf(out, "err\t%s\n", msg);
+}
+
+/*
+ * one request line (without its newline), the reply appended to w->out
+ */
+static void
+serve_request(serve_t *sv, serve_ws_t *w, char *line){
+	char *f[SERVE_MAX_FIELDS], *end;
+	int n = 0, i, mode;
+	bool tb = true;
+	opt_t opt = *sv->opt;
+	f[n++] = line;
+	for(; *line; line++)
+		if(*line == '\t'){
+			if(n == SERVE_MAX_FIELDS){ serve_error(&w->out, "too many fields"); return; }
+			*line = '\0'; f[n++] = line + 1;
+		}
+	if(n < 3){ serve_error(&w->out, "expected MODE s1 s2"); return; }
+	if(strcmp(f[0], "global") == 0) mode = KMODE_GLOBAL;
+	else if(strcmp(f[0], "local") == 0) mode = KMODE_LOCAL;
+	else if(strcmp(f[0], "fit") == 0) mode = KMODE_FIT;
+	else if(strcmp(f[0], "overlap") == 0) mode = KMODE_OVERLAP;
+	else if(strcmp(f[0], "edit") == 0){ mode = KMODE_EDIT; opt.u = 1; }
+	else{ serve_error(&w->out, "unknown mode"); return; }
+	for(i = 3; i < n; i++){
+		char *v = strchr(f[i], '=');
+		long x;
+		if(v == NULL || v[1] == '\0'){ serve_error(&w->out, "expected KEY=VALUE"); return; }
+		*v++ = '\0';
+		x = strtol(v, &end, 10);
+		if(*end != '\0' || x < INT_MIN / 4 || x > INT_MAX / 4){ serve_error(&w->out, "bad value"); return; }
+		if(strcmp(f[i], "m") == 0) opt.m = x;
+		else if(strcmp(f[i], "u") == 0) opt.u = x;
+		else if(strcmp(f[i], "o") == 0) opt.o = x;
+		else if(strcmp(f[i], "e") == 0) opt.e = x;
+		else if(strcmp(f[i], "tb") == 0) tb = x == 0 ? false : true;
+		else{ serve_error(&w->out, "unknown key"); return; }
+	}
+	kstring_t s1 = {strlen(f[1]), 0, f[1]}, s2 = {strlen(f[2]), 0, f[2]};
+	if(s1.l == 0 || s2.l == 0){ serve_error(&w->out, "empty sequence"); return; }
+	// an engine die()s on these, and the planner over the budget, which
+	// would end the server
+	if(mode == KMODE_FIT && s1.l > s2.l){ serve_error(&w->out, "fit needs |s1| <= |s2|"); return; }
+	if(mode != KMODE_EDIT && (opt.o > 0 || opt.e > 0)){ serve_error(&w->out, "gap penalties must be <= 0"); return; }
+	plan_t pl;
+	plan_pick(mode, s1.l, s2.l, &opt, mode == KMODE_EDIT ? false : tb, &pl);
+	if(pl.engine < 0){ serve_error(&w->out, "over the memory budget"); return; }
+	if(mode == KMODE_EDIT){
+		ksprintf(&w->out, "ok\t%d\n", edit_plan(&s1, &s2, &opt));
+		return;
+	}
+	if(tb == false){
+		ksprintf(&w->out, "ok\t%.0f\n", plan_align(mode, &s1, &s2, NULL, NULL, &opt));
+		return;
+	}
+	// engines write up to |s1|+|s2| bases into zeroed rows
+	const size_t need = s1.l + s2.l + 1;
+	if(w->cap < need){
+		w->cap = need;
+		w->r1.s = realloc(w->r1.s, need);
+		w->r2.s = realloc(w->r2.s, need);
+		if(w->r1.s == NULL || w->r2.s == NULL) die("serve_request: fail to allocate %zu bytes\n", need);
+	}
+	memset(w->r1.s, 0, need); memset(w->r2.s, 0, need);
+	w->r1.l = w->r2.l = 0;
+	double score = plan_align(mode, &s1, &s2, &w->r1, &w->r2, &opt);
+	w->cap = (w->r1.l < w->r2.l ? w->r1.l : w->r2.l) + 1; // strrev() may have reallocated them to that
+	if(mode == KMODE_LOCAL) serve_trim(w);
+	size_t l1 = serve_bases(&w->r1), l2 = serve_bases(&w->r2), b1, b2;
+	if(mode == KMODE_GLOBAL){ b1 = 0; b2 = 0; }
+	else if(mode == KMODE_OVERLAP){ b1 = s1.l - l1; b2 = 0; }
+	else if(mode == KMODE_FIT){ b1 = 0; b2 = serve_find(w, &s2, &w->r2); }
+	else{ b1 = serve_find(w, &s1, &w->r1); b2 = serve_find(w, &s2, &w->r2); }
+	ksprintf(&w->out, "ok\t%.0f\t%zu\t%zu\t%zu\t%zu\t", score, b1, b1 + l1, b2, b2 + l2);
+	serve_cigar(&w->r1, &w->r2, &w->out);
+	kputc('\n', &w->out);
+}
+
+static bool
+serve_write(int fd, const char *s, size_t l){
+	while(l > 0){
+		ssize_t k = write(fd, s, l);
+		if(k < 0 && errno == EINTR) continue;
+		if(k <= 0) return false;
+		s += k; l -= k;
+	}
+	return true;
+}
+
+/*
+ * requests of one connection until the client closes it
+ */
+static void
+serve_conn(serve_t *sv, serve_ws_t *w, int fd){
+	size_t done, scan = 0;
+	char *nl;
+	w->in.l = 0;
+	while(1){
+		if(w->in.m < w->in.l + SERVE_BUF + 1){
+			w->in.m = w->in.l + SERVE_BUF + 1;
+			kroundup32(w->in.m);
+			if((w->in.s = realloc(w->in.s, w->in.m)) == NULL) die("serve_conn: fail to allocate %zu bytes\n", w->in.m);
+		}
+		ssize_t k = read(fd, w->in.s + w->in.l, SERVE_BUF);
+		if(k < 0 && errno == EINTR) continue;
+		if(k == 0 && w->in.l > 0){
+			// the client closed after a last request without its newline
+			w->in.s[w->in.l] = '\0';
+			if(w->in.s[w->in.l - 1] == '\r') w->in.s[w->in.l - 1] = '\0';
+			w->out.l = 0;
+			serve_request(sv, w, w->in.s);
+			serve_write(fd, w->out.s, w->out.l);
+			break;
+		}
+		if(k <= 0) break;
+		w->in.l += k;
+		w->in.s[w->in.l] = '\0';
+		done = 0;
+		w->out.l = 0;
+		while((nl = memchr(w->in.s + scan, '\n', w->in.l - scan)) != NULL){
+			*nl = '\0';
+			if(nl > w->in.s + done && nl[-1] == '\r') nl[-1] = '\0';
+			serve_request(sv, w, w->in.s + done);
+			done = scan = nl - w->in.s + 1;
+		}
+		scan = w->in.l - done;
+		if(done > 0) memmove(w->in.s, w->in.s + done, scan);
+		w->in.l = scan;
+		if(w->in.l > SERVE_MAX_LINE){
+			serve_error(&w->out, "request too long");
+			serve_write(fd, w->out.s, w->out.l);
+			break;
+		}
+		if(w->out.l > 0 && serve_write(fd, w->out.s, w->out.l) == false) break;
+	}
+	close(fd);
+}
+
+static void
+*serve_worker(void *data){
+	serve_t *sv = (serve_t*)data;
+	serve_ws_t w;
+	int fd, id = __sync_fetch_and_add(&sv->n_workers, 1);
+	memset(&w, 0, sizeof(w));
+	while((fd = serve_pop(sv, id)) >= 0) serve_conn(sv, &w, fd);
+	free(w.in.s); free(w.out.s);
+	free(w.r1.s); free(w.r2.s); free(w.u.s);
+	STATS_FOLD();
+	return NULL;
+}
+
+/*
+ * a socket at path, which must not be served already
+ */
+static int
+serve_listen(const char *path){
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) die("socket path %s is too long\n", path);
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) die("socket: %s\n", strerror(errno));
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) die("%s is already served\n", path);
+	close(fd);
+	unlink(path); // left over by a server that did not exit cleanly
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) die("socket: %s\n", strerror(errno));
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) die("bind %s: %s\n", path, strerror(errno));
+	if(listen(fd, SOMAXCONN) != 0) die("listen %s: %s\n", path, strerror(errno));
+	return fd;
+}
+
+int
+main_serve(int argc, char *argv[]){
+	opt_t *opt = init_opt();
+	int c, t, n_threads = 4;
+	while ((c = getopt_long(argc, argv, "m:u:o:e:T:M:", plan_long_opts, NULL)) >= 0) {
+			switch (c) {
+			case 'm': opt->m = atoi(optarg); break;
+			case 'u': opt->u = atoi(optarg); break;
+			case 'o': opt->o = atoi(optarg); break;
+			case 'e': opt->e = atoi(optarg); break;
+			case 'T': n_threads = atoi(optarg); break;
+			case 'M': opt->max_mem = plan_parse_mem(optarg); break;
+			case 'b': case PLAN_OPT_MIN_SCORE: die("--both-strands and --min-score are not options of serve\n");
+			default: return 1;
+		}
+	}
+	if (optind + 1 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools serve [options] <socket>\n\n");
+				fprintf(stderr, "Options: -m INT   default score for a match [%d]\n", opt->m);
+				fprintf(stderr, "         -u INT   default mismatch penalty [%d]\n", opt->u);
+				fprintf(stderr, "         -o INT   default gap open penalty [%d]\n", opt->o);
+				fprintf(stderr, "         -e INT   default gap extension penalty [%d]\n", opt->e);
+				fprintf(stderr, "         -T INT   workers [%d]\n", n_threads);
+				fprintf(stderr, "         -M SIZE  memory budget per alignment, e.g. 512M or 4G (--max-mem) [half the physical memory]\n");
+				fprintf(stderr, "\n");
+				fprintf(stderr, "Request: MODE<TAB>s1<TAB>s2[<TAB>KEY=VALUE...], MODE global, local, fit, overlap or edit,\n");
+				fprintf(stderr, "         KEY m, u, o, e or tb (tb=0: score only)\n");
+				fprintf(stderr, "Reply:   ok<TAB>score[<TAB>b1<TAB>e1<TAB>b2<TAB>e2<TAB>CIGAR] or err<TAB>message\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	if(n_threads < 1) die("-T must be at least 1");
+	const char *path = argv[optind];
+	serve_t sv;
+	memset(&sv, 0, sizeof(sv));
+	pthread_mutex_init(&sv.lock, NULL);
+	pthread_cond_init(&sv.more, NULL);
+	pthread_cond_init(&sv.room, NULL);
+	sv.opt = opt;
+	sv.busy = mycalloc(n_threads, int);
+	for(t = 0; t < n_threads; t++) sv.busy[t] = -1;
+	// no SA_RESTART, so that accept() returns on a signal
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN); // a client gone mid-reply only fails that write()
+	int lfd = serve_listen(path);
+	// the workers inherit a mask without SIGINT and SIGTERM, so that
+	// only the main thread, in accept(), receives them
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	pthread_t *tid = mycalloc(n_threads, pthread_t);
+	for(t = 0; t < n_threads; t++)
+		if(pthread_create(&tid[t], NULL, serve_worker, &sv) != 0) die("fail to start thread %d", t);
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+	fprintf(stderr, "[%s] serving %s with %d workers\n", __func__, path, n_threads);
+	while(serve_stop == 0){
+		int fd = accept(lfd, NULL, NULL);
+		if(fd < 0){
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			die("accept: %s\n", strerror(errno));
+		}
+		serve_push(&sv, fd);
+	}
+	close(lfd);
+	unlink(path);
+	serve_drain(&sv);
+	for(t = 0; t < n_threads; t++) pthread_join(tid[t], NULL);
+	fprintf(stderr, "[%s] stopped\n", __func__);
+	free(sv.busy);
+	free(tid);
+	free(opt);
+	return 0;
+}
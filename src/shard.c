@@ -0,0 +1,267 @@
+/*--------------------------------------------------------------------*/
+/* shard.c 		                                                      */
+/* faidx-style index of a FASTA file and sharded reading through it.  */
+/*                                                                    */
+/* <in.fa>.fai has one line per record, as samtools faidx writes it:  */
+/* name, bases, byte offset of the first base, bases per line and     */
+/* bytes per line. `alignTools faidx` builds it in one pass; an index */
+/* from samtools works as well.                                       */
+/*                                                                    */
+/* With --shard i/N a process reads only records of shard i (0-based) */
+/* out of N: the file is cut at bytes T*i/N, T its size, and a record */
+/* goes to the shard its sequence starts in. Records come in units    */
+/* (2 for the pairs of batch) that a cut never splits. The shards are */
+/* disjoint, cover every unit and keep input order, so concatenating  */
+/* the outputs of shards 0..N-1 gives the output of the whole file.   */
+/* A shard seeks to its first record and reads its own bytes only.    */
+/*--------------------------------------------------------------------*/
+#include <sys/stat.h>
+#include "alignment.h"
+
+#define FAI_BUF                 65536
+#define SHARD_SEEK              65536   // skip a larger gap with fseeko()
+
+/*
+ * die if fn is gzip'ed: offsets of the .fai are into the plain file
+ */
+static void
+fai_plain(FILE *fp, const char *fn){
+	int c1 = getc(fp), c2 = getc(fp);
+	if(c1 == 0x1f && c2 == 0x8b) die("%s is compressed; a .fai needs a plain FASTA\n", fn);
+	rewind(fp);
+}
+
+static void
+fai_write(FILE *fo, const kstring_t *name, uint64_t len, uint64_t off, uint64_t lb, uint64_t lw){
+	fprintf(fo, "%s\t%llu\t%llu\t%llu\t%llu\n", name->s, (unsigned long long)len,
+			(unsigned long long)off, (unsigned long long)lb, (unsigned long long)lw);
+}
+
+/*
+ * one pass over fn; every line of a record but its last must have the
+ * same length, or the offset of a base could not be computed
+ */
+void
+fai_build(const char *fn, const char *out){
+	FILE *fp = fopen(fn, "rb");
+	if(fp == NULL) die("Can't open %s\n", fn);
+	fai_plain(fp, fn);
+	FILE *fo = fopen(out, "w");
+	if(fo == NULL) die("Can't open %s for writing\n", out);
+	unsigned char *buf = mycalloc(FAI_BUF, unsigned char);
+	kstring_t name = {0, 0, 0};
+	uint64_t pos = 0, off = 0, len = 0, lb = 0, lw = 0, bases = 0, bytes = 0;
+	int in_rec = 0, in_name = 0, named = 0, short_line = 0;
+	size_t n, i, n_rec = 0;
+	// a line is [bytes) of which [bases) are sequence; it ends at '\n'
+	while((n = fread(buf, 1, FAI_BUF, fp)) > 0){
+		for(i = 0; i < n; i++, pos++){
+			const int c = buf[i];
+			if(bytes == 0 && c == '>'){
+				if(in_rec){ fai_write(fo, &name, len, off, lb, lw); n_rec++; }
+				in_rec = in_name = 1; named = 0;
+				name.l = 0; kputsn("", 0, &name);
+				len = lb = lw = 0; short_line = 0;
+				bytes = 1;
+				continue;
+			}
+			bytes++;
+			if(in_name){
+				if(c == '\n'){
+					in_name = 0; bytes = 0;
+					off = pos + 1;
+				}else if(named == 0 && (c == ' ' || c == '\t' || c == '\r')) named = 1;
+				else if(named == 0) kputc(c, &name);
+				continue;
+			}
+			if(c != '\n'){
+				if(c != '\r') bases++;
+				continue;
+			}
+			if(in_rec == 0){
+				if(bases > 0) die("%s: sequence before the first header\n", fn);
+			}else if(bases == 0){
+				if(lb == 0) off = pos + 1; // blank lines before the sequence
+				else short_line = 1;       // only blank lines may follow
+			}else{
+				if(short_line) die("%s: record %s has lines of different lengths\n", fn, name.s);
+				if(lb == 0){ lb = bases; lw = bytes; }
+				else if(bases != lb || bytes != lw){
+					if(bases > lb || bytes - bases != lw - lb) die("%s: record %s has lines of different lengths\n", fn, name.s);
+					short_line = 1; // the last line may be shorter
+				}
+				len += bases;
+			}
+			bases = bytes = 0;
+		}
+	}
+	if(in_name) die("%s: record %s has no sequence line\n", fn, name.s);
+	if(bases > 0){ // no newline at the end of the file
+		if(short_line || (lb != 0 && bases > lb)) die("%s: record %s has lines of different lengths\n", fn, name.s);
+		if(lb == 0){ lb = bases; lw = bytes; }
+		len += bases;
+	}
+	if(in_rec){ fai_write(fo, &name, len, off, lb, lw); n_rec++; }
+	if(n_rec == 0) die("no record found in %s\n", fn);
+	free(buf);
+	free(name.s);
+	fclose(fp);
+	if(fclose(fo) != 0) die("fail to write %s\n", out);
+}
+
+fai_t
+*fai_load(const char *fn){
+	kstring_t path = {0, 0, 0};
+	ksprintf(&path, "%s.fai", fn);
+	struct stat sf, si;
+	if(stat(path.s, &si) != 0) die("%s not found; build it with `alignTools faidx %s`\n", path.s, fn);
+	if(stat(fn, &sf) == 0 && sf.st_mtime > si.st_mtime) die("%s is older than %s; rebuild it\n", path.s, fn);
+	FILE *fp = fopen(path.s, "r");
+	if(fp == NULL) die("Can't open %s\n", path.s);
+	fai_t *fai = mycalloc(1, fai_t);
+	size_t cap = 0;
+	kstring_t line = {0, 0, 0};
+	int c;
+	while(1){
+		line.l = 0;
+		while((c = getc(fp)) != EOF && c != '\n') kputc(c, &line);
+		if(line.l == 0){
+			if(c == EOF) break;
+			continue;
+		}
+		if(fai->n == cap){
+			cap = cap ? cap * 2 : 1024;
+			fai->r = realloc(fai->r, cap * sizeof(fai_rec_t));
+			if(fai->r == NULL) die("fai_load: fail to allocate %zu records\n", cap);
+		}
+		fai_rec_t *r = &fai->r[fai->n];
+		char *p = strchr(line.s, '\t'), *q;
+		if(p == NULL) die("%s: malformed line %zu\n", path.s, fai->n + 1);
+		r->name = strndup(line.s, p - line.s);
+		r->len = strtoull(p + 1, &q, 10);
+		r->off = strtoull(q, &q, 10);
+		r->lb = strtoull(q, &q, 10);
+		r->lw = strtoull(q, &q, 10);
+		if(r->len > 0 && (r->lb == 0 || r->lw < r->lb)) die("%s: malformed line %zu\n", path.s, fai->n + 1);
+		fai->n++;
+	}
+	fclose(fp);
+	free(line.s);
+	free(path.s);
+	if(fai->n == 0) die("%s.fai has no record\n", fn);
+	return fai;
+}
+
+void
+fai_destroy(fai_t *fai){
+	size_t i;
+	for(i = 0; i < fai->n; i++) free(fai->r[i].name);
+	free(fai->r);
+	free(fai);
+}
+
+/*
+ * bytes from the first base of r to its last one
+ */
+static inline uint64_t
+fai_span(const fai_rec_t *r){
+	return r->len ? (r->len - 1) / r->lb * r->lw + (r->len - 1) % r->lb + 1 : 0;
+}
+
+void
+shard_parse(const char *s, int *i, int *n){
+	char *p;
+	long a = strtol(s, &p, 10), b;
+	if(p == s || *p != '/') die("--shard takes i/N, not '%s'\n", s);
+	b = strtol(p + 1, &p, 10);
+	if(*p != '\0' || b < 1 || a < 0 || a >= b) die("--shard i/N needs 0 <= i < N, not '%s'\n", s);
+	*i = a; *n = b;
+}
+
+shard_t
+*shard_open(const char *fn, int i, int n, size_t unit){
+	shard_t *sh = mycalloc(1, shard_t);
+	sh->fai = fai_load(fn);
+	const fai_rec_t *last = &sh->fai->r[sh->fai->n - 1];
+	const uint64_t total = last->off + fai_span(last);
+	const uint64_t lo = total * i / n, hi = total * (i + 1) / n;
+	const size_t units = sh->fai->n / unit;
+	size_t u = 0;
+	// units are in file order; a unit starts at the sequence of its first record
+	while(u < units && sh->fai->r[u * unit].off < lo) u++;
+	sh->next = u * unit;
+	while(u < units && (i == n - 1 || sh->fai->r[u * unit].off < hi)) u++;
+	sh->end = u * unit;
+	if(i == n - 1 && sh->fai->n % unit)
+		fprintf(stderr, "[%s] %zu records after the last full unit of %zu are ignored\n", __func__, sh->fai->n % unit, unit);
+	if((sh->fp = fopen(fn, "rb")) == NULL) die("Can't open %s\n", fn);
+	fai_plain(sh->fp, fn);
+	if(sh->next < sh->end){
+		if(fseeko(sh->fp, sh->fai->r[sh->next].off, SEEK_SET) != 0) die("fail to seek in %s\n", fn);
+		sh->pos = sh->fai->r[sh->next].off;
+	}
+	fprintf(stderr, "[%s] shard %d/%d: records %zu-%zu of %zu\n", __func__, i, n, sh->next, sh->end, sh->fai->n);
+	return sh;
+}
+
+/*
+ * the next record of the shard into seq, its length or -1 at the end
+ */
+long
+shard_read(shard_t *sh, const char **name, kstring_t *seq){
+	if(sh->next >= sh->end) return -1;
+	const fai_rec_t *r = &sh->fai->r[sh->next++];
+	if(r->off < sh->pos) die("the .fai is not in file order at record %s\n", r->name);
+	if(r->off - sh->pos > SHARD_SEEK){
+		if(fseeko(sh->fp, r->off, SEEK_SET) != 0) die("fail to seek to record %s\n", r->name);
+	}else{
+		uint64_t k;
+		for(k = sh->pos; k < r->off; k++) getc_unlocked(sh->fp); // the header, in the stdio buffer
+	}
+	const uint64_t span = fai_span(r);
+	if(ks_resize(seq, span + 1) < 0) die("shard_read: fail to allocate %llu bytes\n", (unsigned long long)span + 1);
+	if(fread(seq->s, 1, span, sh->fp) != span) die("record %s ends before its .fai says\n", r->name);
+	sh->pos = r->off + span;
+	size_t i, l = 0;
+	for(i = 0; i < span; i++)
+		if(seq->s[i] != '\n' && seq->s[i] != '\r') seq->s[l++] = seq->s[i];
+	if(l != r->len) die("record %s does not match its .fai; rebuild it\n", r->name);
+	seq->s[l] = '\0';
+	seq->l = l;
+	*name = r->name;
+	return l;
+}
+
+void
+shard_close(shard_t *sh){
+	fclose(sh->fp);
+	fai_destroy(sh->fai);
+	free(sh);
+}
+
+int
+main_faidx(int argc, char *argv[]){
+	int c;
+	char *out = NULL;
+	while ((c = getopt(argc, argv, "o:")) >= 0) {
+			switch (c) {
+			case 'o': out = optarg; break;
+			default: return 1;
+		}
+	}
+	if (optind + 1 > argc) {
+		fprintf(stderr, "\n");
+				fprintf(stderr, "Usage:   alignTools faidx [options] <in.fa>\n\n");
+				fprintf(stderr, "Options: -o FILE  output index [<in.fa>.fai]\n");
+				fprintf(stderr, "\n");
+				fprintf(stderr, "The index is that of samtools faidx; --shard of batch reads through it.\n");
+				fprintf(stderr, "\n");
+				return 1;
+	}
+	kstring_t fn = {0, 0, 0};
+	if(out == NULL) ksprintf(&fn, "%s.fai", argv[optind]);
+	else kputs(out, &fn);
+	fai_build(argv[optind], fn.s);
+	free(fn.s);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*--------------------------------------------------------------------*/
+/* stats.h 		                                                      */
+/* Per-phase timers and counters for --stats.                         */
+/*                                                                    */
+/* Compiled out unless built with `make STATS=1` (-DAT_STATS); the    */
+/* macros then expand to nothing, so the hot loops are untouched in   */
+/* a normal build. With it, `alignTools --stats <command> ...` prints */
+/* one JSON object to stderr at exit; --perf adds hardware counters   */
+/* (perf.c) per phase and per planner engine.                         */
+/*--------------------------------------------------------------------*/
+#ifndef _STATS_
+#define _STATS_
+
+#ifdef AT_STATS
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+enum {
+	STATS_PARSE,   // reading fasta / index
+	STATS_ALLOC,   // score and pointer matrices
+	STATS_FILL,    // dynamic programming
+	STATS_TRACE,   // traceback
+	STATS_OUTPUT,  // printing alignments
+	STATS_N
+};
+
+enum {
+	PERF_CYCLES,
+	PERF_INSNS,
+	PERF_L1D_MISS, // L1 data cache read misses
+	PERF_LLC_MISS, // last level cache misses
+	PERF_BR_MISS,  // mispredicted branches
+	PERF_FAULTS,   // page faults, a software counter
+	PERF_N
+};
+
+typedef struct {
+	double   t[STATS_N]; // seconds per phase
+	uint64_t cells;      // DP cells computed
+	uint64_t bytes;      // bytes requested through mycalloc()
+	uint64_t engine[16]; // alignments run by each planner engine (ENG_*)
+	uint64_t hw[STATS_N][PERF_N];   // --perf counters per phase
+	uint64_t engine_hw[16][PERF_N]; // and per engine
+} stats_t;
+
+extern __thread stats_t at_stats; // per thread, see stats_fold()
+extern int at_perf;               // --perf and some counter opened
+
+void perf_init(void);
+void perf_read(uint64_t *v);
+void perf_print(FILE *fp, const stats_t *s, const char *const *phase);
+
+static inline double
+stats_now(void){
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*
+ * add the counters of t to s
+ */
+static inline void
+stats_add(stats_t *s, const stats_t *t){
+	int i;
+	for(i = 0; i < STATS_N; i++) s->t[i] += t->t[i];
+	for(i = 0; i < 16; i++) s->engine[i] += t->engine[i];
+	for(i = 0; i < STATS_N * PERF_N; i++) (&s->hw[0][0])[i] += (&t->hw[0][0])[i];
+	for(i = 0; i < 16 * PERF_N; i++) (&s->engine_hw[0][0])[i] += (&t->engine_hw[0][0])[i];
+	s->cells += t->cells;
+	s->bytes += t->bytes;
+}
+
+/*
+ * counters at the start of a phase; one branch without --perf
+ */
+static inline void
+perf_begin(uint64_t *v0){
+	if(at_perf) perf_read(v0);
+}
+
+static inline void
+perf_end(uint64_t *acc, const uint64_t *v0){
+	if(at_perf){
+		uint64_t v[PERF_N];
+		int k;
+		perf_read(v);
+		for(k = 0; k < PERF_N; k++) acc[k] += v[k] - v0[k];
+	}
+}
+
+void stats_fold(void);
+void stats_print(FILE *fp, const char *cmd, double t_real);
+
+#define STATS_BEGIN(ph)         double _stats_##ph = stats_now(); STATS_HW_BEGIN(ph)
+#define STATS_END(ph)           (at_stats.t[ph] += stats_now() - _stats_##ph, perf_end(at_stats.hw[ph], _perf_##ph))
+#define STATS_CELLS(n)          (at_stats.cells += (uint64_t)(n))
+#define STATS_BYTES(n)          (at_stats.bytes += (uint64_t)(n))
+#define STATS_FOLD()            stats_fold()   // a worker thread, before it returns
+// a function calling STATS_ENGINE() starts with STATS_HW_BEGIN(engine)
+#define STATS_HW_BEGIN(tag)     uint64_t _perf_##tag[PERF_N]; perf_begin(_perf_##tag)
+#define STATS_ENGINE(e)         (at_stats.engine[e]++, perf_end(at_stats.engine_hw[e], _perf_engine))
+#else
+#define STATS_BEGIN(ph)
+#define STATS_END(ph)
+#define STATS_CELLS(n)
+#define STATS_BYTES(n)
+#define STATS_FOLD()
+#define STATS_HW_BEGIN(tag)
+#define STATS_ENGINE(e)
+#endif
+
+#endif
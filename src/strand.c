@@ -0,0 +1,58 @@
+/*--------------------------------------------------------------------*/
+/* strand.c 		                                                  */
+/* Reverse complement and --both-strands.                             */
+/*                                                                    */
+/* The reverse complement of s1 is encoded once per pair. Both        */
+/* strands are scored with the score-only kernel, which keeps two     */
+/* rows per state, and the traceback matrices are only built for the  */
+/* better one; a two-strand run therefore costs one full alignment    */
+/* plus two O(n)-memory passes instead of two full alignments.        */
+/* Ties go to the forward strand.                                     */
+/*--------------------------------------------------------------------*/
+#include "alignment.h"
+
+static unsigned char comp_table[256];
+
+/*
+ * rc = reverse complement of s; case is kept, non-ACGT bases are copied
+ */
+void
+revcomp(const kstring_t *s, kstring_t *rc){
+	size_t i;
+	if(comp_table['A'] == 0){
+		for(i = 0; i < 256; i++) comp_table[i] = i;
+		comp_table['A'] = 'T'; comp_table['T'] = 'A'; comp_table['C'] = 'G'; comp_table['G'] = 'C';
+		comp_table['a'] = 't'; comp_table['t'] = 'a'; comp_table['c'] = 'g'; comp_table['g'] = 'c';
+	}
+	rc->l = 0;
+	if(rc->m < s->l + 1){
+		rc->m = s->l + 1;
+		rc->s = realloc(rc->s, rc->m);
+		if(rc->s == NULL) die("revcomp: fail to allocate %zu bytes", rc->m);
+	}
+	for(i = 0; i < s->l; i++) rc->s[i] = comp_table[(unsigned char)s->s[s->l - 1 - i]];
+	rc->s[rc->l = s->l] = '\0';
+}
+
+/*
+ * align s1 or its reverse complement to s2, whichever scores better
+ * under mode; *strand is set to '+' or '-'.
+ */
+double
+align_both_strands(align_f align, int mode, kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, char *strand){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL || strand == NULL) die("align_both_strands: parameter error\n");
+	kstring_t rc = {0, 0, 0};
+	revcomp(s1, &rc);
+	int fwd = kern_score_int(s1, s2, opt, mode, NULL, NULL);
+	int rev = kern_score_int(&rc, s2, opt, mode, NULL, NULL);
+	double score;
+	if(rev > fwd){
+		*strand = '-';
+		score = align(&rc, s2, r1, r2, opt);
+	}else{
+		*strand = '+';
+		score = align(s1, s2, r1, r2, opt);
+	}
+	free(rc.s);
+	return score;
+}
@@ -0,0 +1,207 @@
+/*--------------------------------------------------------------------*/
+/* twopass.c 	                                                      */
+/* Two-pass local and fit alignment.                                  */
+/*                                                                    */
+/* 1. a forward score-only pass (two rows per state) finds the score  */
+/*    and the cell where the best alignment ends;                     */
+/* 2. a reverse score-only pass, anchored at that cell and run over   */
+/*    the reversed prefixes, finds where the alignment starts;        */
+/* 3. the usual full-matrix aligner is run on the bounded             */
+/*    sub-rectangle only, to produce the traceback.                   */
+/* The reverse passes also bound the linear-space traceback of        */
+/* hirsch.c.                                                          */
+/* Memory drops from O(mn) to O(n) plus the sub-rectangle, which for  */
+/* a read against a gene is tiny compared with read x gene. If the    */
+/* sub-rectangle does not reproduce the forward score the full-matrix */
+/* aligner is used instead, so the score never changes (ties between  */
+/* co-optimal alignments may be broken differently).                  */
+/*--------------------------------------------------------------------*/
+#include "alignment.h"
+
+static inline double
+max2(double a, double b){
+	return a > b ? a : b;
+}
+
+/*
+ * rolling rows for the four states
+ */
+typedef struct {
+	double *M, *L, *U, *J;
+} row_t;
+
+static inline void
+rows_alloc(row_t *p, row_t *c, size_t n){
+	double *buf = mycalloc(8 * (n + 1), double);
+	p->M = buf;            p->L = p->M + (n + 1); p->U = p->L + (n + 1); p->J = p->U + (n + 1);
+	c->M = p->J + (n + 1); c->L = c->M + (n + 1); c->U = c->L + (n + 1); c->J = c->U + (n + 1);
+}
+
+static inline void
+rows_swap(row_t *p, row_t *c){
+	row_t t = *p; *p = *c; *c = t;
+}
+
+/*
+ * reset r1/r2 to hold an alignment of s1 and s2; the trace back
+ * functions shrink them to the length of the previous alignment.
+ */
+static inline void
+result_reset(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2){
+	r1->s = realloc(r1->s, s1->l + s2->l + 1);
+	r2->s = realloc(r2->s, s1->l + s2->l + 1);
+	if(r1->s == NULL || r2->s == NULL) die("result_reset: out of memory");
+	memset(r1->s, 0, s1->l + s2->l + 1);
+	memset(r2->s, 0, s1->l + s2->l + 1);
+	r1->l = r2->l = 0;
+}
+
+/*--------------------------------------------------------------------*/
+/* fit                                                                */
+/*--------------------------------------------------------------------*/
+/*
+ * reverse pass over reversed s1 and reversed s2[0, j_end), anchored at
+ * the forward end cell. A jump runs backwards here, so it may start
+ * anywhere but has to end right before a junction site.
+ * returns the start column of an alignment scoring max_score, or -1.
+ */
+long
+fit_reverse(kstring_t *s1, kstring_t *s2, opt_t *opt, const char *site, size_t j_end, double max_score){
+	double match = opt->m, mismatch = opt->u, gap = opt->o, extension = opt->e, jump_penality = opt->j;
+	size_t m = s1->l, n = j_end, i, j;
+	long j_start = -1;
+	row_t p, c;
+	rows_alloc(&p, &c, n);
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) p.M[j] = p.L[j] = p.U[j] = p.J[j] = -INFINITY;
+	p.M[0] = 0.0;
+	for(i = 1; i <= m; i++){
+		c.M[0] = c.U[0] = c.J[0] = -INFINITY;
+		c.L[0] = max2(p.L[0] + extension, p.M[0] + gap);
+		for(j = 1; j <= n; j++){
+			double new_score = (s1->s[m-i] == s2->s[n-j]) ? match : mismatch;
+			double h = max2(max2(p.L[j-1], p.M[j-1]), p.U[j-1]);
+			if(opt->s == true && j >= 2 && site[n+1-j]) h = max2(h, p.J[j-1]);
+			c.M[j] = h + new_score;
+			c.L[j] = max2(p.L[j] + extension, p.M[j] + gap);
+			c.U[j] = max2(c.M[j-1] + gap, c.U[j-1] + extension);
+			c.J[j] = (opt->s == true && i < m) ? max2(c.M[j-1] + jump_penality, c.J[j-1]) : -INFINITY;
+		}
+		rows_swap(&p, &c);
+	}
+	// a fit alignment may not open with a gap in column 0
+	for(j = 0; j <= n; j++){
+		if(p.M[j] >= max_score || (j < n && p.L[j] >= max_score)){
+			j_start = n - j;
+			break;
+		}
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS((i - 1) * n);
+	free(p.M < c.M ? p.M : c.M);
+	return j_start;
+}
+
+/*
+ * two-pass fit alignment, drop-in for align_fit_affine_jump()
+ */
+double
+align_fit_twopass(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("align: parameter error\n");
+	if(s1->l > s2->l) die("first sequence must be shorter than the second to do fitting alignment");
+	if(opt->p == true) return align_fit_affine_jump(s1, s2, r1, r2, opt); // no score-only two-piece pass
+	char *site = site_mask(opt, s2->l);
+	size_t j_end, k;
+	int j;
+	// forward pass: the fit kernel in score-only form
+	double max_score = kern_score(s1, s2, opt, KMODE_FIT, NULL, &j);
+	j_end = j;
+	long j_start = max_score == -INFINITY ? -1 : fit_reverse(s1, s2, opt, site, j_end, max_score);
+	free(site);
+	if(j_start >= 0){
+		// the fit aligner wants s1 no longer than the target slice
+		size_t st = j_start, en = j_end;
+		if(en - st < s1->l){
+			st = en > s1->l ? en - s1->l : 0;
+			if(st + s1->l > en) en = st + s1->l;
+		}
+		kstring_t sub = {en - st, en - st, s2->s + st};
+		opt_t sub_opt = *opt;
+		sub_opt.sites.size = 0;
+		sub_opt.sites.pos = mycalloc(opt->sites.size + 1, int);
+		for(k = 0; k < opt->sites.size; k++)
+			if(opt->sites.pos[k] >= (int)st && opt->sites.pos[k] < (int)en)
+				sub_opt.sites.pos[sub_opt.sites.size++] = opt->sites.pos[k] - st;
+		double score = align_fit_affine_jump(s1, &sub, r1, r2, &sub_opt);
+		free(sub_opt.sites.pos);
+		if(score == max_score) return score;
+		result_reset(s1, s2, r1, r2);
+	}
+	return align_fit_affine_jump(s1, s2, r1, r2, opt);
+}
+
+/*--------------------------------------------------------------------*/
+/* local                                                              */
+/*--------------------------------------------------------------------*/
+/*
+ * reverse pass over the reversed prefixes ending at (i_end, j_end);
+ * finds the shortest extent (*di, *dj) of an alignment scoring
+ * max_score that ends there. returns 0 on success.
+ */
+int
+local_reverse(kstring_t *s1, kstring_t *s2, opt_t *opt, size_t i_end, size_t j_end, double max_score, size_t *di, size_t *dj){
+	double match = opt->m, mismatch = opt->u, gap = opt->o, extension = opt->e;
+	size_t n = j_end, i, j;
+	int ret = -1;
+	row_t p, c;
+	rows_alloc(&p, &c, n);
+	STATS_BEGIN(STATS_FILL);
+	for(j = 0; j <= n; j++) p.M[j] = p.L[j] = p.U[j] = -INFINITY;
+	p.M[0] = 0.0;
+	for(i = 1; i <= i_end && ret != 0; i++){
+		c.M[0] = c.U[0] = -INFINITY;
+		c.L[0] = max2(p.L[0] + extension, p.M[0] + gap);
+		for(j = 1; j <= n; j++){
+			double new_score = (s1->s[i_end-i] == s2->s[j_end-j]) ? match : mismatch;
+			c.M[j] = max2(max2(p.L[j-1], p.M[j-1]), p.U[j-1]) + new_score;
+			c.L[j] = max2(p.L[j] + extension, p.M[j] + gap);
+			c.U[j] = max2(c.M[j-1] + gap, c.U[j-1] + extension);
+			if(ret != 0 && c.M[j] >= max_score){
+				*di = i; *dj = j;
+				ret = 0;
+			}
+		}
+		rows_swap(&p, &c);
+	}
+	STATS_END(STATS_FILL);
+	STATS_CELLS((i - 1) * n);
+	free(p.M < c.M ? p.M : c.M);
+	return ret;
+}
+
+/*
+ * two-pass local alignment, drop-in for align_local_affine()
+ */
+double
+align_local_twopass(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL) die("align: parameter error\n");
+	size_t i_end, j_end, di, dj;
+	int i, j;
+	// forward pass, (i_end, j_end) is the first cell holding the best M
+	double max_score = kern_score(s1, s2, opt, KMODE_LOCAL, &i, &j);
+	i_end = i; j_end = j;
+	if(max_score <= 0){ // nothing aligns
+		r1->l = r2->l = 0;
+		if(r1->s) r1->s[0] = '\0';
+		if(r2->s) r2->s[0] = '\0';
+		return max_score;
+	}
+	if(local_reverse(s1, s2, opt, i_end, j_end, max_score, &di, &dj) == 0){
+		kstring_t sub1 = {di, di, s1->s + i_end - di};
+		kstring_t sub2 = {dj, dj, s2->s + j_end - dj};
+		double score = align_local_affine(&sub1, &sub2, r1, r2, opt);
+		if(score == max_score) return score;
+		result_reset(s1, s2, r1, r2);
+	}
+	return align_local_affine(s1, s2, r1, r2, opt);
+}
@@ -0,0 +1,576 @@
+/*--------------------------------------------------------------------*/
+/* wfa.c 		                                                      */
+/* Gap-affine wavefront alignment (WFA, Marco-Sola et al. 2021) and   */
+/* its bidirectional low-memory form (BiWFA, Marco-Sola et al. 2023). */
+/*                                                                    */
+/* WFA works on penalties (match 0, all others positive) and, for     */
+/* every penalty s, keeps the furthest cell each diagonal k = j-i     */
+/* reaches at cost s, so it costs O((m+n)s) time instead of O(mn)     */
+/* and near-identical pairs are aligned in close to linear time.      */
+/* With match a, mismatch u, gap open o and extension e, twice the    */
+/* score of an alignment is a(m+n) minus                              */
+/*   x = 2(a-u) per mismatch, o' = 2(e-o) per gap, e' = a-2e per gap  */
+/*   base, and another -2e for a gap at the start of the alignment    */
+/*   (align_gla() charges o+k*e for leading and o+(k-1)e for all      */
+/*   other gaps),                                                     */
+/* so the minimal penalty gives the optimal score. The recurrence of  */
+/* align_gla() never goes from one gap straight into the other; the   */
+/* wavefronts may, which only costs 2e' where a mismatch costs x, so  */
+/* both agree when u >= 2e (as the int8 kernel of -d). wfa_exact()    */
+/* lists the conditions; other scorings fall back to the planner.     */
+/*                                                                    */
+/* align_gla_wfa() keeps every wavefront, O(s^2) memory, and backs    */
+/* the alignment out of them. align_gla_biwfa() runs WFA from both    */
+/* ends with only the last few wavefronts, splits the pair where they */
+/* meet and recurses on both halves, O(s) memory for about twice the  */
+/* time; the full WFA also switches to it when the wavefronts outgrow */
+/* the memory budget. Both return the score of align_gla(); among     */
+/* co-optimal alignments they may pick a different one.               */
+/*                                                                    */
+/* edit_wfa() is the score-only WFA for edit_dist() (mismatch u,      */
+/* indel 1), which the planner tries under a work cap.                */
+/*--------------------------------------------------------------------*/
+#include <stdint.h>
+#include <limits.h>
+#include "alignment.h"
+
+#define WFA_NULL                (INT32_MIN / 2)
+#define WFA_M                   0
+#define WFA_I                   1       // consumes s2, r1 gets '-'
+#define WFA_D                   2       // consumes s1, r2 gets '-'
+#define WFA_BI_BASE             256     // sub-problems up to this penalty get the full WFA
+
+typedef struct {
+	int lo, hi;                 // diagonals k = j - i held, lo > hi when empty
+	int32_t *M, *I, *D;         // furthest offset j of diagonal k in M[k-lo]
+	int32_t *buf;               // M, I and D live here
+	size_t cap;                 // cells per state allocated (ring slots are reused)
+} wf_t;
+
+typedef struct {
+	int x, o, e;                // mismatch, gap open, gap base; match is 0
+} wfa_pen_t;
+
+typedef struct {
+	const char *a, *b;          // s1 and s2, or both reversed
+	int m, n;
+	int start, end;             // WFA_M/I/D the path starts and must end in
+	int lead;                   // penalty of the leading-gap seeds at the origin of the whole pair, -1 if none
+	const wfa_pen_t *p;
+	wf_t *wf;                   // wavefront of penalty s in wf[s], or wf[s % ring]
+	int n_wf, ring;             // ring is 0 when every wavefront is kept
+	size_t bytes, max_bytes;    // max_bytes 0 for no limit
+	double work, max_work;      // cells and 8-byte compares; max_work 0 for no limit
+} wfa_t;
+
+typedef struct {
+	char *a, *b;                // alignment columns of s1 and s2
+	size_t l, m;
+} wfa_aln_t;
+
+static const wf_t wf_empty = {0, -1, NULL, NULL, NULL, NULL, 0};
+
+static inline int32_t
+wf_get(const wf_t *w, const int32_t *v, int k){
+	return (k >= w->lo && k <= w->hi) ? v[k - w->lo] : WFA_NULL;
+}
+
+static inline int32_t
+max2(int32_t a, int32_t b){ return a > b ? a : b; }
+
+/*
+ * true when the wavefronts score exactly like align_gla()
+ */
+bool
+wfa_exact(const opt_t *opt){
+	if(opt->o > opt->e || opt->e > 0 || opt->u >= opt->m || opt->u < 2 * opt->e) return false;
+	if(opt->m - 2 * opt->e < 1) return false;
+	// small penalties keep those of long pairs in int range
+	if((long)opt->m - opt->u > 64 || (long)opt->m - 2L * opt->o > 64) return false;
+	return true;
+}
+
+static void
+wfa_pen(const opt_t *opt, wfa_pen_t *p){
+	p->x = 2 * (opt->m - opt->u);
+	p->o = 2 * (opt->e - opt->o);
+	p->e = opt->m - 2 * opt->e;
+}
+
+/* wavefronts needed behind the current one */
+static inline int
+wfa_scope(const wfa_pen_t *p){
+	return (p->x > p->o + p->e ? p->x : p->o + p->e) + 1;
+}
+
+static void
+wfa_init(wfa_t *W, const wfa_pen_t *p, const char *a, const char *b, int m, int n, int start, int end, int lead, int ring){
+	int s;
+	memset(W, 0, sizeof(wfa_t));
+	W->a = a; W->b = b; W->m = m; W->n = n;
+	W->start = start; W->end = end; W->lead = lead;
+	W->p = p;
+	W->ring = ring;
+	if(ring > 0){
+		W->wf = mycalloc(ring, wf_t);
+		W->n_wf = ring;
+		for(s = 0; s < ring; s++) W->wf[s] = wf_empty;
+	}
+}
+
+static void
+wfa_free(wfa_t *W){
+	int s;
+	for(s = 0; s < W->n_wf; s++) free(W->wf[s].buf);
+	free(W->wf);
+	memset(W, 0, sizeof(wfa_t));
+}
+
+/*
+ * wavefront of penalty s; empty when never computed
+ */
+static inline const wf_t
+*wfa_at(const wfa_t *W, int s){
+	if(s < 0) return &wf_empty;
+	if(W->ring > 0) return &W->wf[s % W->ring];
+	return s < W->n_wf ? &W->wf[s] : &wf_empty;
+}
+
+static void
+wfa_reserve(wfa_t *W, int s){
+	if(W->ring > 0 || s < W->n_wf) return;
+	int n = W->n_wf < 64 ? 64 : W->n_wf, t;
+	while(n <= s) n *= 2;
+	W->wf = realloc(W->wf, n * sizeof(wf_t));
+	if(W->wf == NULL) die("wfa_reserve: fail to allocate %d wavefronts", n);
+	for(t = W->n_wf; t < n; t++) W->wf[t] = wf_empty;
+	W->n_wf = n;
+}
+
+/*
+ * slot for the wavefront of penalty s over diagonals lo..hi; call
+ * wfa_reserve() before taking pointers to other wavefronts
+ */
+static wf_t
+*wfa_slot(wfa_t *W, int s, int lo, int hi){
+	wf_t *w = W->ring > 0 ? &W->wf[s % W->ring] : &W->wf[s];
+	w->lo = lo; w->hi = hi;
+	if(lo > hi) return w;
+	size_t len = hi - lo + 1;
+	if(w->cap < len){
+		size_t cap = W->ring > 0 ? len + len / 2 + 16 : len;
+		free(w->buf);
+		W->bytes += 3 * sizeof(int32_t) * (cap - w->cap);
+		w->buf = mycalloc(3 * cap, int32_t);
+		w->cap = cap;
+	}
+	w->M = w->buf;
+	w->I = w->buf + w->cap;
+	w->D = w->buf + 2 * w->cap;
+	return w;
+}
+
+/*
+ * furthest j from (i,j) along matches
+ */
+static inline int32_t
+wfa_extend(const char *a, const char *b, int m, int n, int32_t i, int32_t j, double *work){
+	int32_t j0 = j;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while(i + 8 <= m && j + 8 <= n){
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + j, 8);
+		if(x != y){
+			j += __builtin_ctzll(x ^ y) >> 3;
+			*work += (j - j0) / 8.0;
+			return j;
+		}
+		i += 8; j += 8;
+	}
+#endif
+	while(i < m && j < n && a[i] == b[j]){ i++; j++; }
+	*work += (j - j0) / 8.0;
+	return j;
+}
+
+/* whether state st holds a seed at penalty s on diagonal 0 */
+static inline bool
+wfa_seed(const wfa_t *W, int st, int s){
+	if(st == WFA_M) return (W->start == WFA_M && s == 0) ? true : false;
+	if(W->start == st && s == W->p->o) return true;
+	return (W->start == WFA_M && W->lead >= 0 && s == W->lead) ? true : false;
+}
+
+/*
+ * gap opening from M of penalty s on diagonal kk; the origin of the
+ * whole pair opens its leading gaps through the seeds instead
+ */
+static inline int32_t
+wfa_open(const wfa_t *W, const wf_t *w, int s, int kk){
+	int32_t v = wf_get(w, w->M, kk);
+	return (W->lead >= 0 && s == 0 && kk == 0 && v == 0) ? WFA_NULL : v;
+}
+
+/*
+ * compute and extend the wavefront of penalty s; returns -1 when the
+ * work or memory cap is hit, 1 when it reaches the end cell, else 0
+ */
+static int
+wfa_next(wfa_t *W, int s){
+	const wfa_pen_t *p = W->p;
+	const int so = s - p->o - p->e, se = s - p->e, m = W->m, n = W->n;
+	wfa_reserve(W, s);
+	const wf_t *mx = wfa_at(W, s - p->x), *mo = wfa_at(W, so), *ge = wfa_at(W, se);
+	const bool si = wfa_seed(W, WFA_I, s), sd = wfa_seed(W, WFA_D, s), sm = wfa_seed(W, WFA_M, s);
+	int lo = INT_MAX, hi = INT_MIN, k;
+	if(mx->lo <= mx->hi){ if(mx->lo < lo) lo = mx->lo; if(mx->hi > hi) hi = mx->hi; }
+	if(mo->lo <= mo->hi){ if(mo->lo - 1 < lo) lo = mo->lo - 1; if(mo->hi + 1 > hi) hi = mo->hi + 1; }
+	if(ge->lo <= ge->hi){ if(ge->lo - 1 < lo) lo = ge->lo - 1; if(ge->hi + 1 > hi) hi = ge->hi + 1; }
+	if(si == true || sd == true || sm == true){ if(lo > 0) lo = 0; if(hi < 0) hi = 0; }
+	if(lo < -m) lo = -m;
+	if(hi > n) hi = n;
+	wf_t *w = wfa_slot(W, s, lo, hi);
+	if(lo > hi) return 0;
+	W->work += hi - lo + 1;
+	for(k = lo; k <= hi; k++){
+		int32_t ins = max2(wfa_open(W, mo, so, k - 1), wf_get(ge, ge->I, k - 1)) + 1;
+		int32_t del = max2(wfa_open(W, mo, so, k + 1), wf_get(ge, ge->D, k + 1));
+		int32_t mis = wf_get(mx, mx->M, k) + 1;
+		if(k == 0){
+			if(si == true) ins = max2(ins, 0);
+			if(sd == true) del = max2(del, 0);
+			if(sm == true) mis = max2(mis, 0);
+		}
+		if(ins < 0 || ins > n) ins = WFA_NULL;
+		if(del < 0 || del - k > m) del = WFA_NULL;
+		if(mis < 0 || mis > n || mis - k > m) mis = WFA_NULL;
+		w->I[k - lo] = ins;
+		w->D[k - lo] = del;
+		w->M[k - lo] = max2(mis, max2(ins, del));
+	}
+	// drop the diagonals nothing reaches
+	int a = 0, b = hi - lo;
+	while(a <= b && w->M[a] < 0) a++;
+	while(b >= a && w->M[b] < 0) b--;
+	w->M += a; w->I += a; w->D += a;
+	w->lo = lo + a; w->hi = lo + b;
+	for(k = w->lo; k <= w->hi; k++){
+		int32_t j = w->M[k - w->lo];
+		if(j >= 0) w->M[k - w->lo] = wfa_extend(W->a, W->b, m, n, j - k, j, &W->work);
+	}
+	if((W->max_work > 0 && W->work > W->max_work) || (W->max_bytes > 0 && W->bytes > W->max_bytes)) return -1;
+	const int32_t *v = W->end == WFA_M ? w->M : W->end == WFA_I ? w->I : w->D;
+	return wf_get(w, v, n - m) >= n ? 1 : 0;
+}
+
+/*
+ * penalty of the first wavefront reaching the end cell, -1 when the
+ * work or memory cap was hit first
+ */
+static int
+wfa_run(wfa_t *W){
+	const wfa_pen_t *p = W->p;
+	const double limit = (W->m + W->n + 2.0) * (p->x + p->o + p->e) + (W->lead > 0 ? W->lead : 0);
+	int s, r;
+	for(s = 0; ; s++){
+		if(s > limit) die("wfa_run: no path to the end cell of %d x %d", W->m, W->n);
+		if((r = wfa_next(W, s)) != 0) return r < 0 ? -1 : s;
+	}
+}
+
+static inline void
+aln_push(wfa_aln_t *A, char x, char y){
+	if(A->l == A->m){
+		A->m = A->m < 256 ? 256 : 2 * A->m;
+		A->a = realloc(A->a, A->m);
+		A->b = realloc(A->b, A->m);
+		if(A->a == NULL || A->b == NULL) die("aln_push: fail to allocate %zu columns", A->m);
+	}
+	A->a[A->l] = x;
+	A->b[A->l++] = y;
+}
+
+/*
+ * append the alignment ending at penalty s to A; every wavefront up
+ * to s must be kept
+ */
+static void
+wfa_trace(const wfa_t *W, int s, wfa_aln_t *A){
+	const wfa_pen_t *p = W->p;
+	const char *a = W->a, *b = W->b;
+	const size_t l0 = A->l;
+	int k = W->n - W->m, st = W->end;
+	int32_t x = W->n;
+	size_t t;
+	while(1){
+		const wf_t *w = wfa_at(W, s);
+		if(st == WFA_M){
+			const wf_t *mx = wfa_at(W, s - p->x);
+			int32_t mis = wf_get(mx, mx->M, k) + 1, ins = wf_get(w, w->I, k), del = wf_get(w, w->D, k);
+			int32_t seed = (k == 0 && wfa_seed(W, WFA_M, s) == true) ? 0 : WFA_NULL;
+			if(mis < 0 || mis > W->n || mis - k > W->m) mis = WFA_NULL;
+			int32_t v = max2(max2(seed, mis), max2(ins, del));
+			if(v < 0) die("wfa_trace: lost the path at penalty %d", s);
+			for(; x > v; x--) aln_push(A, a[x - 1 - k], b[x - 1]);
+			if(v == seed) break;
+			if(v == mis){
+				x--;
+				aln_push(A, a[x - k], b[x]);
+				s -= p->x;
+			}else st = v == ins ? WFA_I : WFA_D;
+		}else if(st == WFA_I){
+			if(k == 0 && x == 0 && wfa_seed(W, WFA_I, s) == true) break;
+			const wf_t *ge = wfa_at(W, s - p->e);
+			int32_t ex = wf_get(ge, ge->I, k - 1);
+			aln_push(A, '-', b[x - 1]);
+			x--; k--;
+			if(ex == x) s -= p->e;
+			else{ st = WFA_M; s -= p->o + p->e; }
+		}else{
+			if(k == 0 && x == 0 && wfa_seed(W, WFA_D, s) == true) break;
+			const wf_t *ge = wfa_at(W, s - p->e);
+			int32_t ex = wf_get(ge, ge->D, k + 1);
+			aln_push(A, a[x - k - 1], '-');
+			k++;
+			if(ex == x) s -= p->e;
+			else{ st = WFA_M; s -= p->o + p->e; }
+		}
+	}
+	for(t = 0; t < (A->l - l0) / 2; t++){
+		size_t u = A->l - 1 - t;
+		char c = A->a[l0 + t]; A->a[l0 + t] = A->a[u]; A->a[u] = c;
+		c = A->b[l0 + t]; A->b[l0 + t] = A->b[u]; A->b[u] = c;
+	}
+}
+
+/*
+ * full WFA of a (sub-)problem with traceback; returns its penalty or
+ * -1 when the wavefronts outgrow max_bytes
+ */
+static int
+wfa_full(const wfa_pen_t *p, const char *a, const char *b, int m, int n, int start, int end, int lead, size_t max_bytes, wfa_aln_t *A){
+	wfa_t W;
+	int s;
+	wfa_init(&W, p, a, b, m, n, start, end, lead, 0);
+	W.max_bytes = max_bytes;
+	if((s = wfa_run(&W)) >= 0) wfa_trace(&W, s, A);
+	wfa_free(&W);
+	return s;
+}
+
+typedef struct {
+	int score;                  // penalty of the whole path through the breakpoint
+	int sf, sr;                 // penalties of the forward and reverse halves
+	int k, f;                   // diagonal and offset j of the forward half's end
+	int st;                     // state the path is in at the breakpoint
+} wfa_bp_t;
+
+/*
+ * record where forward wavefront F (penalty sf) and reverse wavefront
+ * R (penalty sr) meet: the forward path reaches at least as far down
+ * a diagonal as the reverse one comes back up it. Both in a gap count
+ * its opening twice.
+ */
+static void
+wfa_cross(const wfa_pen_t *p, const wf_t *F, int sf, const wf_t *R, int sr, int m, int n, wfa_bp_t *bp){
+	int k, lo = F->lo, hi = F->hi;
+	if(F->lo > F->hi || R->lo > R->hi) return; // an empty wavefront has lo/hi at INT_MAX/INT_MIN
+	if(lo < n - m - R->hi) lo = n - m - R->hi;
+	if(hi > n - m - R->lo) hi = n - m - R->lo;
+	for(k = lo; k <= hi; k++){
+		const int kr = n - m - k;
+		int32_t f = F->M[k - F->lo], r = R->M[kr - R->lo];
+		if(f >= 0 && r >= 0 && f + r >= n && sf + sr < bp->score){
+			bp->score = sf + sr; bp->sf = sf; bp->sr = sr; bp->k = k; bp->f = f; bp->st = WFA_M;
+		}
+		f = F->I[k - F->lo]; r = R->I[kr - R->lo];
+		if(f >= 0 && r >= 0 && f + r >= n && sf + sr - p->o < bp->score){
+			bp->score = sf + sr - p->o; bp->sf = sf; bp->sr = sr; bp->k = k; bp->f = f; bp->st = WFA_I;
+		}
+		f = F->D[k - F->lo]; r = R->D[kr - R->lo];
+		if(f >= 0 && r >= 0 && f + r >= n && sf + sr - p->o < bp->score){
+			bp->score = sf + sr - p->o; bp->sf = sf; bp->sr = sr; bp->k = k; bp->f = f; bp->st = WFA_D;
+		}
+	}
+}
+
+/* furthest anti-diagonal i+j a wavefront reaches */
+static inline int
+wf_reach(const wf_t *w){
+	int k, r = -1;
+	for(k = w->lo; k <= w->hi; k++) if(w->M[k - w->lo] >= 0 && 2 * w->M[k - w->lo] - k > r) r = 2 * w->M[k - w->lo] - k;
+	return r;
+}
+
+/*
+ * BiWFA breakpoint: run WFA forward on a/b and backward on their
+ * reverses ra/rb, one penalty at a time each, and check every new
+ * wavefront against the last few of the other direction.
+ *
+ * Along an optimal path of penalty S the forward penalty rises and the
+ * reverse one falls by at most one operation per step, so some cell
+ * on it has the two within win of each other, both wavefronts reach
+ * it and the pair is checked. The search stops once no pair left to
+ * check can beat the best meeting found.
+ */
+static void
+wfa_breakpoint(const wfa_pen_t *p, const char *a, const char *b, const char *ra, const char *rb, int m, int n, int start, int end, int lead, wfa_bp_t *bp){
+	int win = wfa_scope(p) - 1, sf = 0, sr = 0, t, reach_f, reach_r;
+	if(lead >= 0 && lead + p->e > win) win = lead + p->e;
+	win += p->o + 1;
+	wfa_t F, R;
+	wfa_init(&F, p, a, b, m, n, start, WFA_M, lead, win);
+	wfa_init(&R, p, ra, rb, m, n, end, WFA_M, -1, win);
+	bp->score = INT_MAX;
+	wfa_next(&F, 0);
+	wfa_next(&R, 0);
+	reach_f = wf_reach(wfa_at(&F, 0));
+	reach_r = wf_reach(wfa_at(&R, 0));
+	if(reach_f + reach_r >= m + n) wfa_cross(p, wfa_at(&F, 0), 0, wfa_at(&R, 0), 0, m, n, bp);
+	while(bp->score == INT_MAX || (long)sf + sr + 2 - win - p->o < bp->score){
+		wfa_next(&F, ++sf);
+		t = wf_reach(wfa_at(&F, sf));
+		if(t > reach_f) reach_f = t;
+		if(reach_f + reach_r >= m + n)
+			for(t = sr - win + 1 < 0 ? 0 : sr - win + 1; t <= sr; t++) wfa_cross(p, wfa_at(&F, sf), sf, wfa_at(&R, t), t, m, n, bp);
+		if(bp->score != INT_MAX && (long)sf + sr + 2 - win - p->o >= bp->score) break;
+		wfa_next(&R, ++sr);
+		t = wf_reach(wfa_at(&R, sr));
+		if(t > reach_r) reach_r = t;
+		if(reach_f + reach_r >= m + n)
+			for(t = sf - win + 1 < 0 ? 0 : sf - win + 1; t <= sf; t++) wfa_cross(p, wfa_at(&F, t), t, wfa_at(&R, sr), sr, m, n, bp);
+	}
+	wfa_free(&F);
+	wfa_free(&R);
+}
+
+/*
+ * BiWFA of a/b (ra/rb their reverses) from state start to state end;
+ * hint is the expected penalty, -1 if unknown. Returns the penalty.
+ */
+static int
+wfa_bi(const wfa_pen_t *p, const char *a, const char *b, const char *ra, const char *rb, int m, int n, int start, int end, int lead, int hint, wfa_aln_t *A){
+	wfa_bp_t bp;
+	if(m == 0 || n == 0 || (hint >= 0 && hint <= WFA_BI_BASE)) return wfa_full(p, a, b, m, n, start, end, lead, 0, A);
+	wfa_breakpoint(p, a, b, ra, rb, m, n, start, end, lead, &bp);
+	const int j = bp.f, i = bp.f - bp.k;
+	// a meeting at either corner would not shrink the problem
+	if(bp.score <= WFA_BI_BASE || (i == 0 && j == 0) || (i == m && j == n))
+		return wfa_full(p, a, b, m, n, start, end, lead, 0, A);
+	wfa_bi(p, a, b, ra + (m - i), rb + (n - j), i, j, start, bp.st, lead, bp.sf, A);
+	wfa_bi(p, a + i, b + j, ra, rb, m - i, n - j, bp.st, end, -1, bp.sr, A);
+	return bp.score;
+}
+
+/*
+ * score of the alignment in A under align_gla()'s scoring, after
+ * turning every gap that runs straight into the other kind into an
+ * aligned pair (never worse when u >= 2e, and what align_gla() would
+ * draw); writes it to r1/r2
+ */
+static double
+wfa_output(wfa_aln_t *A, kstring_t *r1, kstring_t *r2, const opt_t *opt){
+	size_t i, l = 0;
+	double score = 0;
+	int gap = 0; // 1 in a gap of s2, 2 in a gap of s1
+	for(i = 0; i < A->l; i++){
+		char x = A->a[i], y = A->b[i];
+		if(l > 0 && ((x == '-' && A->b[l-1] == '-') || (y == '-' && A->a[l-1] == '-'))){
+			if(x == '-') A->b[l-1] = y; else A->a[l-1] = x;
+			continue;
+		}
+		A->a[l] = x; A->b[l++] = y;
+	}
+	for(i = 0; i < l; i++){
+		char x = A->a[i], y = A->b[i];
+		int g = x == '-' ? 1 : y == '-' ? 2 : 0;
+		if(g == 0) score += x == y ? opt->m : opt->u;
+		else score += (g == gap) ? opt->e : (i == 0 ? opt->o + opt->e : opt->o);
+		gap = g;
+	}
+	r1->s = realloc(r1->s, l + 1);
+	r2->s = realloc(r2->s, l + 1);
+	if(r1->s == NULL || r2->s == NULL) die("wfa_output: fail to allocate %zu columns", l);
+	memcpy(r1->s, A->a, l); r1->s[l] = '\0'; r1->l = l;
+	memcpy(r2->s, A->b, l); r2->s[l] = '\0'; r2->l = l;
+	r1->m = r2->m = l + 1;
+	return score;
+}
+
+/*
+ * global alignment, full WFA (bi == false, switching to BiWFA when the
+ * wavefronts outgrow the memory budget) or BiWFA
+ */
+static double
+wfa_global(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt, bool bi){
+	if(s1 == NULL || s2 == NULL || r1 == NULL || r2 == NULL || opt == NULL) die("wfa_global: parameter error\n");
+	if(wfa_exact(opt) == false || s1->l > INT_MAX / 2 || s2->l > INT_MAX / 2) return plan_align(KMODE_GLOBAL, s1, s2, r1, r2, opt);
+	const int m = s1->l, n = s2->l;
+	wfa_pen_t p;
+	wfa_aln_t A = {NULL, NULL, 0, 0};
+	int s = -1;
+	wfa_pen(opt, &p);
+	const int lead = p.o - 2 * opt->e;
+	STATS_BEGIN(STATS_FILL);
+	if(bi == false) s = wfa_full(&p, s1->s, s2->s, m, n, WFA_M, WFA_M, lead, plan_budget(opt), &A);
+	if(s < 0){
+		char *ra = mycalloc(m + 1, char), *rb = mycalloc(n + 1, char);
+		int t;
+		for(t = 0; t < m; t++) ra[t] = s1->s[m - 1 - t];
+		for(t = 0; t < n; t++) rb[t] = s2->s[n - 1 - t];
+		A.l = 0;
+		s = wfa_bi(&p, s1->s, s2->s, ra, rb, m, n, WFA_M, WFA_M, lead, -1, &A);
+		free(ra);
+		free(rb);
+	}
+	STATS_END(STATS_FILL);
+	STATS_BEGIN(STATS_TRACE);
+	double score = wfa_output(&A, r1, r2, opt);
+	STATS_END(STATS_TRACE);
+	free(A.a);
+	free(A.b);
+	// a consistency check on the halves; the planner is exact
+	if(2 * score != (double)opt->m * (m + n) - s){
+		// the engines write into buffers of m+n bytes
+		free(r1->s);
+		free(r2->s);
+		r1->s = mycalloc(m + n + 1, char);
+		r2->s = mycalloc(m + n + 1, char);
+		r1->l = r2->l = 0;
+		r1->m = r2->m = m + n + 1;
+		return plan_align(KMODE_GLOBAL, s1, s2, r1, r2, opt);
+	}
+	return score;
+}
+
+double
+align_gla_wfa(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	return wfa_global(s1, s2, r1, r2, opt, false);
+}
+
+double
+align_gla_biwfa(kstring_t *s1, kstring_t *s2, kstring_t *r1, kstring_t *r2, opt_t *opt){
+	return wfa_global(s1, s2, r1, r2, opt, true);
+}
+
+/*
+ * edit_dist() by score-only WFA (mismatch opt->u >= 1, indel 1); -1
+ * when it would take more than max_work cells (0 for no limit)
+ */
+long
+edit_wfa(const kstring_t *s1, const kstring_t *s2, const opt_t *opt, double max_work){
+	if(s1 == NULL || s2 == NULL || opt == NULL) die("edit_wfa: parameter error\n");
+	if(opt->u < 1 || s1->l > INT_MAX / 2 || s2->l > INT_MAX / 2) return -1;
+	wfa_pen_t p = {opt->u, 0, 1};
+	wfa_t W;
+	int s;
+	wfa_init(&W, &p, s1->s, s2->s, s1->l, s2->l, WFA_M, WFA_M, -1, wfa_scope(&p));
+	W.max_work = max_work;
+	STATS_BEGIN(STATS_FILL);
+	s = wfa_run(&W);
+	STATS_END(STATS_FILL);
+	STATS_CELLS(W.work);
+	wfa_free(&W);
+	return s;
+}
@@ -0,0 +1,144 @@
+#!/bin/sh
+#----------------------------------------------------------------------
+# run.sh, run by `make test`
+# Every engine the planner or a flag can pick claims the score of the
+# default path. This aligns the pairs in test/ and a few generated
+# ones (written to test/gen/) through the default path and through -d,
+# -w, -W, -t, -q and -M budgets that leave only ckpt or hirsch, and
+# fails when any score differs. The generated pairs are seeded, so
+# every run sees the same bases.
+#----------------------------------------------------------------------
+BIN=${1:-bin/alignTools}
+DIR=$(dirname "$0")
+GEN=$DIR/gen
+fail=0
+n=0
+
+[ -x "$BIN" ] || { echo "run.sh: no $BIN, run make first" >&2; exit 1; }
+mkdir -p "$GEN"
+
+# the scores printed by an alignment, one per line: score=X,
+# edit_distance=X or X alone (overlap); nothing when it failed
+scores(){
+	"$BIN" "$@" 2>/dev/null | awk '/^score=/{ sub(/^score=/, ""); print; next }
+		/^edit_distance=/{ sub(/^edit_distance=/, ""); print; next }
+		/^-?[0-9]+(\.[0-9]+)?$/{ print }'
+}
+
+# check "ARGS" "ARGS" ...: every ARGS gives the scores of the first
+check(){
+	ref=$(scores $1)
+	n=$((n + 1))
+	if [ -z "$ref" ]; then
+		echo "FAIL  $1: no score"
+		fail=$((fail + 1))
+		return
+	fi
+	first=$1
+	was=$fail
+	shift
+	for a in "$@"; do
+		n=$((n + 1))
+		got=$(scores $a)
+		if [ "$got" != "$ref" ]; then
+			echo "FAIL  $a: $(echo $got) != $(echo $ref) of $first"
+			fail=$((fail + 1))
+		fi
+	done
+	[ $fail -eq $was ] && echo "ok    $first ($# more)"
+}
+
+# gen SEED KIND LEN IDENT > fa: s2 random, s1 made from it with
+# (100-IDENT)% errors as bench.c does: whole with a 2 kb deletion
+# (global), a read (fit), a read over two exons with the intron as
+# junction sites (splice), or embedded in random flanks (local)
+gen(){
+	awk -v seed="$1" -v kind="$2" -v len="$3" -v ident="$4" '
+	function rnd(l,   s){ s = ""; while(l-- > 0) s = s substr("ACGT", int(rand() * 4) + 1, 1); return s }
+	function mut(t,   i, s, c, r){
+		s = ""
+		for(i = 1; i <= length(t); i++){
+			c = substr(t, i, 1)
+			if(rand() * 100 >= 100 - ident){ s = s c; continue }
+			r = rand()
+			if(r < 0.1) s = s substr("ACGT", int(rand() * 4) + 1, 1) c
+			else if(r >= 0.2) s = s substr("CGTA", index("ACGT", c), 1)
+		}
+		return s
+	}
+	BEGIN{
+		srand(seed)
+		t = rnd(len); h = ""
+		if(kind == "global") s = mut(substr(t, 1, len * 0.4)) mut(substr(t, len * 0.6 + 1))
+		else if(kind == "fit") s = mut(substr(t, len / 3 + 1, len / 5))
+		else if(kind == "splice"){
+			s = mut(substr(t, len / 10 + 1, len / 10)) mut(substr(t, len * 0.6 + 1, len / 10))
+			h = " " (len / 5) "|" (len * 0.6)
+		}else s = rnd(len / 10) mut(substr(t, len / 4 + 1, len / 2)) rnd(len / 10)
+		printf(">s1\n%s\n>s2%s\n%s\n", s, h, t)
+	}'
+}
+
+# reads: the s1 of several fit pairs of one target, and that target
+reads(){
+	: > "$GEN/reads.fa"
+	for i in 1 2 3 4 5; do
+		gen $((40 + i)) fit 3000 $((75 + 5 * i)) > "$GEN/r.fa"
+		awk -v i=$i 'NR == 1{ print ">r" i } NR == 2' "$GEN/r.fa" >> "$GEN/reads.fa"
+		# the same read against the target of seed 41
+		awk 'NR <= 2' "$GEN/r.fa" > "$GEN/read$i.fa"
+	done
+	gen 41 fit 3000 80 | awk 'NR > 2' > "$GEN/target.fa"
+	for i in 1 2 3 4 5; do cat "$GEN/target.fa" >> "$GEN/read$i.fa"; done
+}
+
+# the pairs in test/
+check "global $DIR/test_global.fa" "global -d $DIR/test_global.fa" "global -w $DIR/test_global.fa" "global -W $DIR/test_global.fa"
+check "local $DIR/test_local.fa" "local -t $DIR/test_local.fa"
+check "local $DIR/test_global.fa" "local -t $DIR/test_global.fa" "local -M 64K $DIR/test_global.fa"
+check "fit $DIR/test_fit.fa" "fit -d $DIR/test_fit.fa" "fit -t $DIR/test_fit.fa" "fit -M 10M $DIR/test_fit.fa"
+check "fit -s $DIR/test_fit.fa" "fit -s -t $DIR/test_fit.fa" "fit -s -M 10M $DIR/test_fit.fa"
+check "fit -s -p $DIR/test_fit.fa" "fit -s -p -M 16M $DIR/test_fit.fa"
+
+# generated pairs; at these sizes -M 16M (8M for fit) leaves ckpt and
+# -M 4M only hirsch
+gen 1 global 10000 90 > "$GEN/global.fa"
+gen 2 local 10000 85 > "$GEN/local.fa"
+gen 3 fit 10000 90 > "$GEN/fit.fa"
+gen 4 splice 10000 95 > "$GEN/splice.fa"
+check "global $GEN/global.fa" "global -d $GEN/global.fa" "global -w $GEN/global.fa" "global -W $GEN/global.fa" \
+	"global -M 16M $GEN/global.fa" "global -M 4M $GEN/global.fa"
+check "local $GEN/local.fa" "local -t $GEN/local.fa" "local -M 16M $GEN/local.fa" "local -M 4M $GEN/local.fa"
+check "fit $GEN/fit.fa" "fit -d $GEN/fit.fa" "fit -t $GEN/fit.fa" "fit -M 8M $GEN/fit.fa" "fit -M 4M $GEN/fit.fa"
+check "fit -s $GEN/splice.fa" "fit -s -t $GEN/splice.fa" "fit -s -M 8M $GEN/splice.fa"
+check "fit -s -p $GEN/splice.fa" "fit -s -p -M 12M $GEN/splice.fa"
+for i in 1 2 3 4 5 6 7 8; do
+	gen $((10 + i)) global $((100 * i)) $((70 + 3 * i)) > "$GEN/g$i.fa"
+	check "global $GEN/g$i.fa" "global -d $GEN/g$i.fa" "global -w $GEN/g$i.fa" "global -W $GEN/g$i.fa"
+done
+
+# -q against one pair at a time
+reads
+one=$(for i in 1 2 3 4 5; do scores fit "$GEN/read$i.fa"; done)
+for a in "-T 1" "-T 3"; do
+	n=$((n + 1))
+	got=$(scores fit -q "$GEN/reads.fa" $a "$GEN/target.fa")
+	if [ "$got" != "$one" ]; then
+		echo "FAIL  fit -q $a: $(echo $got) != $(echo $one) one pair at a time"
+		fail=$((fail + 1))
+	else
+		echo "ok    fit -q $a $GEN/reads.fa"
+	fi
+done
+one=$(for i in 1 2 3 4 5; do scores local "$GEN/read$i.fa"; done)
+n=$((n + 1))
+got=$(scores local -q "$GEN/reads.fa" "$GEN/target.fa")
+if [ "$got" != "$one" ]; then
+	echo "FAIL  local -q: $(echo $got) != $(echo $one) one pair at a time"
+	fail=$((fail + 1))
+else
+	echo "ok    local -q $GEN/reads.fa"
+fi
+
+echo "$fail of $n alignments gave another score"
+[ $fail -eq 0 ]